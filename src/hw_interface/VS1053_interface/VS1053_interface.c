@@ -26,6 +26,9 @@ LOG_MODULE_REGISTER(MODULE);
 #define SCI_READ_FLAG 0x03
 #define SCI_WRITE_FLAG 0x02
 #define SDI_MAX_PACKET_LEN 256
+// Bytes the VS1053 FIFO is guaranteed to take each time DREQ is high
+#define SDI_DREQ_CHUNK_LEN 32
+#define VS_DREQ_TIMEOUT_US 10000
 
 // Node labels
 #define VS_SPI_DEVICE DT_NODELABEL(vs1053_spi)
@@ -58,6 +61,11 @@ const uint16_t chipNumber[16] = {1001, 1011, 1011, 1003, 1053, 1033, 1063, 1103,
 // Global SPI completion flag
 static volatile bool spi_xfer_done = false;
 
+// SCI and SDI share the bus and now run from more than one thread (the SDI MIDI
+// worker and the UI), so every transfer holds this. It is recursive, which lets
+// a burst hold it across several transfers.
+K_MUTEX_DEFINE(vs_spi_mutex);
+
 // for debugging in function
 static bool debug = false;
 
@@ -92,15 +100,18 @@ void app_spi_xfer(spi_xfer_type_t type, uint8_t* tx_dat, uint8_t* rx_dat, uint8_
     struct spi_buf rx_buf = {.buf = rx_dat, .len = len};
     struct spi_buf_set rx_buf_set = {.buffers = &rx_buf, .count = 1};
     
+    if(type != SPI_DATA && type != SPI_CTRL) {
+        LOG_ERR("Invalid SPI transfer type");
+        return;
+    }
+
+    k_mutex_lock(&vs_spi_mutex, K_FOREVER);
+
     // Assert correct chip select BEFORE transfer
     if(type == SPI_DATA) {
         gpio_pin_set_dt(&vs_gpio_dcs, 0);  // Assert DCS (active low)
-    } else if(type == SPI_CTRL) {
-        gpio_pin_set_dt(&vs_gpio_mcs, 0);  // Assert MCS
     } else {
-        LOG_ERR("Invalid SPI transfer type");
-        err = -EINVAL;
-        return;
+        gpio_pin_set_dt(&vs_gpio_mcs, 0);  // Assert MCS
     }
     
     // Small delay to ensure CS setup time
@@ -131,6 +142,8 @@ void app_spi_xfer(spi_xfer_type_t type, uint8_t* tx_dat, uint8_t* rx_dat, uint8_
     } else if(type == SPI_CTRL) {
         gpio_pin_set_dt(&vs_gpio_mcs, 1);  // Deassert MCS
     }
+
+    k_mutex_unlock(&vs_spi_mutex);
 }
 
 //< VS1053 Serial Control Interface Write
@@ -222,6 +235,51 @@ int VS1053WriteSdi(const uint8_t *data, uint8_t len) {
     return 0;
 }
 
+//< VS1053 real-time MIDI over SDI
+/*
+* @brief
+* sends @param len raw MIDI bytes from @param midi to the real-time MIDI plugin.
+* The plugin reads SDI as 16-bit words with the MIDI byte in the low half, so
+* each byte goes out as 0x00, byte. The whole block is sent as one burst,
+* split into 32 byte chunks that each wait for DREQ.
+*/
+int VS1053WriteSdiMidi(const uint8_t *midi, uint16_t len) {
+    uint8_t chunk[SDI_DREQ_CHUNK_LEN];
+    uint16_t i = 0;
+    int err = 0;
+
+    if (midi == NULL) {
+        return -EINVAL;
+    }
+
+    k_mutex_lock(&vs_spi_mutex, K_FOREVER);
+
+    while (i < len) {
+        uint8_t n = 0;
+        while (i < len && n < SDI_DREQ_CHUNK_LEN) {
+            chunk[n++] = 0x00;
+            chunk[n++] = midi[i++];
+        }
+
+        uint32_t waited = 0;
+        while (!gpio_pin_get_dt(&vs_gpio_dreq)) {
+            if (waited >= VS_DREQ_TIMEOUT_US) {
+                LOG_ERR("DREQ stuck low, dropped %d MIDI bytes", len - i + n / 2);
+                err = -ETIMEDOUT;
+                goto out;
+            }
+            k_busy_wait(10);
+            waited += 10;
+        }
+
+        app_spi_xfer(SPI_DATA, chunk, NULL, n);
+    }
+
+out:
+    k_mutex_unlock(&vs_spi_mutex);
+    return err;
+}
+
 /**< miscellaneous - begin >**/
 
 //< VS1053 load plugin
@@ -21,6 +21,7 @@ void VS1053UpdateVolume(int8_t volumeL, int8_t volumeR);
 void VS1053WriteSci(uint8_t addr, uint16_t data);
 uint16_t VS1053ReadSci(uint8_t addr);
 int VS1053WriteSdi(const uint8_t *data, uint8_t len);
+int VS1053WriteSdiMidi(const uint8_t *midi, uint16_t len);
 void VS1053WriteMem(uint16_t addr, uint16_t data);
 uint16_t VS1053ReadMem(uint16_t addr);
 uint8_t VS1053HardwareReset(void);
@@ -5,9 +5,52 @@
 #include "VS1053_interface.h"
 #include "uart_interface.h"
 #include "midi.h"
+#include "midi_scheduler.h"
+#include "midi_sdi.h"
+#include "midi_voice.h"
+#include "latency_probe.h"
+#include "midi_recorder.h"
+
+#include <string.h>
 
 LOG_MODULE_REGISTER(midi_test, LOG_LEVEL_INF);
 
+// The UART TX ring has a single producer; notes can come from several threads
+// (and timer ISRs) so the hand-off is serialized here. The critical section is
+// just the copy into the ring, nothing in it waits on the wire.
+static struct k_spinlock midi_tx_lock;
+
+// Output transport, only changed under midi_tx_lock
+static midi_transport_t midi_transport = MIDI_TRANSPORT_DEFAULT;
+
+// Running-status encoder state, only touched under midi_tx_lock
+static bool midi_rs_enabled = MIDI_RUNNING_STATUS_DEFAULT;
+static uint8_t midi_rs_status;      // status byte the receiver is running on, 0 if none
+static uint32_t midi_rs_abort_seq;  // UART abort count the state above is valid for
+
+// Notes currently sounding, one bit per note per channel. Written under
+// midi_tx_lock as messages are queued; single-word reads need no lock.
+static uint32_t midi_active_notes[16][NUM_MIDI_NOTES / 32];
+static uint16_t midi_used_channels;  // channels that saw a Note On since the last cleanup
+
+// Controller lane, only touched under midi_tx_lock. Sent values are stored +1
+// so that 0 means the receiver's value is unknown.
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} midi_lane_slot_t;
+
+static midi_lane_slot_t midi_lane[MIDI_LANE_SLOTS];
+static uint8_t midi_lane_count;
+static uint16_t midi_lane_chans;    // channels with something waiting
+static uint8_t midi_cc_sent[16][128];
+static uint8_t midi_prog_sent[16];
+static midi_lane_stats_t midi_lane_stats;
+
+static void midi_lane_work_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(midi_lane_work, midi_lane_work_handler);
+
 // Standard MIDI Notes (Middle C = 60)
 #define MIDI_NOTE_C3    48
 #define MIDI_NOTE_C4    60   // Middle C
@@ -19,11 +62,523 @@ LOG_MODULE_REGISTER(midi_test, LOG_LEVEL_INF);
 #define MIDI_NOTE_A4    69   // A440
 #define MIDI_NOTE_B4    71
 
-// VS1053 MIDI Implementation using your header definitions
-void midi_send_byte(uint8_t data) {
+// Number of bytes (status included) in a message starting with @p status,
+// 0 for anything that isn't a complete short message we know how to build
+uint8_t midi_msg_length(uint8_t status) {
+    if (status < 0x80) {
+        return 0;
+    }
+
+    switch (status & 0xF0) {
+        case note_off:
+        case note_on:
+        case poly_aftertouch:
+        case control_change:
+        case pitch_wheel:
+            return 3;
+        case program_chng:
+        case channel_aftertouch:
+            return 2;
+        default:
+            break;
+    }
+
+    // System Common / Real-Time
+    switch (status) {
+        case 0xF1: // MTC quarter frame
+        case 0xF3: // Song select
+            return 2;
+        case 0xF2: // Song position pointer
+            return 3;
+        case 0xF6: // Tune request
+        case 0xF8: case 0xFA: case 0xFB: case 0xFC: case 0xFE: case 0xFF:
+            return 1;
+        default:
+            // SysEx (0xF0/0xF7) and undefined status bytes are not short messages
+            return 0;
+    }
+}
+
+void midi_group_init(midi_tx_group_t *group) {
+    group->len = 0;
+    group->traced = false;
+}
+
+// Drop status bytes the receiver already has. Must run under midi_tx_lock so
+// the encoder state follows the exact byte order going into the UART ring.
+// Output is never longer than the input.
+static uint8_t midi_rs_encode(const uint8_t *in, uint8_t len, uint8_t *out) {
+    uint8_t n = 0;
+
+    // An abort may have eaten the status byte we are running on
+    uint32_t abort_seq = uart_midi_tx_abort_seq();
+    if (abort_seq != midi_rs_abort_seq) {
+        midi_rs_abort_seq = abort_seq;
+        midi_rs_status = 0;
+    }
+
+    for (uint8_t i = 0; i < len; ) {
+        uint8_t status = in[i];
+        uint8_t msg_len = midi_msg_length(status);
+
+        if (status >= 0xF8) {
+            // System Real-Time may sit anywhere and doesn't touch running status
+            out[n++] = in[i++];
+            continue;
+        }
+
+        if (status >= 0xF0) {
+            // System Common cancels running status
+            memcpy(&out[n], &in[i], msg_len);
+            n += msg_len;
+            i += msg_len;
+            midi_rs_status = 0;
+            continue;
+        }
+
+        uint8_t data1 = in[i + 1];
+        uint8_t data2 = (msg_len > 2) ? in[i + 2] : 0;
+
+        // Note Off as Note On velocity 0 keeps a run of note events going
+        if ((status & 0xF0) == note_off && midi_rs_status == (note_on | (status & 0x0F))) {
+            status = midi_rs_status;
+            data2 = 0;
+        }
+
+        if (status != midi_rs_status) {
+            out[n++] = status;
+            midi_rs_status = status;
+        }
+        out[n++] = data1;
+        if (msg_len > 2) {
+            out[n++] = data2;
+        }
+        i += msg_len;
+    }
+
+    return n;
+}
+
+void midi_set_running_status(bool enable) {
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    midi_rs_enabled = enable;
+    midi_rs_status = 0;
+    k_spin_unlock(&midi_tx_lock, key);
+
+    LOG_INF("MIDI running status %s", enable ? "on" : "off");
+}
+
+// Forget every controller and program value the receiver is assumed to have.
+// Call with midi_tx_lock held.
+static void midi_sent_reset_locked(void) {
+    memset(midi_cc_sent, 0, sizeof(midi_cc_sent));
+    memset(midi_prog_sent, 0, sizeof(midi_prog_sent));
+}
+
+static int midi_transport_flush(midi_transport_t transport, k_timeout_t timeout) {
+    return transport == MIDI_TRANSPORT_SDI ? midi_sdi_flush(timeout)
+                                           : uart_midi_tx_flush(timeout);
+}
+
+int midi_set_transport(midi_transport_t transport) {
+    if (transport == MIDI_TRANSPORT_SDI && !midi_sdi_ready()) {
+        return -ENODEV;
+    }
+
+    midi_transport_t old = midi_get_transport();
+    if (old == transport) {
+        return 0;
+    }
+
+    // New messages must not overtake ones still queued on the old path
+    if (midi_transport_flush(old, K_MSEC(100)) != 0) {
+        LOG_WRN("MIDI transport didn't drain before switching");
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    midi_transport = transport;
+    midi_rs_status = 0;
+    // The other path may lead to a receiver in a different state
+    midi_sent_reset_locked();
+    k_spin_unlock(&midi_tx_lock, key);
+
+    LOG_INF("MIDI output over %s", transport == MIDI_TRANSPORT_SDI ? "SDI" : "UART");
+    return 0;
+}
+
+midi_transport_t midi_get_transport(void) {
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    midi_transport_t transport = midi_transport;
+    k_spin_unlock(&midi_tx_lock, key);
+
+    return transport;
+}
+
+// Keep the active-note table and the sent controller values in step with a
+// group just queued, whichever path it came from. Call with midi_tx_lock held.
+static void midi_track_notes(const midi_tx_group_t *group) {
+    for (uint8_t i = 0; i < group->len; ) {
+        uint8_t status = group->buf[i];
+        uint8_t chan = status & 0x0F;
+        uint8_t note = group->buf[i + 1];
+
+        switch (status & 0xF0) {
+            case note_on:
+                if (group->buf[i + 2] != 0) {
+                    midi_active_notes[chan][note / 32] |= BIT(note % 32);
+                    midi_used_channels |= BIT(chan);
+                    break;
+                }
+                // Velocity 0 is a Note Off, fall through
+            case note_off:
+                midi_active_notes[chan][note / 32] &= ~BIT(note % 32);
+                break;
+            case control_change:
+                // All Sound Off / All Notes Off
+                if (note == 0x78 || note == 0x7B) {
+                    memset(midi_active_notes[chan], 0, sizeof(midi_active_notes[chan]));
+                }
+                if (note == 0x79) {
+                    // Reset All Controllers puts them back to values we don't track
+                    memset(midi_cc_sent[chan], 0, sizeof(midi_cc_sent[chan]));
+                } else {
+                    midi_cc_sent[chan][note] = group->buf[i + 2] + 1;
+                }
+                break;
+            case program_chng:
+                midi_prog_sent[chan] = note + 1;
+                break;
+            default:
+                break;
+        }
+        i += midi_msg_length(status);
+    }
+}
+
+bool midi_note_is_active(uint8_t chan, uint8_t note) {
+    if (chan > 15 || note > 127) return false;
+
+    return (midi_active_notes[chan][note / 32] & BIT(note % 32)) != 0;
+}
+
+uint8_t midi_active_note_count(uint8_t chan) {
+    uint8_t count = 0;
+
+    if (chan > 15) return 0;
+
+    for (int w = 0; w < NUM_MIDI_NOTES / 32; w++) {
+        count += __builtin_popcount(midi_active_notes[chan][w]);
+    }
+    return count;
+}
+
+uint16_t midi_active_channels(void) {
+    uint16_t mask = 0;
+
+    for (int ch = 0; ch < 16; ch++) {
+        for (int w = 0; w < NUM_MIDI_NOTES / 32; w++) {
+            if (midi_active_notes[ch][w]) {
+                mask |= BIT(ch);
+                break;
+            }
+        }
+    }
+    return mask;
+}
+
+// Hand a group to the current transport. Call with midi_tx_lock held.
+static int midi_tx_send_locked(const midi_tx_group_t *group) {
+    int err;
+
+    if (midi_transport == MIDI_TRANSPORT_SDI) {
+        // SPI is fast enough that dropping status bytes buys nothing
+        err = midi_sdi_send(group->buf, group->len, group->traced);
+    } else if (midi_rs_enabled) {
+        uint8_t encoded[MIDI_TX_GROUP_SIZE];
+        uint8_t prev_status = midi_rs_status;
+        uint8_t len = midi_rs_encode(group->buf, group->len, encoded);
+
+        err = uart_send_midi_data(encoded, len, group->traced);
+        if (err) {
+            // Nothing was queued, so the receiver is still where it was
+            midi_rs_status = prev_status;
+        }
+    } else {
+        err = uart_send_midi_data(group->buf, group->len, group->traced);
+    }
+    if (!err) {
+        midi_track_notes(group);
+        // A copy into RAM, file I/O happens on the recorder's own thread
+        midi_recorder_tap(group->buf, group->len);
+    }
+
+    return err;
+}
+
+// Bytes still waiting for the wire on the current transport
+static uint32_t midi_tx_queued(void) {
+    if (midi_transport == MIDI_TRANSPORT_SDI) {
+        midi_sdi_stats_t stats;
+        midi_sdi_get_stats(&stats);
+        return stats.queued;
+    }
+
+    uart_midi_tx_stats_t stats;
+    uart_midi_get_tx_stats(&stats);
+    return stats.queued;
+}
+
+// Lane drain order: bank select, then other controllers, then program change,
+// so a program change always lands on the bank chosen with it
+static uint8_t midi_lane_rank(const midi_lane_slot_t *slot) {
+    if ((slot->status & 0xF0) == program_chng) {
+        return 2;
+    }
+    return (slot->data1 == 0x00 || slot->data1 == 0x20) ? 0 : 1;
+}
 
-    uart_send_midi_data(&data, 1); 
-    k_msleep(10);
+static void midi_lane_send_locked(const midi_tx_group_t *group) {
+    if (midi_tx_send_locked(group) != 0) {
+        // Some of these never made it, so stop trusting what we think was sent
+        midi_sent_reset_locked();
+        LOG_ERR("MIDI controller lane send failed");
+    }
+}
+
+// Send and remove everything waiting for the channels in @p chans.
+// Call with midi_tx_lock held.
+static void midi_lane_emit_locked(uint16_t chans) {
+    midi_tx_group_t group;
+    midi_group_init(&group);
+
+    for (uint8_t rank = 0; rank < 3; rank++) {
+        uint8_t kept = 0;
+
+        for (uint8_t i = 0; i < midi_lane_count; i++) {
+            midi_lane_slot_t *slot = &midi_lane[i];
+            uint8_t chan = slot->status & 0x0F;
+
+            if (!(chans & BIT(chan)) || midi_lane_rank(slot) != rank) {
+                midi_lane[kept++] = *slot;
+                continue;
+            }
+
+            uint8_t len = midi_msg_length(slot->status);
+            if (group.len + len > MIDI_TX_GROUP_SIZE) {
+                midi_lane_send_locked(&group);
+                group.len = 0;
+            }
+            group.buf[group.len++] = slot->status;
+            group.buf[group.len++] = slot->data1;
+            if (len > 2) {
+                group.buf[group.len++] = slot->data2;
+            }
+            midi_lane_stats.sent++;
+        }
+        midi_lane_count = kept;
+    }
+
+    if (group.len > 0) {
+        midi_lane_send_locked(&group);
+    }
+
+    midi_lane_chans = 0;
+    for (uint8_t i = 0; i < midi_lane_count; i++) {
+        midi_lane_chans |= BIT(midi_lane[i].status & 0x0F);
+    }
+}
+
+static int midi_lane_submit(uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t chan = status & 0x0F;
+    bool is_cc = (status & 0xF0) == control_change;
+    uint8_t value = is_cc ? data2 : data1;
+
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+
+    uint8_t sent = is_cc ? midi_cc_sent[chan][data1] : midi_prog_sent[chan];
+
+    midi_lane_stats.queued++;
+
+    for (uint8_t i = 0; i < midi_lane_count; i++) {
+        midi_lane_slot_t *slot = &midi_lane[i];
+        if (slot->status != status || (is_cc && slot->data1 != data1)) {
+            continue;
+        }
+
+        if (sent == value + 1) {
+            // Back to what the receiver already has, nothing left to send
+            midi_lane[i] = midi_lane[--midi_lane_count];
+            midi_lane_stats.redundant++;
+        } else {
+            slot->data1 = data1;
+            slot->data2 = data2;
+            midi_lane_stats.coalesced++;
+        }
+        k_spin_unlock(&midi_tx_lock, key);
+        return 0;
+    }
+
+    if (sent == value + 1) {
+        midi_lane_stats.redundant++;
+        k_spin_unlock(&midi_tx_lock, key);
+        return 0;
+    }
+
+    if (midi_lane_count == MIDI_LANE_SLOTS) {
+        // Full: let the oldest changes out rather than lose this one
+        midi_lane_emit_locked(0xFFFF);
+    }
+
+    midi_lane[midi_lane_count++] = (midi_lane_slot_t){ status, data1, data2 };
+    midi_lane_chans |= BIT(chan);
+
+    k_spin_unlock(&midi_tx_lock, key);
+
+    // Only the first change starts the holdoff, later ones ride along
+    k_work_schedule(&midi_lane_work, K_MSEC(MIDI_LANE_HOLDOFF_MS));
+    return 0;
+}
+
+static void midi_lane_work_handler(struct k_work *work) {
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+
+    if (midi_lane_count > 0 && midi_tx_queued() > MIDI_LANE_TX_BUSY_BYTES) {
+        // Notes are on the wire, come back once they have gone
+        k_spin_unlock(&midi_tx_lock, key);
+        k_work_schedule(&midi_lane_work, K_MSEC(1));
+        return;
+    }
+
+    midi_lane_emit_locked(0xFFFF);
+    k_spin_unlock(&midi_tx_lock, key);
+}
+
+int midi_lane_control_change(uint8_t chan, uint8_t ctrl, uint8_t val) {
+    if (chan > 15 || ctrl > 127 || val > 127) return -EINVAL;
+
+    return midi_lane_submit(control_change | chan, ctrl, val);
+}
+
+int midi_lane_program_change(uint8_t chan, uint8_t prog) {
+    if (chan > 15 || prog > 127) return -EINVAL;
+
+    return midi_lane_submit(program_chng | chan, prog, 0);
+}
+
+void midi_lane_flush(void) {
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    midi_lane_emit_locked(0xFFFF);
+    k_spin_unlock(&midi_tx_lock, key);
+}
+
+void midi_lane_get_stats(midi_lane_stats_t *stats) {
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    *stats = midi_lane_stats;
+    stats->pending = midi_lane_count;
+    k_spin_unlock(&midi_tx_lock, key);
+}
+
+// Channels a group plays notes on
+static uint16_t midi_group_note_chans(const midi_tx_group_t *group) {
+    uint16_t chans = 0;
+
+    for (uint8_t i = 0; i < group->len; i += midi_msg_length(group->buf[i])) {
+        uint8_t type = group->buf[i] & 0xF0;
+        if (type == note_on || type == note_off) {
+            chans |= BIT(group->buf[i] & 0x0F);
+        }
+    }
+    return chans;
+}
+
+int midi_group_send(midi_tx_group_t *group) {
+    int err = 0;
+
+    if (group->len > 0) {
+        // Queued as one block so the whole group goes out back to back
+        k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+
+        // A note must hear the controller changes made before it
+        if (midi_lane_chans) {
+            uint16_t chans = midi_group_note_chans(group) & midi_lane_chans;
+            if (chans) {
+                midi_lane_emit_locked(chans);
+            }
+        }
+
+        err = midi_tx_send_locked(group);
+        k_spin_unlock(&midi_tx_lock, key);
+        if (group->traced) {
+            latency_probe_mark(LATENCY_STAGE_MIDI_ENCODE);
+        }
+        if (err) {
+            LOG_ERR("MIDI group send failed (%d bytes): %d", group->len, err);
+        }
+        group->len = 0;
+    }
+
+    return err;
+}
+
+int midi_group_add(midi_tx_group_t *group, uint8_t status, uint8_t data1, uint8_t data2) {
+    uint8_t len = midi_msg_length(status);
+    if (len == 0) {
+        return -EINVAL;
+    }
+
+    // Flush what we have rather than split a message across two transfers
+    if (group->len + len > MIDI_TX_GROUP_SIZE) {
+        int err = midi_group_send(group);
+        if (err) {
+            return err;
+        }
+    }
+
+    group->buf[group->len++] = status;
+    if (len > 1) {
+        group->buf[group->len++] = data1 & 0x7F;
+    }
+    if (len > 2) {
+        group->buf[group->len++] = data2 & 0x7F;
+    }
+
+    return 0;
+}
+
+int midi_send_msg(uint8_t status, uint8_t data1, uint8_t data2) {
+    midi_tx_group_t group;
+
+    midi_group_init(&group);
+    int err = midi_group_add(&group, status, data1, data2);
+    if (err) {
+        return err;
+    }
+
+    return midi_group_send(&group);
+}
+
+int midi_group_note_on(midi_tx_group_t *group, uint8_t chan, uint8_t note, uint8_t vel) {
+    if (chan > 15 || note > 127 || vel > 127) return -EINVAL;
+
+    return midi_group_add(group, note_on | chan, note, vel);
+}
+
+int midi_group_note_off(midi_tx_group_t *group, uint8_t chan, uint8_t note, uint8_t vel) {
+    if (chan > 15 || note > 127 || vel > 127) return -EINVAL;
+
+    return midi_group_add(group, note_off | chan, note, vel);
+}
+
+int midi_group_control_change(midi_tx_group_t *group, uint8_t chan, uint8_t ctrl, uint8_t val) {
+    if (chan > 15 || ctrl > 127 || val > 127) return -EINVAL;
+
+    return midi_group_add(group, control_change | chan, ctrl, val);
+}
+
+int midi_group_program_change(midi_tx_group_t *group, uint8_t chan, uint8_t prog) {
+    if (chan > 15 || prog > 127) return -EINVAL;
+
+    return midi_group_add(group, program_chng | chan, prog, 0);
 }
 
 // Implement your MIDI functions for VS1053
@@ -32,8 +587,7 @@ void midiSetInstrument(uint8_t chan, uint8_t inst) {
 
     LOG_INF("MIDI Set Instrument: Ch=%d, Inst=%d", chan, inst);
 
-    midi_send_byte(program_chng | chan);  // Use your header definition
-    midi_send_byte(inst);
+    midi_lane_program_change(chan, inst);
 }
 
 void midiSetChannelVolume(uint8_t chan, uint8_t vol) {
@@ -41,9 +595,7 @@ void midiSetChannelVolume(uint8_t chan, uint8_t vol) {
 
     LOG_INF("MIDI Set Volume: Ch=%d, Vol=%d", chan, vol);
 
-    midi_send_byte(control_change | chan);  // Use your header definition
-    midi_send_byte(0x07);  // Volume controller
-    midi_send_byte(vol);
+    midi_lane_control_change(chan, 0x07, vol);  // Volume controller
 }
 
 void midiSetChannelBank(uint8_t chan, uint8_t bank) {
@@ -51,64 +603,85 @@ void midiSetChannelBank(uint8_t chan, uint8_t bank) {
 
     LOG_INF("MIDI Set Bank: Ch=%d, Bank=%d", chan, bank);
 
-    midi_send_byte(control_change | chan);
-    midi_send_byte((uint8_t)0x00);  // Bank select MSB
-    midi_send_byte(bank);
+    midi_lane_control_change(chan, 0x00, bank);  // Bank select MSB
 }
 
+// Note logging is DBG so the RTT backend stays off the key-press path.
+// Both go through the voice allocator so play modes stay inside the budget.
 void midiNoteOn(uint8_t chan, uint8_t note, uint8_t vel) {
     if (chan > 15 || note > 127 || vel > 127) return;
 
-    LOG_INF("MIDI Note ON: Ch=%d, Note=%d, Vel=%d", chan, note, vel);
+    LOG_DBG("MIDI Note ON: Ch=%d, Note=%d, Vel=%d", chan, note, vel);
 
-    midi_send_byte(note_on | chan);  // Use your header definition
-    midi_send_byte(note);
-    midi_send_byte(vel);
+    midi_voice_note_on(chan, note, vel);
 }
 
 void midiNoteOff(uint8_t chan, uint8_t note, uint8_t vel) {
     if (chan > 15 || note > 127 || vel > 127) return;
 
-    LOG_INF("MIDI Note OFF: Ch=%d, Note=%d, Vel=%d", chan, note, vel);
+    LOG_DBG("MIDI Note OFF: Ch=%d, Note=%d, Vel=%d", chan, note, vel);
 
-    midi_send_byte(note_off | chan);  // Use your header definition
-    midi_send_byte(note);
-    midi_send_byte(vel);
+    midi_voice_note_off(chan, note, vel);
 }
 
 // Additional helper functions
 void midi_all_notes_off(uint8_t channel) {
     LOG_INF("MIDI All Notes Off: Ch=%d", channel);
-    midi_send_byte(control_change | channel);
-    midi_send_byte(0x7B);  // All Notes Off controller
-    midi_send_byte(0x00);
+    midi_send_msg(control_change | channel, 0x7B, 0x00);  // All Notes Off controller
 }
 
 void midi_all_sound_off(uint8_t channel) {
     LOG_INF("MIDI All Sound Off: Ch=%d", channel);
-    midi_send_byte(control_change | channel);
-    midi_send_byte(0x78);  // All Sound Off controller
-    midi_send_byte(0x00);
+    midi_send_msg(control_change | channel, 0x78, 0x00);  // All Sound Off controller
 }
 
 // Test Functions
+//
+// Tests lay their events out on the scheduler relative to a start time t0 and
+// then wait for the queue to drain, so note timing doesn't depend on this
+// thread (or logging) being scheduled on time.
+
+// Head start so the first events aren't late while the rest are queued
+#define MIDI_TEST_LEAD_MS   20
+
+static int64_t test_start(void) {
+    return midi_sched_now() + midi_sched_us_to_ticks(MIDI_TEST_LEAD_MS * 1000ULL);
+}
+
+static void test_msg(int64_t t0, uint32_t at_ms, uint8_t status, uint8_t data1, uint8_t data2) {
+    int err = midi_sched_at(t0 + midi_sched_us_to_ticks(at_ms * 1000ULL), MIDI_SCHED_TAG_TEST,
+                            status, data1, data2);
+    if (err) {
+        LOG_ERR("Failed to schedule test event at %d ms: %d", at_ms, err);
+    }
+}
+
+// A note held for @p dur_ms starting @p at_ms after t0
+static void test_note(int64_t t0, uint32_t at_ms, uint32_t dur_ms, uint8_t chan, uint8_t note, uint8_t vel) {
+    test_msg(t0, at_ms, note_on | chan, note, vel);
+    test_msg(t0, at_ms + dur_ms, note_off | chan, note, 64);
+}
+
+// Wait for everything queued and then until @p end_ms after t0
+static void test_wait(int64_t t0, uint32_t end_ms) {
+    midi_sched_wait_idle(K_FOREVER);
+    k_sleep(K_TIMEOUT_ABS_TICKS(t0 + midi_sched_us_to_ticks(end_ms * 1000ULL)));
+}
+
 void test_single_note(void) {
     LOG_INF("=== Testing Single Note ===");
+    int64_t t0 = test_start();
 
     // Set acoustic grand piano on channel 0 (using your definitions)
-    midiSetInstrument(0, ACOUSTIC_GRAND_PIANO);
-    k_msleep(100);
+    test_msg(t0, 0, program_chng | 0, ACOUSTIC_GRAND_PIANO, 0);
 
     // Set volume to medium
-    midiSetChannelVolume(0, 100);
-    k_msleep(100);
+    test_msg(t0, 100, control_change | 0, 0x07, 100);
 
-    // Play middle C
-    midiNoteOn(0, MIDI_NOTE_C4, 127);
-    k_msleep(1000);  // Hold for 1 second
-    midiNoteOff(0, MIDI_NOTE_C4, 64);
+    // Play middle C, hold for 1 second
+    test_note(t0, 200, 1000, 0, MIDI_NOTE_C4, 127);
 
-    k_msleep(500);
+    test_wait(t0, 1700);
     LOG_INF("Single note test complete");
 }
 
@@ -125,45 +698,37 @@ void test_scale(void) {
         MIDI_NOTE_B4,     // B
         MIDI_NOTE_C5      // C (octave)
     };
+    int64_t t0 = test_start();
+    uint32_t t = 0;
 
     // Set acoustic grand piano
-    midiSetInstrument(0, ACOUSTIC_GRAND_PIANO);
-    k_msleep(100);
+    test_msg(t0, t, program_chng | 0, ACOUSTIC_GRAND_PIANO, 0);
+    t += 100;
 
-    for (int i = 0; i < 8; i++) {
-        LOG_INF("Playing note %d of scale", i + 1);
-        midiNoteOn(0, scale[i], 100);
-        k_msleep(500);
-        midiNoteOff(0, scale[i], 64);
-        k_msleep(100);
+    LOG_INF("Playing %d notes of scale", (int)ARRAY_SIZE(scale));
+    for (int i = 0; i < (int)ARRAY_SIZE(scale); i++) {
+        test_note(t0, t, 500, 0, scale[i], 100);
+        t += 600;
     }
 
+    test_wait(t0, t);
     LOG_INF("Scale test complete");
 }
 
 void test_chord(void) {
     LOG_INF("=== Testing C Major Chord ===");
+    int64_t t0 = test_start();
 
     // Set electric grand piano
-    midiSetInstrument(0, ELECTRIC_GRAND_PIANO);
-    k_msleep(100);
+    test_msg(t0, 0, program_chng | 0, ELECTRIC_GRAND_PIANO, 0);
 
-    // Play C major chord (C-E-G)
+    // Play C major chord (C-E-G); same deadline, so one transfer
     LOG_INF("Playing C major chord");
-    midiNoteOn(0, MIDI_NOTE_C4, 100);      // C
-    k_msleep(50);
-    midiNoteOn(0, MIDI_NOTE_E4, 100);      // E
-    k_msleep(50);
-    midiNoteOn(0, MIDI_NOTE_G4, 100);      // G
-
-    k_msleep(2000);  // Hold chord for 2 seconds
+    test_note(t0, 100, 2000, 0, MIDI_NOTE_C4, 100);      // C
+    test_note(t0, 100, 2000, 0, MIDI_NOTE_E4, 100);      // E
+    test_note(t0, 100, 2000, 0, MIDI_NOTE_G4, 100);      // G
 
-    // Release chord
-    midiNoteOff(0, MIDI_NOTE_C4, 64);
-    midiNoteOff(0, MIDI_NOTE_E4, 64);
-    midiNoteOff(0, MIDI_NOTE_G4, 64);
-
-    k_msleep(500);
+    test_wait(t0, 2600);
     LOG_INF("Chord test complete");
 }
 
@@ -201,27 +766,19 @@ void test_instruments(void) {
         "Violin"
     };
 
+    // One instrument at a time so the log lines up with what is heard
     for (int i = 0; i < 12; i++) {
         LOG_INF("Testing instrument: %s", instrument_names[i]);
+        int64_t t0 = test_start();
 
-        midiSetInstrument(0, instruments[i]);
-        k_msleep(200);
+        test_msg(t0, 0, program_chng | 0, instruments[i], 0);
 
         // Play a simple melody
-        midiNoteOn(0, MIDI_NOTE_C4, 100);
-        k_msleep(400);
-        midiNoteOff(0, MIDI_NOTE_C4, 64);
-        k_msleep(100);
-
-        midiNoteOn(0, MIDI_NOTE_E4, 100);
-        k_msleep(400);
-        midiNoteOff(0, MIDI_NOTE_E4, 64);
-        k_msleep(100);
+        test_note(t0, 200, 400, 0, MIDI_NOTE_C4, 100);
+        test_note(t0, 700, 400, 0, MIDI_NOTE_E4, 100);
+        test_note(t0, 1200, 400, 0, MIDI_NOTE_G4, 100);
 
-        midiNoteOn(0, MIDI_NOTE_G4, 100);
-        k_msleep(400);
-        midiNoteOff(0, MIDI_NOTE_G4, 64);
-        k_msleep(300);
+        test_wait(t0, 1900);
     }
 
     LOG_INF("Instrument test complete");
@@ -229,74 +786,85 @@ void test_instruments(void) {
 
 void test_multi_channel(void) {
     LOG_INF("=== Testing Multi-Channel ===");
+    int64_t t0 = test_start();
 
     // Set different instruments on different channels
-    midiSetInstrument(0, ACOUSTIC_GRAND_PIANO);  // Channel 0: Piano
-    k_msleep(100);
-    midiSetInstrument(1, VIOLIN);                // Channel 1: Violin
-    k_msleep(100);
-    midiSetInstrument(2, TRUMPET);               // Channel 2: Trumpet
-    k_msleep(100);
+    test_msg(t0, 0, program_chng | 0, ACOUSTIC_GRAND_PIANO, 0);  // Channel 0: Piano
+    test_msg(t0, 100, program_chng | 1, VIOLIN, 0);              // Channel 1: Violin
+    test_msg(t0, 200, program_chng | 2, TRUMPET, 0);             // Channel 2: Trumpet
 
     // Set volumes
-    midiSetChannelVolume(0, 100);  // Piano medium
-    midiSetChannelVolume(1, 80);   // Violin softer
-    midiSetChannelVolume(2, 120);  // Trumpet louder
-    k_msleep(100);
+    test_msg(t0, 300, control_change | 0, 0x07, 100);  // Piano medium
+    test_msg(t0, 300, control_change | 1, 0x07, 80);   // Violin softer
+    test_msg(t0, 300, control_change | 2, 0x07, 120);  // Trumpet louder
 
-    // Play harmony
+    // Play harmony, entries staggered, all released together
     LOG_INF("Playing multi-channel harmony");
-    midiNoteOn(0, MIDI_NOTE_C4, 100);      // Piano: C
-    k_msleep(200);
-    midiNoteOn(1, MIDI_NOTE_E4, 90);       // Violin: E
-    k_msleep(200);
-    midiNoteOn(2, MIDI_NOTE_G4, 110);      // Trumpet: G
-
-    k_msleep(2000);  // Hold harmony
+    test_note(t0, 400, 2400, 0, MIDI_NOTE_C4, 100);      // Piano: C
+    test_note(t0, 600, 2200, 1, MIDI_NOTE_E4, 90);       // Violin: E
+    test_note(t0, 800, 2000, 2, MIDI_NOTE_G4, 110);      // Trumpet: G
 
-    // Release all
-    midiNoteOff(0, MIDI_NOTE_C4, 64);
-    midiNoteOff(1, MIDI_NOTE_E4, 64);
-    midiNoteOff(2, MIDI_NOTE_G4, 64);
-
-    k_msleep(500);
+    test_wait(t0, 3300);
     LOG_INF("Multi-channel test complete");
 }
 
 void test_volume_control(void) {
     LOG_INF("=== Testing Volume Control ===");
 
-    midiSetInstrument(0, ACOUSTIC_GRAND_PIANO);
-    k_msleep(100);
-
     uint8_t volumes[] = {30, 60, 90, MAXIMUM_MIDI_VOLUME};
+    int64_t t0 = test_start();
+    uint32_t t = 0;
 
-    for (int i = 0; i < 4; i++) {
-        LOG_INF("Playing at volume %d", volumes[i]);
-        midiSetChannelVolume(0, volumes[i]);
-        k_msleep(100);
+    test_msg(t0, t, program_chng | 0, ACOUSTIC_GRAND_PIANO, 0);
+    t += 100;
 
-        midiNoteOn(0, MIDI_NOTE_C4, 100);
-        k_msleep(800);
-        midiNoteOff(0, MIDI_NOTE_C4, 64);
-        k_msleep(300);
+    LOG_INF("Playing at volumes %d, %d, %d, %d", volumes[0], volumes[1], volumes[2], volumes[3]);
+    for (int i = 0; i < 4; i++) {
+        test_msg(t0, t, control_change | 0, 0x07, volumes[i]);
+        test_note(t0, t + 100, 800, 0, MIDI_NOTE_C4, 100);
+        t += 1200;
     }
 
+    test_wait(t0, t);
     LOG_INF("Volume control test complete");
 }
 
 void cleanup_midi(void) {
     LOG_INF("=== Cleaning up MIDI ===");
 
-    // Stop all notes on all channels
+    // Snapshot what is sounding; the table changes as the note-offs go out
+    uint32_t active[16][NUM_MIDI_NOTES / 32];
+    k_spinlock_key_t key = k_spin_lock(&midi_tx_lock);
+    memcpy(active, midi_active_notes, sizeof(active));
+    uint16_t used = midi_used_channels;
+    midi_used_channels = 0;
+    // Whatever plays next starts over, so resend its values rather than trust old ones
+    midi_sent_reset_locked();
+    k_spin_unlock(&midi_tx_lock, key);
+
+    // Note Off for each sounding note, then All Notes Off only on channels
+    // that were played, batched into as few transfers as fit
+    midi_tx_group_t group;
+    int notes = 0;
+    midi_group_init(&group);
     for (int ch = 0; ch < 16; ch++) {
-        midi_all_notes_off(ch);
-        k_msleep(10);
-        midi_all_sound_off(ch);
-        k_msleep(10);
+        for (int w = 0; w < NUM_MIDI_NOTES / 32; w++) {
+            uint32_t bits = active[ch][w];
+            while (bits) {
+                int bit = __builtin_ctz(bits);
+                bits &= bits - 1;
+                midi_group_note_off(&group, ch, w * 32 + bit, 0);
+                notes++;
+            }
+        }
+        if (used & BIT(ch)) {
+            midi_group_control_change(&group, ch, 0x7B, 0x00);  // All Notes Off
+        }
     }
+    midi_group_send(&group);
+    midi_voice_reset();
 
-    LOG_INF("MIDI cleanup complete");
+    LOG_INF("MIDI cleanup complete (%d notes, channels 0x%04X)", notes, used);
 }
 
 
@@ -342,20 +910,12 @@ void vs1053_midi_quick_test(void) {
     //setup_vs1053_midi_mode();
     //k_msleep(200);
 
-    midiNoteOn(0, MIDI_NOTE_C4, 108);
-    k_msleep(250);
-    midiNoteOff(0, MIDI_NOTE_C4, 0);
-
-    midiNoteOn(0, MIDI_NOTE_D4, 108);
-    k_msleep(250);
-    midiNoteOff(0, MIDI_NOTE_D4, 0);
-
-    midiNoteOn(0, MIDI_NOTE_C4, 108);
-    k_msleep(250);
-    midiNoteOff(0, MIDI_NOTE_C4, 0);
-    midiNoteOn(0, MIDI_NOTE_D4, 108);
-    k_msleep(250);
-    midiNoteOff(0, MIDI_NOTE_D4, 0);
+    int64_t t0 = test_start();
+    test_note(t0, 0, 250, 0, MIDI_NOTE_C4, 108);
+    test_note(t0, 250, 250, 0, MIDI_NOTE_D4, 108);
+    test_note(t0, 500, 250, 0, MIDI_NOTE_C4, 108);
+    test_note(t0, 750, 250, 0, MIDI_NOTE_D4, 108);
+    test_wait(t0, 1000);
 
     cleanup_midi();
 
@@ -2,6 +2,7 @@
 #define _MIDIFILE_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 /* Application definitions */
 
 /* definitions for MIDI file parsing code */
@@ -137,9 +138,10 @@ void mfwrite();
 
 #define NUM_MIDI_NOTES 128 //0-127
 
-#define MAX_MIDI_DATA_LENGTH        4092
-#define MAX_MIDI_TRACK_LENGTH       4092
-#define MAX_MIDI_TRACKS             2
+// Most tracks a song may have; each gets its own cursor in the playback merge
+#define MAX_MIDI_TRACKS             16
+// RAM shared out as read windows between the tracks of the playing song
+#define MIDI_TRACK_BUFFER_BUDGET    4096
 
 #define MAX_INSTRUMENTS 13
 #define MIN_INSTRUMENTS 1
@@ -149,18 +151,185 @@ void mfwrite();
 
 #define DEFAULT_MIDI_NOTE_DURATION  960
 
+// Largest burst of messages handed to the UART in one transfer
+#define MIDI_TX_GROUP_SIZE          64
+
+// Drop repeated status bytes on the wire unless turned off at run time
+#define MIDI_RUNNING_STATUS_DEFAULT true
+
+// Where MIDI output goes: the MIDI UART at 31.25 kbps, or straight into the
+// VS1053 real-time MIDI plugin over SPI SDI
+typedef enum {
+    MIDI_TRANSPORT_UART,
+    MIDI_TRANSPORT_SDI,
+} midi_transport_t;
+
+// Build-time default, can be changed at run time with midi_set_transport()
+#ifndef MIDI_TRANSPORT_DEFAULT
+#define MIDI_TRANSPORT_DEFAULT      MIDI_TRANSPORT_UART
+#endif
+
+// Controller lane: CC, bank and program changes wait here so a newer value for
+// the same channel/controller replaces the older one, and notes never queue
+// behind a burst of encoder steps
+#define MIDI_LANE_SLOTS             32
+// How long changes collect before going out
+#define MIDI_LANE_HOLDOFF_MS        5
+// Hold the lane back while more than this many bytes are waiting for the wire
+#define MIDI_LANE_TX_BUSY_BYTES     16
+
+// Controller lane counters
+typedef struct {
+    uint8_t pending;        // changes waiting right now
+    uint32_t queued;        // changes submitted
+    uint32_t coalesced;     // changes replaced by a newer value before being sent
+    uint32_t redundant;     // changes dropped because the receiver already had the value
+    uint32_t sent;          // messages that reached the transport
+} midi_lane_stats_t;
+
+// A group of complete MIDI messages that is queued for the output transport as one block
+typedef struct {
+    uint8_t buf[MIDI_TX_GROUP_SIZE];
+    uint8_t len;
+    bool traced;            // played from the controls, timed by the latency probe
+} midi_tx_group_t;
+
+/**
+ * @brief Length in bytes of a short MIDI message, status byte included
+ *
+ * @param status MIDI status byte
+ * @return uint8_t 1-3, or 0 if @p status doesn't start a short message
+ */
+uint8_t midi_msg_length(uint8_t status);
+
+/**
+ * @brief Empty a message group so it can be filled again
+ */
+void midi_group_init(midi_tx_group_t *group);
+
+/**
+ * @brief Append one message to a group
+ *
+ * If the message doesn't fit the group is sent first, so messages are never
+ * split across transfers.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_group_add(midi_tx_group_t *group, uint8_t status, uint8_t data1, uint8_t data2);
+
+/**
+ * @brief Queue every message in a group for the UART as one block and empty it
+ *
+ * Returns as soon as the bytes are queued; they leave back to back in as few
+ * DMA transfers as the UART buffers allow.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_group_send(midi_tx_group_t *group);
+
+/**
+ * @brief Queue a single message for the UART
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_send_msg(uint8_t status, uint8_t data1, uint8_t data2);
+
+/**
+ * @brief Turn running-status compression of outgoing messages on or off
+ *
+ * When on, status bytes the receiver already has are dropped and Note Off is
+ * sent as Note On velocity 0 where that keeps the current status running.
+ */
+void midi_set_running_status(bool enable);
+
+/**
+ * @brief Queue a Control Change on the coalescing lane
+ *
+ * Sent within MIDI_LANE_HOLDOFF_MS, or right before the next note on the same
+ * channel, whichever comes first. A value the receiver already has is dropped.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_lane_control_change(uint8_t chan, uint8_t ctrl, uint8_t val);
+
+/**
+ * @brief Queue a Program Change on the coalescing lane
+ *
+ * Goes out after any bank select for the same channel.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_lane_program_change(uint8_t chan, uint8_t prog);
+
+/**
+ * @brief Send everything waiting on the controller lane now
+ */
+void midi_lane_flush(void);
+
+/**
+ * @brief Read the controller lane counters
+ */
+void midi_lane_get_stats(midi_lane_stats_t *stats);
+
+/**
+ * @brief Send all further MIDI output over @p transport
+ *
+ * Waits (briefly) for the current transport to drain so messages already
+ * queued stay ahead of new ones. Call from a thread. Running status only
+ * applies to the UART; the SDI path always sends full messages.
+ *
+ * @return int 0 on success, -ENODEV if the SDI transport isn't started
+ */
+int midi_set_transport(midi_transport_t transport);
+
+/**
+ * @brief Transport MIDI output currently goes to
+ */
+midi_transport_t midi_get_transport(void);
+
+/**
+ * @brief Check whether a note is sounding (Note On sent, no Note Off yet)
+ *
+ * Play modes use this to avoid stacking duplicate Note Ons.
+ */
+bool midi_note_is_active(uint8_t chan, uint8_t note);
+
+/**
+ * @brief Number of notes sounding on a channel
+ */
+uint8_t midi_active_note_count(uint8_t chan);
+
+/**
+ * @brief Bit mask of channels with at least one note sounding
+ */
+uint16_t midi_active_channels(void);
+
+// Channel message builders for groups
+int midi_group_note_on(midi_tx_group_t *group, uint8_t chan, uint8_t note, uint8_t vel);
+int midi_group_note_off(midi_tx_group_t *group, uint8_t chan, uint8_t note, uint8_t vel);
+int midi_group_control_change(midi_tx_group_t *group, uint8_t chan, uint8_t ctrl, uint8_t val);
+int midi_group_program_change(midi_tx_group_t *group, uint8_t chan, uint8_t prog);
+
 
 void midiSetInstrument(uint8_t chan, uint8_t inst);
 void midiSetChannelVolume(uint8_t chan, uint8_t vol);
 void midiSetChannelBank(uint8_t chan, uint8_t bank);
 void midiNoteOn(uint8_t chan, uint8_t n, uint8_t vel);
 void midiNoteOff(uint8_t chan, uint8_t n, uint8_t vel);
+void midi_all_notes_off(uint8_t channel);
+void midi_all_sound_off(uint8_t channel);
 
 // VS1053 MIDI Test Function Prototypes
 void vs1053_midi_test_suite(void);
 void vs1053_midi_quick_test(void);
 void run_midi_tests(void);
 void setup_vs1053_midi_mode(void);
+/**
+ * @brief Silence everything that is sounding
+ *
+ * Sends Note Off only for notes that are actually on, and All Notes Off only
+ * on channels that were played since the last cleanup.
+ */
 void cleanup_midi(void);
 
 // Individual test functions
@@ -0,0 +1,295 @@
+// midi_in.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <string.h>
+
+#include "midi_in.h"
+#include "midi.h"
+#include "uart_interface.h"
+
+LOG_MODULE_REGISTER(midi_in, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(midi_in_stack, MIDI_IN_STACK_SIZE);
+static struct k_thread midi_in_thread_data;
+
+static midi_in_cb_t midi_in_cb;
+static void *midi_in_cb_data;
+static bool midi_in_thru;
+
+// Parser state, only touched from the MIDI input thread
+static uint8_t in_status;       // status the next data bytes belong to, 0 if none
+static uint8_t in_expected;     // data bytes that complete a message for in_status
+static uint8_t in_data[2];
+static uint8_t in_idx;
+static bool in_sysex;           // inside 0xF0 ... 0xF7
+static bool in_sysex_started;   // first fragment of the current SysEx was delivered
+
+static midi_in_stats_t in_stats;
+static uint32_t in_dropped_base;
+static uint32_t in_window_bytes;
+static int64_t in_window_start;
+
+static void midi_in_deliver_short(uint8_t status, uint8_t data1, uint8_t data2)
+{
+    in_stats.messages++;
+
+    if (midi_in_thru && midi_send_msg(status, data1, data2) != 0) {
+        in_stats.thru_errors++;
+    }
+
+    if (midi_in_cb) {
+        midi_in_event_t evt = {
+            .type = MIDI_IN_EVT_SHORT,
+            .status = status,
+            .data1 = data1,
+            .data2 = data2,
+        };
+        midi_in_cb(&evt, midi_in_cb_data);
+    }
+}
+
+static void midi_in_deliver_sysex(const uint8_t *data, uint32_t len, uint8_t flags)
+{
+    if (!in_sysex_started) {
+        flags |= MIDI_IN_SYSEX_START;
+        in_sysex_started = true;
+    }
+
+    // Nothing to say about an empty middle fragment
+    if (len == 0 && !(flags & (MIDI_IN_SYSEX_START | MIDI_IN_SYSEX_END | MIDI_IN_SYSEX_ABORTED))) {
+        return;
+    }
+
+    in_stats.sysex_bytes += len;
+
+    if (midi_in_cb) {
+        midi_in_event_t evt = {
+            .type = MIDI_IN_EVT_SYSEX,
+            .status = 0xF0,
+            .sysex_flags = flags,
+            .sysex = data,
+            .sysex_len = len,
+        };
+        midi_in_cb(&evt, midi_in_cb_data);
+    }
+}
+
+// Parse one contiguous run of received bytes. SysEx payload is handed out as
+// pointers into @p buf, split wherever a real-time byte or the run ends.
+static void midi_in_parse(const uint8_t *buf, uint32_t len)
+{
+    uint32_t frag = 0;  // start of the pending SysEx fragment in buf
+
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t b = buf[i];
+
+        if (b >= 0xF8) {
+            // Real-Time can land anywhere, even inside another message,
+            // and leaves running status and SysEx alone
+            if (in_sysex) {
+                midi_in_deliver_sysex(&buf[frag], i - frag, 0);
+                frag = i + 1;
+            }
+            if (midi_msg_length(b) == 1) {
+                midi_in_deliver_short(b, 0, 0);
+            }
+            continue;
+        }
+
+        if (b < 0x80) {
+            if (in_sysex) {
+                continue;
+            }
+            if (in_status == 0) {
+                in_stats.stray++;
+                continue;
+            }
+
+            in_data[in_idx++] = b;
+            if (in_idx == in_expected) {
+                midi_in_deliver_short(in_status, in_data[0], in_data[1]);
+                in_idx = 0;
+                // Only channel messages can run
+                if (in_status >= 0xF0) {
+                    in_status = 0;
+                }
+            }
+            continue;
+        }
+
+        // Any other status byte ends a SysEx in progress
+        if (in_sysex) {
+            midi_in_deliver_sysex(&buf[frag], i - frag,
+                                  b == 0xF7 ? MIDI_IN_SYSEX_END : MIDI_IN_SYSEX_ABORTED);
+            in_sysex = false;
+        }
+
+        in_idx = 0;
+
+        if (b == 0xF0) {
+            in_sysex = true;
+            in_sysex_started = false;
+            in_status = 0;
+            frag = i + 1;
+            continue;
+        }
+
+        uint8_t msg_len = midi_msg_length(b);
+        if (msg_len == 0) {
+            // 0xF7 outside SysEx or an undefined status, clears running status
+            in_status = 0;
+            continue;
+        }
+
+        if (msg_len == 1) {
+            // Tune request
+            in_status = 0;
+            midi_in_deliver_short(b, 0, 0);
+            continue;
+        }
+
+        in_status = b;
+        in_expected = msg_len - 1;
+    }
+
+    // The rest of this run belongs to a SysEx that continues in the next one
+    if (in_sysex) {
+        midi_in_deliver_sysex(&buf[frag], len - frag, 0);
+    }
+}
+
+static void midi_in_update_rate(void)
+{
+    int64_t now = k_uptime_get();
+    int64_t elapsed = now - in_window_start;
+
+    if (elapsed >= MIDI_IN_RATE_WINDOW_MS) {
+        in_stats.bytes_per_sec = (uint32_t)((uint64_t)in_window_bytes * 1000 / elapsed);
+        in_window_bytes = 0;
+        in_window_start = now;
+    }
+}
+
+static void midi_in_thread(void *p1, void *p2, void *p3)
+{
+    uint8_t *data;
+
+    while (1) {
+        // Wake at least once per window so the rate drops back to 0 when idle
+        uart_midi_rx_wait(K_MSEC(MIDI_IN_RATE_WINDOW_MS));
+
+        uint32_t drained = 0;
+        while (drained < MIDI_IN_DRAIN_MAX) {
+            uint32_t len = uart_midi_rx_claim(&data, MIN(MIDI_IN_BATCH_SIZE, MIDI_IN_DRAIN_MAX - drained));
+            if (len == 0) {
+                break;
+            }
+
+            midi_in_parse(data, len);
+            uart_midi_rx_finish(len);
+            drained += len;
+        }
+
+        in_stats.bytes += drained;
+        in_window_bytes += drained;
+        in_stats.dropped = uart_midi_rx_dropped() - in_dropped_base;
+        midi_in_update_rate();
+
+        // Give the other threads a turn if there is still more waiting
+        if (drained == MIDI_IN_DRAIN_MAX) {
+            k_yield();
+        }
+    }
+}
+
+int midi_in_init(void)
+{
+    in_status = 0;
+    in_idx = 0;
+    in_sysex = false;
+    midi_in_reset_stats();
+
+    k_tid_t tid = k_thread_create(&midi_in_thread_data, midi_in_stack,
+                                  K_THREAD_STACK_SIZEOF(midi_in_stack),
+                                  midi_in_thread, NULL, NULL, NULL,
+                                  MIDI_IN_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start MIDI input thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "midi_in");
+
+    LOG_INF("MIDI input started");
+    return 0;
+}
+
+void midi_in_set_callback(midi_in_cb_t cb, void *user_data)
+{
+    midi_in_cb_data = user_data;
+    midi_in_cb = cb;
+}
+
+void midi_in_set_thru(bool enable)
+{
+    midi_in_thru = enable;
+    LOG_INF("MIDI thru %s", enable ? "enabled" : "disabled");
+}
+
+void midi_in_get_stats(midi_in_stats_t *stats)
+{
+    *stats = in_stats;
+}
+
+void midi_in_reset_stats(void)
+{
+    in_stats = (midi_in_stats_t){0};
+    in_dropped_base = uart_midi_rx_dropped();
+    in_window_bytes = 0;
+    in_window_start = k_uptime_get();
+}
+
+#ifdef CONFIG_SHELL
+
+static int cmd_midi_in_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_in_stats_t stats;
+
+    midi_in_get_stats(&stats);
+    shell_print(sh, "%u bytes (%u/s), %u messages, %u SysEx bytes", stats.bytes,
+                stats.bytes_per_sec, stats.messages, stats.sysex_bytes);
+    shell_print(sh, "stray %u, dropped %u", stats.stray, stats.dropped);
+    shell_print(sh, "thru %s, %u refused", midi_in_thru ? "on" : "off", stats.thru_errors);
+    return 0;
+}
+
+static int cmd_midi_in_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_in_reset_stats();
+    shell_print(sh, "MIDI input statistics cleared");
+    return 0;
+}
+
+static int cmd_midi_in_thru(const struct shell *sh, size_t argc, char **argv)
+{
+    if (strcmp(argv[1], "on") == 0) {
+        midi_in_set_thru(true);
+    } else if (strcmp(argv[1], "off") == 0) {
+        midi_in_set_thru(false);
+    } else {
+        shell_error(sh, "Usage: midi_in thru on|off");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_midi_in,
+    SHELL_CMD(stats, NULL, "Parser counters", cmd_midi_in_stats),
+    SHELL_CMD(reset, NULL, "Clear the counters", cmd_midi_in_reset),
+    SHELL_CMD_ARG(thru, NULL, "Send what arrives to the synth: on|off", cmd_midi_in_thru, 2, 0),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(midi_in, &sub_midi_in, "MIDI input", NULL);
+
+#endif // CONFIG_SHELL
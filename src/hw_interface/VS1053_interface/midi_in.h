@@ -0,0 +1,88 @@
+#ifndef MIDI_IN_H
+#define MIDI_IN_H
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Most bytes parsed per ring claim, keeps one pass short and bounded
+#define MIDI_IN_BATCH_SIZE      64
+// Most bytes parsed before the thread waits again, so a flood can't starve others
+#define MIDI_IN_DRAIN_MAX       256
+#define MIDI_IN_STACK_SIZE      1024
+#define MIDI_IN_PRIORITY        5
+// Window for the bytes/second counter
+#define MIDI_IN_RATE_WINDOW_MS  1000
+// Play what arrives on MIDI IN through the synth; `midi_in thru` changes it
+#define MIDI_IN_THRU_DEFAULT    true
+
+typedef enum {
+    MIDI_IN_EVT_SHORT,      // channel, system common or real-time message
+    MIDI_IN_EVT_SYSEX,      // a piece of a System Exclusive message
+} midi_in_evt_type_t;
+
+// SysEx fragment flags
+#define MIDI_IN_SYSEX_START     BIT(0)  // first fragment, came right after 0xF0
+#define MIDI_IN_SYSEX_END       BIT(1)  // last fragment, 0xF7 seen
+#define MIDI_IN_SYSEX_ABORTED   BIT(2)  // ended by a status byte instead of 0xF7
+
+// One decoded message. SysEx payload points straight into the RX ring and is
+// only valid for the duration of the callback.
+typedef struct {
+    midi_in_evt_type_t type;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t sysex_flags;
+    const uint8_t *sysex;   // payload without the 0xF0/0xF7 framing
+    uint16_t sysex_len;
+} midi_in_event_t;
+
+typedef void (*midi_in_cb_t)(const midi_in_event_t *evt, void *user_data);
+
+// Parser counters
+typedef struct {
+    uint32_t bytes;             // bytes parsed since the last reset
+    uint32_t bytes_per_sec;     // over the last MIDI_IN_RATE_WINDOW_MS
+    uint32_t messages;          // short messages delivered
+    uint32_t sysex_bytes;       // SysEx payload bytes delivered
+    uint32_t stray;             // data bytes with no status to attach to
+    uint32_t dropped;           // bytes lost to a full UART RX ring
+    uint32_t thru_errors;       // thru messages the TX path refused
+} midi_in_stats_t;
+
+/**
+ * @brief Start the MIDI input thread
+ *
+ * The thread drains the UART RX ring, parses it and hands every message to
+ * the callback set with midi_in_set_callback().
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_in_init(void);
+
+/**
+ * @brief Set where decoded messages go, called from the MIDI input thread
+ */
+void midi_in_set_callback(midi_in_cb_t cb, void *user_data);
+
+/**
+ * @brief Re-send every parsed short message on the MIDI TX path
+ *
+ * Thru happens in the parser, before the callback, so it adds no extra hop.
+ * SysEx is not forwarded.
+ */
+void midi_in_set_thru(bool enable);
+
+/**
+ * @brief Read the parser counters
+ */
+void midi_in_get_stats(midi_in_stats_t *stats);
+
+/**
+ * @brief Clear the parser counters
+ */
+void midi_in_reset_stats(void);
+
+#endif // MIDI_IN_H
@@ -0,0 +1,356 @@
+// midi_scheduler.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "midi_scheduler.h"
+#include "midi.h"
+#include "midi_voice.h"
+
+LOG_MODULE_REGISTER(midi_scheduler, LOG_LEVEL_INF);
+
+// Binary min-heap of waiting events, keyed on (deadline, seq)
+static midi_sched_event_t sched_heap[MIDI_SCHED_MAX_EVENTS];
+static uint32_t sched_count;
+static uint32_t sched_seq;
+
+// Protects everything above; taken from threads and from the timer ISR
+static struct k_spinlock sched_lock;
+
+static struct k_timer sched_timer;
+static struct k_sem sched_idle_sem;
+
+// Counters
+static uint32_t sched_peak;
+static uint32_t sched_released;
+static uint32_t sched_dropped;
+static uint32_t sched_cancelled;
+static uint32_t sched_send_failed;
+static uint32_t sched_max_late_ticks;
+static uint64_t sched_late_ticks_sum;
+
+static inline bool sched_before(const midi_sched_event_t *a, const midi_sched_event_t *b)
+{
+    if (a->deadline != b->deadline) {
+        return a->deadline < b->deadline;
+    }
+    // Sequence numbers wrap, compare them as a signed distance
+    return (int32_t)(a->seq - b->seq) < 0;
+}
+
+static void sched_sift_up(uint32_t idx)
+{
+    midi_sched_event_t ev = sched_heap[idx];
+
+    while (idx > 0) {
+        uint32_t parent = (idx - 1) / 2;
+        if (!sched_before(&ev, &sched_heap[parent])) {
+            break;
+        }
+        sched_heap[idx] = sched_heap[parent];
+        idx = parent;
+    }
+    sched_heap[idx] = ev;
+}
+
+static void sched_sift_down(uint32_t idx)
+{
+    midi_sched_event_t ev = sched_heap[idx];
+
+    while (1) {
+        uint32_t child = 2 * idx + 1;
+        if (child >= sched_count) {
+            break;
+        }
+        if (child + 1 < sched_count && sched_before(&sched_heap[child + 1], &sched_heap[child])) {
+            child++;
+        }
+        if (!sched_before(&sched_heap[child], &ev)) {
+            break;
+        }
+        sched_heap[idx] = sched_heap[child];
+        idx = child;
+    }
+    sched_heap[idx] = ev;
+}
+
+static void sched_pop(void)
+{
+    sched_count--;
+    if (sched_count > 0) {
+        sched_heap[0] = sched_heap[sched_count];
+        sched_sift_down(0);
+    }
+}
+
+// Arm the timer for the earliest waiting event. Call with sched_lock held.
+static void sched_arm(void)
+{
+    if (sched_count == 0) {
+        k_timer_stop(&sched_timer);
+        k_sem_give(&sched_idle_sem);
+        return;
+    }
+
+    k_timer_start(&sched_timer, K_TIMEOUT_ABS_TICKS(sched_heap[0].deadline), K_NO_WAIT);
+}
+
+// Due message taken off the queue, kept small as batches live on the ISR stack
+typedef struct {
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} sched_msg_t;
+
+// Send events taken off the queue, as few groups as they fit in. Notes go
+// through the voice allocator like live ones, so budgets and stealing cover
+// songs and tests too. Runs without sched_lock so the TX path never nests
+// inside it; losses are counted.
+static void sched_send(const sched_msg_t *events, uint32_t count)
+{
+    midi_tx_group_t group;
+    uint32_t grouped = 0;
+    uint32_t failed = 0;
+
+    midi_group_init(&group);
+    for (uint32_t i = 0; i < count; i++) {
+        const sched_msg_t *ev = &events[i];
+
+        if (group.len + MIDI_VOICE_GROUP_ROOM > MIDI_TX_GROUP_SIZE) {
+            if (midi_group_send(&group) != 0) {
+                failed += grouped;
+            }
+            grouped = 0;
+        }
+        if (midi_voice_group_add(&group, ev->status, ev->data1, ev->data2) == 0) {
+            grouped++;
+        } else {
+            failed++;
+        }
+    }
+    if (grouped > 0 && midi_group_send(&group) != 0) {
+        failed += grouped;
+    }
+
+    if (failed > 0) {
+        k_spinlock_key_t key = k_spin_lock(&sched_lock);
+        sched_send_failed += failed;
+        k_spin_unlock(&sched_lock, key);
+    }
+}
+
+// Timer expiry (ISR): release everything that is due, oldest first
+static void sched_timer_handler(struct k_timer *timer)
+{
+    sched_msg_t batch[MIDI_SCHED_BATCH];
+    bool more;
+
+    do {
+        uint32_t count = 0;
+        k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+        int64_t now = k_uptime_ticks();
+        while (count < MIDI_SCHED_BATCH && sched_count > 0 && sched_heap[0].deadline <= now) {
+            midi_sched_event_t *ev = &sched_heap[0];
+            uint32_t late = (uint32_t)(now - ev->deadline);
+
+            if (late > sched_max_late_ticks) {
+                sched_max_late_ticks = late;
+            }
+            sched_late_ticks_sum += late;
+            sched_released++;
+
+            batch[count++] = (sched_msg_t){ ev->status, ev->data1, ev->data2 };
+            sched_pop();
+        }
+
+        more = sched_count > 0 && sched_heap[0].deadline <= now;
+        if (!more) {
+            sched_arm();
+        }
+        k_spin_unlock(&sched_lock, key);
+
+        // Everything due together goes out back to back
+        sched_send(batch, count);
+    } while (more);
+}
+
+void midi_sched_init(void)
+{
+    k_timer_init(&sched_timer, sched_timer_handler, NULL);
+    k_sem_init(&sched_idle_sem, 0, 1);
+
+    sched_count = 0;
+    sched_seq = 0;
+    midi_sched_reset_stats();
+
+    LOG_INF("MIDI scheduler initialized (%d events, %d ticks/s)",
+            MIDI_SCHED_MAX_EVENTS, CONFIG_SYS_CLOCK_TICKS_PER_SEC);
+}
+
+int64_t midi_sched_now(void)
+{
+    return k_uptime_ticks();
+}
+
+int64_t midi_sched_us_to_ticks(uint64_t us)
+{
+    return (int64_t)k_us_to_ticks_ceil64(us);
+}
+
+int midi_sched_at(int64_t deadline, uint16_t tag, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    if (midi_msg_length(status) == 0) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    if (sched_count >= MIDI_SCHED_MAX_EVENTS) {
+        sched_dropped++;
+        k_spin_unlock(&sched_lock, key);
+        return -ENOMEM;
+    }
+
+    uint32_t idx = sched_count++;
+    uint32_t seq = sched_seq++;
+    sched_heap[idx] = (midi_sched_event_t){
+        .deadline = deadline,
+        .seq = seq,
+        .tag = tag,
+        .status = status,
+        .data1 = data1,
+        .data2 = data2,
+    };
+    sched_sift_up(idx);
+
+    if (sched_count > sched_peak) {
+        sched_peak = sched_count;
+    }
+
+    // Only a new earliest event moves the timer
+    if (sched_heap[0].seq == seq) {
+        sched_arm();
+    }
+
+    k_spin_unlock(&sched_lock, key);
+    return 0;
+}
+
+int midi_sched_at_us(uint64_t deadline_us, uint16_t tag, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    return midi_sched_at(midi_sched_us_to_ticks(deadline_us), tag, status, data1, data2);
+}
+
+static inline bool sched_is_note_off(const midi_sched_event_t *ev)
+{
+    uint8_t type = ev->status & 0xF0;
+
+    return type == 0x80 || (type == 0x90 && ev->data2 == 0);
+}
+
+int midi_sched_cancel(uint16_t tag)
+{
+    sched_msg_t batch[MIDI_SCHED_BATCH];
+    int removed = 0;
+    bool more;
+
+    // Dropping a waiting Note Off would leave its note hanging, so those go
+    // out now instead; a batch at a time, outside the lock
+    do {
+        uint32_t count = 0;
+        uint32_t kept = 0;
+        k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+        more = false;
+        for (uint32_t i = 0; i < sched_count; i++) {
+            midi_sched_event_t *ev = &sched_heap[i];
+
+            if (ev->tag != tag) {
+                sched_heap[kept++] = *ev;
+                continue;
+            }
+            if (sched_is_note_off(ev)) {
+                if (count == MIDI_SCHED_BATCH) {
+                    // Left for the next pass
+                    sched_heap[kept++] = *ev;
+                    more = true;
+                    continue;
+                }
+                batch[count++] = (sched_msg_t){ ev->status, ev->data1, ev->data2 };
+            }
+        }
+
+        removed += sched_count - kept;
+        sched_cancelled += sched_count - kept;
+        sched_count = kept;
+
+        // Rebuild the heap bottom-up, O(n)
+        for (int32_t i = (int32_t)sched_count / 2 - 1; i >= 0; i--) {
+            sched_sift_down(i);
+        }
+        sched_arm();
+
+        k_spin_unlock(&sched_lock, key);
+
+        sched_send(batch, count);
+    } while (more);
+
+    LOG_DBG("Cancelled %d events with tag %d", removed, tag);
+    return removed;
+}
+
+void midi_sched_flush(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    sched_cancelled += sched_count;
+    sched_count = 0;
+    sched_arm();
+
+    k_spin_unlock(&sched_lock, key);
+}
+
+int midi_sched_wait_idle(k_timeout_t timeout)
+{
+    k_sem_reset(&sched_idle_sem);
+
+    while (sched_count > 0) {
+        if (k_sem_take(&sched_idle_sem, timeout) != 0) {
+            return -EAGAIN;
+        }
+    }
+
+    return 0;
+}
+
+void midi_sched_get_stats(midi_sched_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    stats->queued = sched_count;
+    stats->peak = sched_peak;
+    stats->released = sched_released;
+    stats->dropped = sched_dropped;
+    stats->cancelled = sched_cancelled;
+    stats->send_failed = sched_send_failed;
+    stats->max_late_us = (uint32_t)k_ticks_to_us_floor64(sched_max_late_ticks);
+    stats->mean_late_us = sched_released ?
+        (uint32_t)(k_ticks_to_us_floor64(sched_late_ticks_sum) / sched_released) : 0;
+
+    k_spin_unlock(&sched_lock, key);
+}
+
+void midi_sched_reset_stats(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+
+    sched_peak = sched_count;
+    sched_released = 0;
+    sched_dropped = 0;
+    sched_cancelled = 0;
+    sched_send_failed = 0;
+    sched_max_late_ticks = 0;
+    sched_late_ticks_sum = 0;
+
+    k_spin_unlock(&sched_lock, key);
+}
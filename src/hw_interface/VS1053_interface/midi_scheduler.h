@@ -0,0 +1,107 @@
+#ifndef MIDI_SCHEDULER_H
+#define MIDI_SCHEDULER_H
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "midi.h"
+
+// Events that can be waiting at once
+#define MIDI_SCHED_MAX_EVENTS   128
+// Due events taken off the queue per lock hold; each batch is sent unlocked
+#define MIDI_SCHED_BATCH        (MIDI_TX_GROUP_SIZE / 3)
+
+// Tags let a caller cancel just its own events (e.g. one track, the arpeggiator)
+#define MIDI_SCHED_TAG_NONE     0
+#define MIDI_SCHED_TAG_TEST     1
+#define MIDI_SCHED_TAG_PLAYER   2
+
+// One MIDI message waiting for its deadline
+typedef struct {
+    int64_t deadline;   // absolute kernel ticks
+    uint32_t seq;       // keeps events with equal deadlines in submit order
+    uint16_t tag;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+} midi_sched_event_t;
+
+// Scheduler counters, lateness is how far past its deadline an event went out
+typedef struct {
+    uint32_t queued;        // events waiting right now
+    uint32_t peak;          // most events ever waiting at once
+    uint32_t released;      // events handed to the MIDI TX path
+    uint32_t dropped;       // submits rejected because the queue was full
+    uint32_t cancelled;     // events removed by cancel/flush
+    uint32_t send_failed;   // released events the MIDI TX path turned away
+    uint32_t max_late_us;
+    uint32_t mean_late_us;
+} midi_sched_stats_t;
+
+/**
+ * @brief Initialize the MIDI event scheduler
+ *
+ * Events are released from a kernel timer (ISR context) straight into the
+ * MIDI TX path, so their timing doesn't depend on any thread being scheduled.
+ */
+void midi_sched_init(void);
+
+/**
+ * @brief Current scheduler time in kernel ticks
+ */
+int64_t midi_sched_now(void);
+
+/**
+ * @brief Convert microseconds to scheduler ticks (rounded up)
+ */
+int64_t midi_sched_us_to_ticks(uint64_t us);
+
+/**
+ * @brief Schedule a short MIDI message for an absolute time
+ *
+ * @param deadline Absolute time in kernel ticks (see midi_sched_now())
+ * @param tag Owner tag for midi_sched_cancel()
+ * @return int 0 on success, -EINVAL for a bad message, -ENOMEM if the queue is full
+ */
+int midi_sched_at(int64_t deadline, uint16_t tag, uint8_t status, uint8_t data1, uint8_t data2);
+
+/**
+ * @brief Schedule a short MIDI message for an absolute time in microseconds since boot
+ */
+int midi_sched_at_us(uint64_t deadline_us, uint16_t tag, uint8_t status, uint8_t data1, uint8_t data2);
+
+/**
+ * @brief Remove every waiting event with @p tag
+ *
+ * Note Offs among them are sent straight away rather than dropped, so
+ * notes already sounding are released.
+ *
+ * @return int Number of events removed
+ */
+int midi_sched_cancel(uint16_t tag);
+
+/**
+ * @brief Remove every waiting event (stop/pause)
+ */
+void midi_sched_flush(void);
+
+/**
+ * @brief Wait until the queue is empty
+ *
+ * @return int 0 once empty, -EAGAIN on timeout
+ */
+int midi_sched_wait_idle(k_timeout_t timeout);
+
+/**
+ * @brief Read the scheduler counters
+ */
+void midi_sched_get_stats(midi_sched_stats_t *stats);
+
+/**
+ * @brief Clear the peak, drop and lateness counters
+ */
+void midi_sched_reset_stats(void);
+
+#endif // MIDI_SCHEDULER_H
@@ -0,0 +1,130 @@
+// midi_sdi.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "midi_sdi.h"
+#include "VS1053_interface.h"
+#include "spsc_ring.h"
+#include "latency_probe.h"
+
+LOG_MODULE_REGISTER(midi_sdi, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(midi_sdi_stack, MIDI_SDI_STACK_SIZE);
+static struct k_thread midi_sdi_thread_data;
+
+// SPI can't be driven from the scheduler's timer ISR, so senders only fill the
+// ring and the worker thread turns it into SDI bursts
+static spsc_ring_t sdi_ring;
+static uint8_t sdi_ring_buf[MIDI_SDI_RING_SIZE];
+static struct k_sem sdi_data_sem;
+static struct k_sem sdi_idle_sem;
+static atomic_t sdi_busy;
+static bool sdi_ready;
+
+static uint32_t sdi_bursts;
+static uint32_t sdi_errors;
+static latency_span_t sdi_trace;
+
+static void midi_sdi_thread(void *p1, void *p2, void *p3)
+{
+    uint8_t burst[MIDI_SDI_BURST_SIZE];
+
+    while (1) {
+        k_sem_take(&sdi_data_sem, K_FOREVER);
+
+        atomic_set(&sdi_busy, 1);
+
+        // Everything queued while the last burst was on the bus goes in the next one
+        uint32_t pos = sdi_ring.tail;
+        uint32_t len;
+        while ((len = spsc_ring_get(&sdi_ring, burst, sizeof(burst))) > 0) {
+            latency_probe_span_tx_start(&sdi_trace, pos, len);
+            if (VS1053WriteSdiMidi(burst, len) != 0) {
+                sdi_errors++;
+                latency_probe_span_reset(&sdi_trace);
+            }
+            latency_probe_span_tx_done(&sdi_trace);
+            sdi_bursts++;
+            pos += len;
+        }
+
+        atomic_set(&sdi_busy, 0);
+        k_sem_give(&sdi_idle_sem);
+    }
+}
+
+int midi_sdi_init(void)
+{
+    spsc_ring_init(&sdi_ring, sdi_ring_buf, sizeof(sdi_ring_buf));
+    k_sem_init(&sdi_data_sem, 0, 1);
+    k_sem_init(&sdi_idle_sem, 0, 1);
+    atomic_set(&sdi_busy, 0);
+
+    k_tid_t tid = k_thread_create(&midi_sdi_thread_data, midi_sdi_stack,
+                                  K_THREAD_STACK_SIZEOF(midi_sdi_stack),
+                                  midi_sdi_thread, NULL, NULL, NULL,
+                                  MIDI_SDI_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start SDI MIDI thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "midi_sdi");
+
+    sdi_ready = true;
+    LOG_INF("SDI MIDI transport ready");
+    return 0;
+}
+
+bool midi_sdi_ready(void)
+{
+    return sdi_ready;
+}
+
+int midi_sdi_send(const uint8_t *data, size_t length, bool traced)
+{
+    if (!sdi_ready) {
+        return -ENODEV;
+    }
+
+    if (data == NULL || length == 0) {
+        return -EINVAL;
+    }
+
+    if (traced) {
+        latency_probe_span_queued(&sdi_trace, sdi_ring.head, length);
+    }
+    int err = spsc_ring_put(&sdi_ring, data, length);
+    if (err) {
+        if (traced) {
+            latency_probe_span_reset(&sdi_trace);
+        }
+        return err;
+    }
+
+    k_sem_give(&sdi_data_sem);
+    return 0;
+}
+
+int midi_sdi_flush(k_timeout_t timeout)
+{
+    if (!sdi_ready) {
+        return 0;
+    }
+
+    while (spsc_ring_used(&sdi_ring) > 0 || atomic_get(&sdi_busy)) {
+        if (k_sem_take(&sdi_idle_sem, timeout) != 0) {
+            return -EAGAIN;
+        }
+    }
+
+    return 0;
+}
+
+void midi_sdi_get_stats(midi_sdi_stats_t *stats)
+{
+    stats->queued = spsc_ring_used(&sdi_ring);
+    stats->high_water = sdi_ring.high_water;
+    stats->overflows = sdi_ring.overflows;
+    stats->bursts = sdi_bursts;
+    stats->errors = sdi_errors;
+}
@@ -0,0 +1,63 @@
+#ifndef MIDI_SDI_H
+#define MIDI_SDI_H
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Bytes waiting for the SPI worker, must be a power of two
+#define MIDI_SDI_RING_SIZE      512
+// Most MIDI bytes per SDI burst (twice that on the bus)
+#define MIDI_SDI_BURST_SIZE     128
+#define MIDI_SDI_STACK_SIZE     1024
+// Above the MIDI input and UI threads so note output isn't held up
+#define MIDI_SDI_PRIORITY       4
+
+// SDI transport counters
+typedef struct {
+    uint32_t queued;        // bytes waiting right now
+    uint32_t high_water;    // most bytes ever waiting at once
+    uint32_t overflows;     // sends rejected because the ring was full
+    uint32_t bursts;        // SPI bursts sent
+    uint32_t errors;        // bursts lost to a stuck DREQ
+} midi_sdi_stats_t;
+
+/**
+ * @brief Start the SDI MIDI worker
+ *
+ * Call once the VS1053 is up and the real-time MIDI plugin is loaded.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_sdi_init(void);
+
+/**
+ * @brief Whether midi_sdi_init() has run
+ */
+bool midi_sdi_ready(void);
+
+/**
+ * @brief Queue raw MIDI bytes for the VS1053 SDI port without waiting for SPI
+ *
+ * Same contract as uart_send_midi_data(): a single producer, safe from ISRs,
+ * and all-or-nothing.
+ *
+ * @param traced The bytes answer the input the latency probe is tracing
+ * @return int 0 on success, -ENOMEM if the ring is full (nothing is queued)
+ */
+int midi_sdi_send(const uint8_t *data, size_t length, bool traced);
+
+/**
+ * @brief Wait until every queued byte has been written to the VS1053
+ *
+ * @return int 0 once idle, -EAGAIN on timeout
+ */
+int midi_sdi_flush(k_timeout_t timeout);
+
+/**
+ * @brief Read the SDI transport counters
+ */
+void midi_sdi_get_stats(midi_sdi_stats_t *stats);
+
+#endif // MIDI_SDI_H
@@ -0,0 +1,269 @@
+// midi_voice.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "midi_voice.h"
+#include "midi.h"
+
+#include <string.h>
+
+LOG_MODULE_REGISTER(midi_voice, LOG_LEVEL_INF);
+
+typedef struct {
+    uint32_t age;       // allocation order, lower is older
+    uint8_t chan;
+    uint8_t note;
+    uint8_t vel;
+    bool used;
+} midi_voice_t;
+
+// Everything below is guarded by voice_lock; note calls come from threads and ISRs
+static struct k_spinlock voice_lock;
+static midi_voice_t voices[MIDI_VOICE_MAX];
+static uint8_t voice_chan_count[16];
+static uint8_t voice_active;
+static uint32_t voice_age;
+
+static uint8_t voice_global_budget = MIDI_VOICE_GLOBAL_DEFAULT;
+static uint8_t voice_chan_budget = MIDI_VOICE_CHANNEL_DEFAULT;
+static midi_voice_steal_t voice_policy = MIDI_VOICE_STEAL_OLDEST;
+
+static midi_voice_stats_t voice_stats;
+
+static int voice_find(uint8_t chan, uint8_t note)
+{
+    for (int i = 0; i < MIDI_VOICE_MAX; i++) {
+        if (voices[i].used && voices[i].chan == chan && voices[i].note == note) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Pick the voice to steal, only among @p chan unless it is 0xFF
+static int voice_victim(uint8_t chan)
+{
+    int victim = -1;
+
+    for (int i = 0; i < MIDI_VOICE_MAX; i++) {
+        const midi_voice_t *v = &voices[i];
+
+        if (!v->used || (chan != 0xFF && v->chan != chan)) {
+            continue;
+        }
+        if (victim < 0) {
+            victim = i;
+            continue;
+        }
+
+        const midi_voice_t *best = &voices[victim];
+        if (voice_policy == MIDI_VOICE_STEAL_LOWEST_VELOCITY && v->vel != best->vel) {
+            if (v->vel < best->vel) {
+                victim = i;
+            }
+        } else if ((int32_t)(v->age - best->age) < 0) {
+            victim = i;
+        }
+    }
+
+    return victim;
+}
+
+static void voice_release(int idx)
+{
+    voices[idx].used = false;
+    voice_chan_count[voices[idx].chan]--;
+    voice_active--;
+}
+
+int midi_voice_set_budget(uint8_t global, uint8_t per_channel)
+{
+    if (global == 0 || global > MIDI_VOICE_MAX || per_channel == 0 || per_channel > global) {
+        return -EINVAL;
+    }
+
+    // Lowering a budget only takes effect on the next Note On; nothing is cut now
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    voice_global_budget = global;
+    voice_chan_budget = per_channel;
+    k_spin_unlock(&voice_lock, key);
+
+    LOG_INF("Voice budget %d total, %d per channel", global, per_channel);
+    return 0;
+}
+
+void midi_voice_set_steal_policy(midi_voice_steal_t policy)
+{
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    voice_policy = policy;
+    k_spin_unlock(&voice_lock, key);
+}
+
+// Take a voice and add the Note On to @p group, with the Note Offs it costs
+// ahead of it. Steals stop once only the Note On still fits, so a budget that
+// was lowered a long way catches up over the next few Note Ons.
+// Call with voice_lock held and MIDI_VOICE_GROUP_ROOM bytes free in @p group.
+static int voice_start_locked(midi_tx_group_t *group, uint8_t chan, uint8_t note, uint8_t vel)
+{
+    int idx = voice_find(chan, note);
+    if (idx >= 0) {
+        // Same key again: end the old note so the codec doesn't stack a second voice
+        voice_release(idx);
+        midi_group_note_off(group, chan, note, 0);
+        voice_stats.retriggers++;
+    }
+
+    // Channel budget first so one busy channel can't steal from the others
+    while ((voice_chan_count[chan] >= voice_chan_budget ||
+            voice_active >= voice_global_budget) &&
+           group->len + 6 <= MIDI_TX_GROUP_SIZE) {
+        int victim = voice_victim(voice_chan_count[chan] >= voice_chan_budget ? chan : 0xFF);
+        if (victim < 0) {
+            break;
+        }
+        midi_group_note_off(group, voices[victim].chan, voices[victim].note, 0);
+        voice_release(victim);
+        voice_stats.steals++;
+    }
+
+    for (idx = 0; idx < MIDI_VOICE_MAX && voices[idx].used; idx++) {
+    }
+    if (idx == MIDI_VOICE_MAX) {
+        return -ENOMEM;
+    }
+    voices[idx] = (midi_voice_t){
+        .age = voice_age++,
+        .chan = chan,
+        .note = note,
+        .vel = vel,
+        .used = true,
+    };
+    voice_chan_count[chan]++;
+    voice_active++;
+    voice_stats.note_ons++;
+    if (voice_active > voice_stats.peak) {
+        voice_stats.peak = voice_active;
+    }
+
+    midi_group_note_on(group, chan, note, vel);
+    return 0;
+}
+
+// Free the voice of a note that is ending, if it has one. Call with voice_lock held.
+static void voice_stop_locked(uint8_t chan, uint8_t note)
+{
+    int idx = voice_find(chan, note);
+    if (idx >= 0) {
+        voice_release(idx);
+    }
+}
+
+int midi_voice_note_on(uint8_t chan, uint8_t note, uint8_t vel)
+{
+    if (chan > 15 || note > 127 || vel > 127) {
+        return -EINVAL;
+    }
+
+    if (vel == 0) {
+        return midi_voice_note_off(chan, note, 0);
+    }
+
+    midi_tx_group_t group;
+    midi_group_init(&group);
+    // Notes are played from the controls through here, so they are what the probe times
+    group.traced = true;
+
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    int ret = voice_start_locked(&group, chan, note, vel);
+    k_spin_unlock(&voice_lock, key);
+
+    // Steals and the new note leave together, Note Offs first
+    int err = midi_group_send(&group);
+    return ret ? ret : err;
+}
+
+int midi_voice_group_add(midi_tx_group_t *group, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t type = status & 0xF0;
+    uint8_t chan = status & 0x0F;
+    int ret = 0;
+
+    if (midi_msg_length(status) == 0) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+
+    if (type == note_on && data2 != 0) {
+        ret = voice_start_locked(group, chan, data1, data2);
+    } else {
+        if (type == note_on || type == note_off) {
+            voice_stop_locked(chan, data1);
+        } else if (type == control_change && (data1 == 0x78 || data1 == 0x7B)) {
+            // All Sound Off / All Notes Off end every voice on the channel
+            for (int i = 0; i < MIDI_VOICE_MAX; i++) {
+                if (voices[i].used && voices[i].chan == chan) {
+                    voice_release(i);
+                }
+            }
+        }
+        midi_group_add(group, status, data1, data2);
+    }
+
+    k_spin_unlock(&voice_lock, key);
+    return ret;
+}
+
+int midi_voice_note_off(uint8_t chan, uint8_t note, uint8_t vel)
+{
+    if (chan > 15 || note > 127 || vel > 127) {
+        return -EINVAL;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    voice_stop_locked(chan, note);
+    k_spin_unlock(&voice_lock, key);
+
+    // Sent even for untracked notes (stolen, or started before a reset);
+    // a spare Note Off is harmless, a missing one hangs a note
+    midi_tx_group_t group;
+    midi_group_init(&group);
+    group.traced = true;
+    midi_group_note_off(&group, chan, note, vel);
+    return midi_group_send(&group);
+}
+
+void midi_voice_reset(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    for (int i = 0; i < MIDI_VOICE_MAX; i++) {
+        voices[i].used = false;
+    }
+    memset(voice_chan_count, 0, sizeof(voice_chan_count));
+    voice_active = 0;
+    k_spin_unlock(&voice_lock, key);
+}
+
+uint8_t midi_voice_count(uint8_t chan)
+{
+    if (chan > 15) {
+        return 0;
+    }
+
+    return voice_chan_count[chan];
+}
+
+void midi_voice_get_stats(midi_voice_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    *stats = voice_stats;
+    stats->active = voice_active;
+    k_spin_unlock(&voice_lock, key);
+}
+
+void midi_voice_reset_stats(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&voice_lock);
+    voice_stats = (midi_voice_stats_t){ .peak = voice_active };
+    k_spin_unlock(&voice_lock, key);
+}
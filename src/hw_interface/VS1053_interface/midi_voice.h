@@ -0,0 +1,100 @@
+#ifndef MIDI_VOICE_H
+#define MIDI_VOICE_H
+
+#include <zephyr/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "midi.h"
+
+// Voices tracked at once; also the hard ceiling for the global budget
+#define MIDI_VOICE_MAX              48
+// Defaults, keep the VS1053 well inside what it can mix without dropouts
+#define MIDI_VOICE_GLOBAL_DEFAULT   24
+#define MIDI_VOICE_CHANNEL_DEFAULT  12
+// Most bytes midi_voice_group_add() puts in a group for one message:
+// a retrigger Note Off, a stolen voice's Note Off and the Note On
+#define MIDI_VOICE_GROUP_ROOM       9
+
+// Which voice gives way when a budget is full
+typedef enum {
+    MIDI_VOICE_STEAL_OLDEST,            // longest sounding note
+    MIDI_VOICE_STEAL_LOWEST_VELOCITY,   // quietest note, oldest among equals
+} midi_voice_steal_t;
+
+// Voice counters
+typedef struct {
+    uint8_t active;         // voices sounding right now
+    uint8_t peak;           // most voices ever sounding at once
+    uint32_t note_ons;      // Note Ons that got a voice
+    uint32_t steals;        // voices cut short to make room
+    uint32_t retriggers;    // Note Ons for a note that was already sounding
+} midi_voice_stats_t;
+
+/**
+ * @brief Set the voice budgets
+ *
+ * @param global Most voices across all channels, 1..MIDI_VOICE_MAX
+ * @param per_channel Most voices on any single channel, 1..@p global
+ * @return int 0 on success, -EINVAL if a budget is out of range
+ */
+int midi_voice_set_budget(uint8_t global, uint8_t per_channel);
+
+/**
+ * @brief Choose how a voice is picked when a budget is full
+ */
+void midi_voice_set_steal_policy(midi_voice_steal_t policy);
+
+/**
+ * @brief Start a note within the voice budget
+ *
+ * When a budget is full a voice is stolen with an explicit Note Off, sent in
+ * the same transfer just ahead of the new Note On.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_voice_note_on(uint8_t chan, uint8_t note, uint8_t vel);
+
+/**
+ * @brief Add a message to a group being built, with voice accounting
+ *
+ * For messages that go out in bulk (everything the scheduler releases) rather
+ * than one call per note. A Note On takes a voice within the budgets, any
+ * Note Offs that costs going into @p group ahead of it; a Note Off, All Notes
+ * Off or All Sound Off frees voices; anything else is added as is. Safe from
+ * ISRs. The caller keeps MIDI_VOICE_GROUP_ROOM bytes free in @p group, so it
+ * is never sent from here.
+ *
+ * @return int 0 on success, -ENOMEM if no voice was free (the Note On is left
+ *         out), -EINVAL for a bad message
+ */
+int midi_voice_group_add(midi_tx_group_t *group, uint8_t status, uint8_t data1, uint8_t data2);
+
+/**
+ * @brief Release a note and its voice
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_voice_note_off(uint8_t chan, uint8_t note, uint8_t vel);
+
+/**
+ * @brief Forget every voice without sending anything (after All Notes Off)
+ */
+void midi_voice_reset(void);
+
+/**
+ * @brief Voices sounding on @p chan
+ */
+uint8_t midi_voice_count(uint8_t chan);
+
+/**
+ * @brief Read the voice counters
+ */
+void midi_voice_get_stats(midi_voice_stats_t *stats);
+
+/**
+ * @brief Clear the peak and event counters
+ */
+void midi_voice_reset_stats(void);
+
+#endif // MIDI_VOICE_H
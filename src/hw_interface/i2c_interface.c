@@ -231,11 +231,12 @@ void i2c_lcd_draw_playback(enum input_modes input_mode, play_modes_struct play_m
         }
 }
 
-void i2c_lcd_draw_track(uint8_t track)
+void i2c_lcd_draw_track(uint16_t track)
 {
         fsm_copy.current_track = track;
+        //Up to three digits, clear what a longer number left behind
         i2c_lcd_set_cursor(LCD_TRACK_COL_CURSOR+1, LCD_TRACK_ROW_CURSOR);
-        ser_lcd_write_string(" ", 1);
+        ser_lcd_write_string("  ", 2);
         i2c_lcd_set_cursor(LCD_TRACK_COL_CURSOR, LCD_TRACK_ROW_CURSOR);
         ser_lcd_write_int(track);
 }
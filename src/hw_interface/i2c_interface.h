@@ -129,7 +129,7 @@ void ser_lcd_init(void);
 
 void i2c_lcd_draw_input(enum input_modes input_mode);
 void i2c_lcd_draw_playback(enum input_modes input_mode, play_modes_struct play_mode);
-void i2c_lcd_draw_track(uint8_t track);
+void i2c_lcd_draw_track(uint16_t track);
 //TODO - Uncomment this function once midi file is written
 //void i2c_lcd_draw_key(music_key_enum key);
 void i2c_lcd_draw_instrument(uint8_t instr);
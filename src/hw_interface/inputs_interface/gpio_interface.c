@@ -5,6 +5,12 @@
 #include <zephyr/logging/log.h>
 
 #include "gpio_interface.h"
+#include "midi_scheduler.h"
+#include "latency_probe.h"
+#include "midi_player.h"
+#include "track_index.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+#include "settings_store/settings_store.h"
 
 LOG_MODULE_REGISTER(gpio_interface, LOG_LEVEL_DBG);
 
@@ -294,6 +300,8 @@ int toggle_power_led(void)
 void BTN7_Handler(fsm_struct* fsm)
 {
     if (!gpio_pin_get_dt(&BTN7) && fsm->btn[6] == false && fsm->btn_change[6] == false) {
+        latency_probe_begin();
+        latency_probe_mark(LATENCY_STAGE_FSM);
         fsm->btn_change[6] = true;
         fsm->btn[6] = true;
         LOG_INF("BTN7 = 1");
@@ -307,6 +315,8 @@ void BTN7_Handler(fsm_struct* fsm)
 void BTN8_Handler(fsm_struct* fsm)
 {
     if (!gpio_pin_get_dt(&BTN8) && fsm->btn[7] == false && fsm->btn_change[7] == false) {
+        latency_probe_begin();
+        latency_probe_mark(LATENCY_STAGE_FSM);
         fsm->btn_change[7] = true;
         fsm->btn[7] = true;
         LOG_INF("BTN8 = 1");
@@ -319,15 +329,59 @@ void BTN8_Handler(fsm_struct* fsm)
 
 bool track_new = false;
 
+//Start the tempo setting at the opening tempo of the selected song
+static void load_track_tempo(fsm_struct* fsm)
+{
+    char path[MIDI_PLAYER_PATH_LEN];
+    track_meta_t meta;
+    uint16_t bpm;
+
+    //The track index already has it, without opening the song
+    if (track_index_get(fsm->current_track, &meta) == 0)
+    {
+        bpm = track_meta_bpm(&meta);
+        LOG_INF("Track %d: %u:%02u, %d/%d", fsm->current_track, meta.duration_ms / 60000,
+                (meta.duration_ms / 1000) % 60, meta.time_sig_num, 1 << meta.time_sig_den);
+    }
+    else if (get_track_file_name(fsm->current_track, path, sizeof(path)) != 0 ||
+             midi_player_song_tempo(path, &bpm) != 0)
+    {
+        LOG_INF("No tempo for track %d, keeping %d BPM", fsm->current_track, fsm->tempo);
+        return;
+    }
+
+    //A new song plays as written until the tempo is turned
+    midi_player_set_tempo(0);
+    fsm->tempo = CLAMP(bpm, MIN_TEMPO, MAX_TEMPO);
+    LOG_INF("Track %d tempo %d BPM", fsm->current_track, bpm);
+}
+
+//Entering a menu ends the song (the player silences its own notes) and any
+//queued test notes; scheduled traffic with other owners is left alone
+static void menu_stop_playback(void)
+{
+    midi_player_stop();
+    midi_sched_cancel(MIDI_SCHED_TAG_TEST);
+}
+
 //Function to handle track/instrument/tempo selection
 void ENC1_Handler(fsm_struct* fsm)
 {
+    latency_probe_mark(LATENCY_STAGE_FSM);
+
     if (fsm->settings_menu.music_settings != MUSIC_IDLE && fsm->settings_menu.operation_settings == OPERATION_IDLE)
     {
         //arp_stop();  //Pat note: copied from old SAMI, don't know what this is
+        //Tempo changes apply to the song as it plays, so leave it running
+        if (fsm->settings_menu.music_settings != SET_TEMPO)
+        {
+            menu_stop_playback();
+        }
         switch(fsm->settings_menu.music_settings)
         {
             case SET_TRACK:
+                //The scan may have found any number of songs
+                settings_store_fit_track(fsm, get_track_count());
                 i2c_lcd_clear();
                 i2c_lcd_draw_track(fsm->current_track);
 
@@ -357,9 +411,7 @@ void ENC1_Handler(fsm_struct* fsm)
                             if (fsm->current_track != fsm->previous_track)
                             {
                                 track_new = true;
-                                //TODO - Alex: Replace with correct functions once they are written
-                                //
-                                //fsm->tempo = MICROSECONDS_PER_MIN / track_list[0].tempo;
+                                load_track_tempo(fsm);
                                 //arpTempo_set(fsm->tempo); //Copied from old SAMI, dont know again
                             }
 
@@ -385,8 +437,7 @@ void ENC1_Handler(fsm_struct* fsm)
                             {
                                 //Set track_new flag to be handled in main
                                 track_new = true;
-                                //TODO - Alex: Replace with correct functions once they are written
-                                //fsm->tempo = MICROSECONDS_PER_MIN / track_list[0].tempo;
+                                load_track_tempo(fsm);
                                 //arpTempo_set(fsm->tempo); //Copied from old SAMI, dont know again
                             }
 
@@ -463,6 +514,7 @@ void ENC1_Handler(fsm_struct* fsm)
 
                             LOG_INF("Tempo CW\n");
                             i2c_lcd_draw_tempo(fsm->tempo);
+                            midi_player_set_tempo(fsm->tempo);
                             break;
                         
                         case ENC_CCW:
@@ -478,6 +530,7 @@ void ENC1_Handler(fsm_struct* fsm)
 
                             LOG_INF("Tempo CW\n");
                             i2c_lcd_draw_tempo(fsm->tempo);
+                            midi_player_set_tempo(fsm->tempo);
                             break;
                     }
                 }
@@ -488,15 +541,21 @@ void ENC1_Handler(fsm_struct* fsm)
                 break;
         }
     }
+
+    settings_store_mark_dirty(fsm);
 }
 
 //Function to handle input/playback settings selection
 void ENC2_Handler(fsm_struct* fsm)
 {
+    latency_probe_mark(LATENCY_STAGE_FSM);
+
     //enum input_modes prev_input_mode = fsm->input_mode; //Pat note: pretty sure we don't need this
 
     if(fsm->settings_menu.music_settings == MUSIC_IDLE && fsm->settings_menu.operation_settings != OPERATION_IDLE)
     {
+        menu_stop_playback();
+
         switch (fsm->settings_menu.operation_settings)
         {
             case INPUT_MENU:
@@ -691,4 +750,6 @@ void ENC2_Handler(fsm_struct* fsm)
         midiSetInstrument(etc.)
     }
     */
+
+    settings_store_mark_dirty(fsm);
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+// latency_probe.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <cmsis_core.h>
+#include <string.h>
+
+#include "latency_probe.h"
+
+LOG_MODULE_REGISTER(latency_probe, LOG_LEVEL_INF);
+
+#if LATENCY_PROBE_ENABLED
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;       // cycles
+    uint32_t max;       // cycles
+    uint64_t sum;       // cycles
+    uint32_t hist[LATENCY_HIST_BUCKETS];
+} latency_acc_t;
+
+static const char *const stage_names[LATENCY_STAGE_COUNT] = {
+    [LATENCY_STAGE_GPIO_ISR] = "gpio_isr",
+    [LATENCY_STAGE_FSM] = "fsm",
+    [LATENCY_STAGE_MIDI_ENCODE] = "midi_encode",
+    [LATENCY_STAGE_TX_START] = "tx_start",
+    [LATENCY_STAGE_TX_DONE] = "tx_done",
+};
+
+// Marks come from GPIO, timer and UART ISRs as well as threads
+static struct k_spinlock probe_lock;
+static latency_acc_t probe_acc[LATENCY_STAGE_COUNT];
+static bool probe_open;
+static uint32_t probe_t0;       // DWT cycles at the edge
+static uint8_t probe_seen;      // stages already recorded for the open trace
+static uint32_t probe_cycles_per_us;
+
+static inline uint32_t probe_now(void)
+{
+    return DWT->CYCCNT;
+}
+
+static uint32_t probe_to_us(uint64_t cycles)
+{
+    return (uint32_t)(cycles / probe_cycles_per_us);
+}
+
+static void probe_acc_reset(latency_acc_t *acc)
+{
+    *acc = (latency_acc_t){ .min = UINT32_MAX };
+}
+
+void latency_probe_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    probe_cycles_per_us = SystemCoreClock / 1000000;
+    latency_probe_reset();
+
+    LOG_INF("Latency probe running at %d cycles/us", probe_cycles_per_us);
+}
+
+void latency_probe_begin(void)
+{
+    uint32_t now = probe_now();
+    k_spinlock_key_t key = k_spin_lock(&probe_lock);
+
+    // A trace that never made it to the wire would block every later one
+    if (probe_open && (now - probe_t0) / probe_cycles_per_us > LATENCY_TRACE_TIMEOUT_MS * 1000) {
+        probe_open = false;
+    }
+
+    if (!probe_open) {
+        probe_open = true;
+        probe_t0 = now;
+        probe_seen = 0;
+    }
+
+    k_spin_unlock(&probe_lock, key);
+}
+
+void latency_probe_mark(latency_stage_t stage)
+{
+    if (!probe_open || stage >= LATENCY_STAGE_COUNT) {
+        return;
+    }
+
+    uint32_t now = probe_now();
+    k_spinlock_key_t key = k_spin_lock(&probe_lock);
+
+    if (probe_open && !(probe_seen & BIT(stage))) {
+        uint32_t cycles = now - probe_t0;
+        latency_acc_t *acc = &probe_acc[stage];
+
+        probe_seen |= BIT(stage);
+        acc->count++;
+        acc->sum += cycles;
+        if (cycles < acc->min) {
+            acc->min = cycles;
+        }
+        if (cycles > acc->max) {
+            acc->max = cycles;
+        }
+
+        uint32_t us = cycles / probe_cycles_per_us;
+        uint32_t bucket = us < 2 ? 0 : 31 - __builtin_clz(us);
+        acc->hist[MIN(bucket, LATENCY_HIST_BUCKETS - 1)]++;
+
+        if (stage == LATENCY_STAGE_TX_DONE) {
+            probe_open = false;
+        }
+    }
+
+    k_spin_unlock(&probe_lock, key);
+}
+
+void latency_probe_span_queued(latency_span_t *span, uint32_t pos, uint32_t len)
+{
+    span->start = pos;
+    span->end = pos + len;
+    span->done_pending = false;
+    // The transport only looks at the fields once it sees the span armed
+    atomic_set(&span->armed, 1);
+}
+
+void latency_probe_span_tx_start(latency_span_t *span, uint32_t pos, uint32_t len)
+{
+    if (!atomic_get(&span->armed)) {
+        return;
+    }
+
+    // Positions run freely, so compare distances
+    if (span->start - pos < len) {
+        latency_probe_mark(LATENCY_STAGE_TX_START);
+    }
+    if (span->end - 1 - pos < len) {
+        span->done_pending = true;
+    }
+}
+
+void latency_probe_span_tx_done(latency_span_t *span)
+{
+    if (atomic_get(&span->armed) && span->done_pending) {
+        atomic_clear(&span->armed);
+        latency_probe_mark(LATENCY_STAGE_TX_DONE);
+    }
+}
+
+void latency_probe_span_reset(latency_span_t *span)
+{
+    atomic_clear(&span->armed);
+}
+
+void latency_probe_get(latency_stage_t stage, latency_stage_stats_t *stats)
+{
+    if (stage >= LATENCY_STAGE_COUNT) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&probe_lock);
+    const latency_acc_t *acc = &probe_acc[stage];
+
+    stats->count = acc->count;
+    stats->min_us = acc->count ? probe_to_us(acc->min) : 0;
+    stats->max_us = probe_to_us(acc->max);
+    stats->mean_us = acc->count ? probe_to_us(acc->sum / acc->count) : 0;
+    memcpy(stats->hist, acc->hist, sizeof(stats->hist));
+
+    k_spin_unlock(&probe_lock, key);
+}
+
+void latency_probe_reset(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&probe_lock);
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        probe_acc_reset(&probe_acc[i]);
+    }
+    probe_open = false;
+    k_spin_unlock(&probe_lock, key);
+}
+
+void latency_probe_dump(void)
+{
+    latency_stage_stats_t stats;
+
+    LOG_INF("=== Input to audio latency (us from edge) ===");
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        latency_probe_get(s, &stats);
+        LOG_INF("%-12s n=%u min=%u mean=%u max=%u", stage_names[s],
+                stats.count, stats.min_us, stats.mean_us, stats.max_us);
+        for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+            if (stats.hist[b]) {
+                LOG_INF("    <%6u us: %u", 2U << b, stats.hist[b]);
+            }
+        }
+    }
+}
+
+#ifdef CONFIG_SHELL
+
+static int cmd_latency_show(const struct shell *sh, size_t argc, char **argv)
+{
+    latency_stage_stats_t stats;
+
+    shell_print(sh, "%-12s %8s %8s %8s %8s", "stage", "count", "min_us", "mean_us", "max_us");
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        latency_probe_get(s, &stats);
+        shell_print(sh, "%-12s %8u %8u %8u %8u", stage_names[s],
+                    stats.count, stats.min_us, stats.mean_us, stats.max_us);
+    }
+    return 0;
+}
+
+static int cmd_latency_hist(const struct shell *sh, size_t argc, char **argv)
+{
+    latency_stage_stats_t stats;
+
+    for (int s = 0; s < LATENCY_STAGE_COUNT; s++) {
+        latency_probe_get(s, &stats);
+        shell_print(sh, "%s:", stage_names[s]);
+        for (int b = 0; b < LATENCY_HIST_BUCKETS; b++) {
+            if (stats.hist[b]) {
+                shell_print(sh, "  <%6u us %8u", 2U << b, stats.hist[b]);
+            }
+        }
+    }
+    return 0;
+}
+
+static int cmd_latency_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    latency_probe_reset();
+    shell_print(sh, "Latency statistics cleared");
+    return 0;
+}
+
+static int cmd_latency_dump(const struct shell *sh, size_t argc, char **argv)
+{
+    latency_probe_dump();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_latency,
+    SHELL_CMD(show, NULL, "Per-stage min/mean/max", cmd_latency_show),
+    SHELL_CMD(hist, NULL, "Per-stage log2 histograms", cmd_latency_hist),
+    SHELL_CMD(reset, NULL, "Clear statistics", cmd_latency_reset),
+    SHELL_CMD(dump, NULL, "Write everything to the log", cmd_latency_dump),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(latency, &sub_latency, "Input to audio latency probe", NULL);
+
+#endif // CONFIG_SHELL
+
+#endif // LATENCY_PROBE_ENABLED
@@ -0,0 +1,123 @@
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <zephyr/types.h>
+#include <zephyr/sys/atomic.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Set to 0 to compile every probe out
+#define LATENCY_PROBE_ENABLED       1
+
+// log2 buckets of microseconds: bucket 0 is < 2 us, bucket n is [2^n, 2^(n+1)) us
+#define LATENCY_HIST_BUCKETS        16
+// A trace that hasn't reached TX done by then produced no MIDI and is dropped
+#define LATENCY_TRACE_TIMEOUT_MS    200
+
+// Points on the way from a button edge to the last MIDI byte leaving the UART.
+// Each sample is the time from the edge to reaching that stage.
+typedef enum {
+    LATENCY_STAGE_GPIO_ISR,     // end of the input interrupt handler
+    LATENCY_STAGE_FSM,          // state machine picked the input up
+    LATENCY_STAGE_MIDI_ENCODE,  // message group encoded and queued
+    LATENCY_STAGE_TX_START,     // UART transfer started
+    LATENCY_STAGE_TX_DONE,      // UART transfer finished
+    LATENCY_STAGE_COUNT,
+} latency_stage_t;
+
+// Where the traced input's MIDI sits in a transport's byte stream, so only the
+// transfers carrying it stamp TX start and TX done, not whatever else (song
+// playback, MIDI thru) happens to be going out. One per transport.
+typedef struct {
+    atomic_t armed;
+    uint32_t start;         // stream position of the traced group's first byte
+    uint32_t end;           // one past its last byte
+    bool done_pending;      // the transfer with its last byte has started
+} latency_span_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint32_t mean_us;
+    uint32_t hist[LATENCY_HIST_BUCKETS];
+} latency_stage_stats_t;
+
+#if LATENCY_PROBE_ENABLED
+
+/**
+ * @brief Start the cycle counter used for stamping
+ */
+void latency_probe_init(void);
+
+/**
+ * @brief Stamp an input edge and open a trace (call first thing in the ISR)
+ *
+ * Only one trace is open at a time; edges that arrive while one is open are
+ * not traced.
+ */
+void latency_probe_begin(void);
+
+/**
+ * @brief Record reaching @p stage for the open trace
+ *
+ * Only the first time each stage is reached counts. TX done closes the trace.
+ * Does nothing when no trace is open. The TX stages are stamped through a
+ * latency_span_t, so only for the transfers carrying the traced input.
+ */
+void latency_probe_mark(latency_stage_t stage);
+
+/**
+ * @brief Sender side: the traced group is about to be queued at @p pos
+ *
+ * Call before the bytes are made visible to the transport, so it can't send
+ * them unnoticed; latency_probe_span_reset() if queueing them then fails.
+ */
+void latency_probe_span_queued(latency_span_t *span, uint32_t pos, uint32_t len);
+
+/**
+ * @brief Transport side: a transfer of stream bytes [@p pos, @p pos + @p len) starts
+ */
+void latency_probe_span_tx_start(latency_span_t *span, uint32_t pos, uint32_t len);
+
+/**
+ * @brief Transport side: the transfer last started has finished
+ */
+void latency_probe_span_tx_done(latency_span_t *span);
+
+/**
+ * @brief Forget the traced group, e.g. after its bytes were lost
+ */
+void latency_probe_span_reset(latency_span_t *span);
+
+/**
+ * @brief Read one stage's statistics
+ */
+void latency_probe_get(latency_stage_t stage, latency_stage_stats_t *stats);
+
+/**
+ * @brief Clear all statistics
+ */
+void latency_probe_reset(void);
+
+/**
+ * @brief Log every stage's statistics and histogram (ends up on RTT)
+ */
+void latency_probe_dump(void);
+
+#else
+
+static inline void latency_probe_init(void) {}
+static inline void latency_probe_begin(void) {}
+static inline void latency_probe_mark(latency_stage_t stage) {}
+static inline void latency_probe_span_queued(latency_span_t *span, uint32_t pos, uint32_t len) {}
+static inline void latency_probe_span_tx_start(latency_span_t *span, uint32_t pos, uint32_t len) {}
+static inline void latency_probe_span_tx_done(latency_span_t *span) {}
+static inline void latency_probe_span_reset(latency_span_t *span) {}
+static inline void latency_probe_get(latency_stage_t stage, latency_stage_stats_t *stats) {}
+static inline void latency_probe_reset(void) {}
+static inline void latency_probe_dump(void) {}
+
+#endif // LATENCY_PROBE_ENABLED
+
+#endif // LATENCY_PROBE_H
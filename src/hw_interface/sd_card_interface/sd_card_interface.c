@@ -15,11 +15,16 @@
 #include <diskio.h>
 #include <string.h>
 #include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/spi.h>
 
 #include "sd_card_interface.h"
 #include "spi_interface.h"
+#include "sd_sector_cache.h"
+#include "sd_file_pool.h"
+#include "sd_readahead.h"
 
 #define MODULE sd_card_interface
 LOG_MODULE_REGISTER(MODULE);
@@ -29,41 +34,53 @@ LOG_MODULE_REGISTER(MODULE);
 //
 #define DISK_MOUNT_PT   "/SD:"
 //#define DISK_NAME       "SD Card slot" //Must match the overlay label
-//FATFS objects
+//FATFS objects; files come from the handle pool (sd_file_pool.h)
 static FATFS fs;
-static DIR dir;
-static FILINFO fno;
-static FIL file;
+//Mount point; the file system keeps a pointer to it while mounted
+static struct fs_mount_t sd_mount = {
+    .type = FS_FATFS,
+    .fs_data = &fs,
+    .mnt_point = DISK_MOUNT_PT,
+};
 //SD card logical drive
 #define SD_DRIVE        "SD:"
 //MIDI directory
 #define MIDI_DIR        "/MIDI"
-//Settings file
-#define SETTINGS_FILE   "/settings.txt"
-//Maximum number of tracks
-#define MAX_MIDI_TRACKS     10
 //Buffers
 #define MAX_SD_READ_BUFFER  512
-#define MAX_SETTINGS_READ_WRITE_BUFFER  32
 static char file_buf[1024];
-//Track file names
-static char track_file_names[MAX_MIDI_TRACKS][32];
-static uint8_t num_tracks = 0;
+//Track file names: offsets into one pool of NUL-terminated names, in track order
+static uint16_t song_name_offset[MAX_SONG_FILES];
+static char song_name_pool[SONG_NAME_POOL_SIZE];
+static uint16_t song_name_pool_used = 0;
+static uint16_t num_tracks = 0;
+
+//What a saved listing was written for
+typedef struct {
+    uint32_t volume_serial;
+    uint16_t dir_date;
+    uint16_t dir_time;
+} song_list_stamp_t;
+
+//Saved as is at the top of SONG_LIST_FILE, followed by the offsets and the pool
+typedef struct {
+    uint32_t magic;         //Written last, so a partial listing never loads
+    uint16_t version;
+    uint16_t count;
+    uint32_t pool_used;
+    song_list_stamp_t stamp;    //Card and directory it lists
+} song_list_header_t;
 
 // TODO PATRICK - This is code spat out by chat GPT after I put in SEGGER code into it and asked it to convert to NRF Connect
 //              - test all these functions out in main to see if it works and change accordingly. Uses FATFS
 /**
  * @brief Initialize the SD card interface hardware
  * 
+ * Doesn't touch the card; sd_manager probes it and mounts it when one is in.
+ * 
  * @return int 0 on success, negative error code otherwise
  */
 int SDcardInterfaceInit(void) {
-    //Small delay
-    k_sleep(K_MSEC(500));
-
-    int ret_code = 0;
-    uint8_t retries = 3;
-
     //Check if SD spi is ready
     const struct device *sdc_spi = DEVICE_DT_GET(DT_ALIAS(sdcardspi));
     if (!device_is_ready(sdc_spi))
@@ -82,25 +99,17 @@ int SDcardInterfaceInit(void) {
     }
     LOG_INF("SD - MMC ready");
 
-    //Check if disk is already initialized
-    const char *disk_name = sdc_disk->name;
-    LOG_INF("SD card mmc name: %s", disk_name);
+    //The card is registered under its volume name (CONFIG_SDMMC_VOLUME_NAME), not the device name
+    LOG_INF("SD card mmc name: %s, volume %s", sdc_disk->name, SD_SECTOR_CACHE_RAW_DISK);
 
-    while (retries--) 
-    {
-        ret_code = disk_access_init(disk_name);
-        if (ret_code == 0){
-            LOG_INF("Disk init success - test 1\n");
-            return 0;
-        }
-        else
-        {
-            LOG_INF("%s Disk init failed, code: %d, retrying\n", disk_name, ret_code);
-            k_sleep(K_MSEC(500));
-        }
+    //FatFs goes through the sector cache, which forwards to the card
+    int ret = sd_sector_cache_init();
+    if (ret != 0) {
+        return -1;
     }
-    LOG_INF("Disk init failed three times\n");
-    return -1;
+
+    //Read-ahead worker, shared by every card that gets mounted
+    return sd_readahead_init();
 }
 
 int CheckDevices(void)
@@ -124,6 +133,24 @@ int CheckDevices(void)
     return 0;
 }
 
+//On FAT32 the MIDI directory lives in the data area like any file, outside
+//the FAT region the sector cache finds by itself. Pin its first cluster, which
+//holds the entries of the first few hundred songs at any usual cluster size.
+static void sd_pin_midi_dir(void)
+{
+    char midi_path[32];
+    DIR dir;
+
+    snprintf(midi_path, sizeof(midi_path), "%s%s", SD_DRIVE, MIDI_DIR);
+    if (f_opendir(&dir, midi_path) != FR_OK) {
+        return;
+    }
+    if (dir.obj.sclust >= 2) {
+        sd_sector_cache_pin(fs.database + (dir.obj.sclust - 2) * fs.csize, fs.csize);
+    }
+    f_closedir(&dir);
+}
+
 /**
  * @brief Initialize the SD card file system
  * 
@@ -133,14 +160,8 @@ int CheckDevices(void)
  // TODO - Patrick: Check all these
 
 int SDcardInit(void) {
-    struct fs_mount_t mp = {
-        .type = FS_FATFS,
-        .fs_data = &fs,
-        .mnt_point = DISK_MOUNT_PT,
-    };
-    
     //Mount the file system
-    int ret = fs_mount(&mp);
+    int ret = fs_mount(&sd_mount);
 
     if (ret != 0) {
         LOG_INF("Mounting failed\n");
@@ -174,34 +195,174 @@ int SDcardInit(void) {
 
     fs_closedir(&dir);
 
+    sd_pin_midi_dir();
     return 0;
 }
 
 /**
- * @brief Scan for MIDI files in the MIDI directory
- * 
- * This function scans the MIDI directory for .mid files and
- * populates the track_file_names array.
+ * @brief Unmount the SD card file system and forget its songs
  * 
- * @return int Number of MIDI files found
+ * @return int 0 on success, negative error code otherwise
  */
-int scan_midi_files(void) {
+int SDcardDeinit(void) {
+    //Nothing may look up a song on a card that is gone
+    num_tracks = 0;
+    song_name_pool_used = 0;
+
+    int ret = fs_unmount(&sd_mount);
+    if (ret != 0) {
+        LOG_INF("Unmounting failed: %d", ret);
+        return ret;
+    }
+
+    LOG_INF("SD card unmounted");
+    return 0;
+}
+
+//Songs are the .mid files; the listing, index and caches kept next to them aren't
+static bool song_list_is_song(const FILINFO *fno)
+{
+    size_t name_len = strlen(fno->fname);
+
+    return !(fno->fattrib & AM_DIR) && name_len > 4 &&
+           strcasecmp(&fno->fname[name_len - 4], ".mid") == 0;
+}
+
+//Key the saved listing on the card's volume serial and the MIDI directory's
+//timestamp, both known without walking the directory. Songs copied in from a
+//computer don't always touch either, so after changing the card elsewhere the
+//listing is refreshed with `tracks rescan` or sd_manager_rescan().
+static int song_list_stamp(song_list_stamp_t *stamp)
+{
+    sd_sector_cache_stats_t cache;
+    FILINFO fno;
+
+    if (f_stat(SD_DRIVE MIDI_DIR, &fno) != FR_OK || !(fno.fattrib & AM_DIR)) {
+        return -ENOENT;
+    }
+    sd_sector_cache_get_stats(&cache);
+
+    *stamp = (song_list_stamp_t){
+        .volume_serial = cache.volume_serial,
+        .dir_date = fno.fdate,
+        .dir_time = fno.ftime,
+    };
+    return 0;
+}
+
+static bool song_list_read(int handle, void *buf, size_t len)
+{
+    return sd_file_read(handle, buf, len) == (int)len;
+}
+
+//Load the saved listing if it belongs to this card and directory
+static bool song_list_load(const song_list_stamp_t *stamp)
+{
+    song_list_header_t hdr;
+    bool ok = false;
+
+    int handle = sd_file_open(SONG_LIST_FILE, FA_READ);
+    if (handle < 0) {
+        return false;
+    }
+
+    if (song_list_read(handle, &hdr, sizeof(hdr)) && hdr.magic == SONG_LIST_MAGIC &&
+        hdr.version == SONG_LIST_VERSION && hdr.count <= MAX_SONG_FILES &&
+        hdr.pool_used <= SONG_NAME_POOL_SIZE &&
+        memcmp(&hdr.stamp, stamp, sizeof(*stamp)) == 0) {
+        ok = song_list_read(handle, song_name_offset, hdr.count * sizeof(song_name_offset[0])) &&
+             song_list_read(handle, song_name_pool, hdr.pool_used);
+    }
+    sd_file_close(handle);
+
+    //Every name has to end inside the pool
+    for (uint16_t i = 0; ok && i < hdr.count; i++) {
+        ok = song_name_offset[i] < hdr.pool_used &&
+             memchr(&song_name_pool[song_name_offset[i]], '\0',
+                    hdr.pool_used - song_name_offset[i]) != NULL;
+    }
+
+    if (ok) {
+        num_tracks = hdr.count;
+        song_name_pool_used = hdr.pool_used;
+    }
+    return ok;
+}
+
+static void song_list_save(const song_list_stamp_t *stamp)
+{
+    song_list_header_t hdr = {
+        .magic = 0,
+        .version = SONG_LIST_VERSION,
+        .count = num_tracks,
+        .pool_used = song_name_pool_used,
+        .stamp = *stamp,
+    };
+
+    int handle = sd_file_open(SONG_LIST_FILE, FA_WRITE | FA_CREATE_ALWAYS);
+    if (handle < 0) {
+        LOG_INF("Failed to create %s: %d", SONG_LIST_FILE, handle);
+        return;
+    }
+
+    bool ok = sd_file_write(handle, &hdr, sizeof(hdr)) == 0 &&
+              sd_file_write(handle, song_name_offset, num_tracks * sizeof(song_name_offset[0])) == 0 &&
+              sd_file_write(handle, song_name_pool, song_name_pool_used) == 0;
+    if (ok) {
+        hdr.magic = SONG_LIST_MAGIC;
+        ok = sd_file_seek(handle, 0) == 0 && sd_file_write(handle, &hdr, sizeof(hdr)) == 0;
+    }
+    sd_file_close(handle);
+
+    if (!ok) {
+        LOG_INF("Failed to write %s", SONG_LIST_FILE);
+        f_unlink(SONG_LIST_FILE);
+    }
+}
+
+//Numbered songs first, in number order ("2_" before "10_"), then the rest by name
+static int song_name_compare(const void *a, const void *b)
+{
+    const char *name_a = &song_name_pool[*(const uint16_t *)a];
+    const char *name_b = &song_name_pool[*(const uint16_t *)b];
+    bool num_a = isdigit((unsigned char)name_a[0]);
+    bool num_b = isdigit((unsigned char)name_b[0]);
+
+    if (num_a != num_b) {
+        return num_a ? -1 : 1;
+    }
+    if (num_a) {
+        unsigned long n_a = strtoul(name_a, NULL, 10);
+        unsigned long n_b = strtoul(name_b, NULL, 10);
+        if (n_a != n_b) {
+            return n_a < n_b ? -1 : 1;
+        }
+    }
+    return strcasecmp(name_a, name_b);
+}
+
+//Walk the MIDI directory and fill the name pool
+static int song_list_walk(void)
+{
     FRESULT res;
+    DIR dir;
+    FILINFO fno;
     char midi_path[32];
-    
-    /* Reset track count */
+    uint16_t skipped = 0;
+
     num_tracks = 0;
-    
+    song_name_pool_used = 0;
+
     /* Format MIDI directory path */
     snprintf(midi_path, sizeof(midi_path), "%s%s", SD_DRIVE, MIDI_DIR);
-    
+
     /* Open MIDI directory */
     res = f_opendir(&dir, midi_path);
     if (res != FR_OK) {
         LOG_INF("Failed to open MIDI directory: %d", res);
-        return 0;
+        return -ENOENT;
     }
-    
+
     /* Scan for MIDI files */
     while (1) {
         /* Read directory entry */
@@ -210,37 +371,80 @@ int scan_midi_files(void) {
             /* End of directory or error */
             break;
         }
-        
-        /* Skip directories */
-        if (fno.fattrib & AM_DIR) {
-            continue;
-        }
-        
-        /* Check if file has .mid extension */
+
+        /* Only .mid files, no directories */
         size_t name_len = strlen(fno.fname);
-        if (name_len > 4 && strcasecmp(&fno.fname[name_len - 4], ".mid") == 0) {
-            /* Copy file name to track_file_names array */
-            if (num_tracks < MAX_MIDI_TRACKS) {
-                snprintf(track_file_names[num_tracks], sizeof(track_file_names[0]),
-                         "%s/%s", midi_path, fno.fname);
-                num_tracks++;
+        if (song_list_is_song(&fno)) {
+            /* Append the name to the pool */
+            if (sizeof(SD_DRIVE MIDI_DIR "/") + name_len > SONG_PATH_LEN) {
+                LOG_INF("Name too long, skipping %s", fno.fname);
+                skipped++;
+            } else if (num_tracks < MAX_SONG_FILES &&
+                song_name_pool_used + name_len + 1 <= SONG_NAME_POOL_SIZE) {
+                song_name_offset[num_tracks++] = song_name_pool_used;
+                memcpy(&song_name_pool[song_name_pool_used], fno.fname, name_len + 1);
+                song_name_pool_used += name_len + 1;
+            } else {
+                skipped++;
             }
         }
     }
-    
+
     /* Close directory */
     f_closedir(&dir);
-    
+
+    if (skipped) {
+        LOG_INF("Left out %d MIDI files", skipped);
+    }
+
+    /* Stable numbering whatever order the directory is in */
+    qsort(song_name_offset, num_tracks, sizeof(song_name_offset[0]), song_name_compare);
+    return num_tracks;
+}
+
+/**
+ * @brief Scan for MIDI files in the MIDI directory
+ * 
+ * This function loads the saved listing of the MIDI directory, or walks the
+ * directory for .mid files when the card or the directory's timestamp changed
+ * since; rescan_midi_files() always walks it.
+ * 
+ * @return int Number of MIDI files found
+ */
+int scan_midi_files(void) {
+    song_list_stamp_t stamp;
+
+    if (song_list_stamp(&stamp) != 0) {
+        LOG_INF("No MIDI directory");
+        num_tracks = 0;
+        song_name_pool_used = 0;
+        return 0;
+    }
+    if (song_list_load(&stamp)) {
+        LOG_INF("Found %d MIDI files (saved listing)", num_tracks);
+        return num_tracks;
+    }
+
+    if (song_list_walk() < 0) {
+        return 0;
+    }
+    song_list_save(&stamp);
+
     LOG_INF("Found %d MIDI files", num_tracks);
     return num_tracks;
 }
 
+int rescan_midi_files(void) {
+    f_unlink(SONG_LIST_FILE);
+    return scan_midi_files();
+}
+
 /**
  * @brief Get the number of MIDI tracks
  * 
- * @return uint8_t Number of tracks
+ * @return uint16_t Number of tracks
  */
-uint8_t get_track_count(void) {
+uint16_t get_track_count(void) {
     return num_tracks;
 }
 
@@ -252,14 +456,15 @@ uint8_t get_track_count(void) {
  * @param len Length of the buffer
  * @return int 0 on success, negative error code otherwise
  */
-int get_track_file_name(uint8_t track_number, char *file_name, size_t len) {
+int get_track_file_name(uint16_t track_number, char *file_name, size_t len) {
     if (track_number == 0 || track_number > num_tracks) {
         return -EINVAL;
     }
-    
-    /* Copy file name to buffer */
-    strncpy(file_name, track_file_names[track_number - 1], len);
-    return 0;
+
+    /* Full path of the file */
+    int n = snprintf(file_name, len, "%s%s/%s", SD_DRIVE, MIDI_DIR,
+                     &song_name_pool[song_name_offset[track_number - 1]]);
+    return (n < 0 || (size_t)n >= len) ? -ENAMETOOLONG : 0;
 }
 
 /**
@@ -271,27 +476,21 @@ int get_track_file_name(uint8_t track_number, char *file_name, size_t len) {
  * @return int Number of bytes read, negative error code otherwise
  */
 int read_file(const char *file_name, uint8_t *buffer, size_t max_size) {
-    FRESULT res;
-    UINT bytes_read;
-    
     /* Open file */
-    res = f_open(&file, file_name, FA_READ);
-    if (res != FR_OK) {
-        LOG_INF("Failed to open file %s: %d", file_name, res);
+    int handle = sd_readahead_open(file_name);
+    if (handle < 0) {
+        LOG_INF("Failed to open file %s: %d", file_name, handle);
         return -EIO;
     }
-    
-    /* Read file contents */
-    res = f_read(&file, buffer, max_size, &bytes_read);
-    if (res != FR_OK) {
-        LOG_INF("Failed to read file %s: %d", file_name, res);
-        f_close(&file);
+
+    /* Read file contents, one request so whole sectors go to the card as multi-block reads */
+    int bytes_read = sd_readahead_read(handle, 0, buffer, max_size);
+    sd_readahead_close(handle);
+    if (bytes_read < 0) {
+        LOG_INF("Failed to read file %s: %d", file_name, bytes_read);
         return -EIO;
     }
-    
-    /* Close file */
-    f_close(&file);
-    
+
     LOG_INF("Read %d bytes from file %s", bytes_read, file_name);
     return bytes_read;
 }
@@ -305,28 +504,27 @@ int read_file(const char *file_name, uint8_t *buffer, size_t max_size) {
  * @return int 0 on success, negative error code otherwise
  */
 int write_file(const char *file_name, const uint8_t *buffer, size_t size) {
-    FRESULT res;
-    UINT bytes_written;
+    int res;
     
     /* Open file */
-    res = f_open(&file, file_name, FA_WRITE | FA_CREATE_ALWAYS);
-    if (res != FR_OK) {
-        LOG_INF("Failed to open file %s for writing: %d", file_name, res);
+    int handle = sd_file_open(file_name, FA_WRITE | FA_CREATE_ALWAYS);
+    if (handle < 0) {
+        LOG_INF("Failed to open file %s for writing: %d", file_name, handle);
         return -EIO;
     }
     
     /* Write file contents */
-    res = f_write(&file, buffer, size, &bytes_written);
-    if (res != FR_OK || bytes_written != size) {
+    res = sd_file_write(handle, buffer, size);
+    if (res != 0) {
         LOG_INF("Failed to write file %s: %d", file_name, res);
-        f_close(&file);
+        sd_file_close(handle);
         return -EIO;
     }
     
     /* Close file */
-    f_close(&file);
+    sd_file_close(handle);
     
-    LOG_INF("Wrote %d bytes to file %s", bytes_written, file_name);
+    LOG_INF("Wrote %d bytes to file %s", size, file_name);
     return 0;
 }
 
@@ -338,6 +536,7 @@ int write_file(const char *file_name, const uint8_t *buffer, size_t size) {
  */
 int get_file_size(const char *file_name) {
     FRESULT res;
+    FILINFO fno;
     
     /* Get file information */
     res = f_stat(file_name, &fno);
@@ -372,25 +571,3 @@ int read_midi(const char *file_name, uint8_t *buffer, size_t max_size) {
     /* Read file */
     return read_file(full_path, buffer, max_size);
 }
-
-/**
- * @brief Write settings to a file
- * 
- * @param fsm State machine
- * @return int 0 on success, negative error code otherwise
- */
-int write_settings_txt(fsm_struct *fsm) 
-{
-    return 0;
-}
-
-/**
- * @brief Read settings from a file
- * 
- * @param fsm State machine
- * @return int 0 on success, negative error code otherwise
- */
-int read_settings_txt(fsm_struct *fsm) 
-{
-    return 0;
-}
@@ -13,6 +13,16 @@
 
 // Use this as a guideline for your TODOs
 
+//Songs the directory index holds, and the space for all their names
+#define MAX_SONG_FILES          256
+#define SONG_NAME_POOL_SIZE     8192
+//Longest full path of a song ("SD:/MIDI/<name>"), longer names are left out
+#define SONG_PATH_LEN           64
+//Saved listing of the MIDI directory, so boot doesn't have to walk it
+#define SONG_LIST_FILE          "SD:/MIDI/songs.bin"
+#define SONG_LIST_MAGIC         0x31474E53  // "SNG1"
+#define SONG_LIST_VERSION       3
+
 /**
  * @brief Check for devices
  * 
@@ -34,27 +44,48 @@ int SDcardInterfaceInit(void);
 /**
  * @brief Initialize the SD card
  * 
- * This function initializes the SD card file system and scans for MIDI files.
+ * This function mounts the SD card file system. The card must have been
+ * initialized (sd_manager does this when it finds one).
  * 
  * @return int 0 on success, negative error code otherwise
  */
 int SDcardInit(void);
 
+/**
+ * @brief Unmount the SD card
+ * 
+ * The song list is emptied first. Works whether or not the card is still there.
+ * 
+ * @return int 0 on success, negative error code otherwise
+ */
+int SDcardDeinit(void);
+
 /**
  * @brief Scan for MIDI files
  * 
- * This function scans the MIDI directory for .midi files.
+ * This function lists the .mid files of the MIDI directory, sorted so that
+ * numbered songs ("2_TRACK.mid") come in number order and the rest by name.
+ * The listing saved by the last walk is used instead of sorting the
+ * directory again when a CRC of all its entries (names, sizes, dates)
+ * is unchanged.
  * 
  * @return int Number of MIDI files found
  */
 int scan_midi_files(void);
 
+/**
+ * @brief Walk the MIDI directory even if the saved listing looks current
+ * 
+ * @return int Number of MIDI files found
+ */
+int rescan_midi_files(void);
+
 /**
  * @brief Get the number of MIDI tracks
  * 
- * @return uint8_t Number of tracks
+ * @return uint16_t Number of tracks
  */
-uint8_t get_track_count(void);
+uint16_t get_track_count(void);
 
 /**
  * @brief Get the file name for a track
@@ -64,7 +95,7 @@ uint8_t get_track_count(void);
  * @param len Length of the buffer
  * @return int 0 on success, negative error code otherwise
  */
-int get_track_file_name(uint8_t track_number, char *file_name, size_t len);
+int get_track_file_name(uint16_t track_number, char *file_name, size_t len);
 
 /**
  * @brief Read a file from the SD card
@@ -104,22 +135,4 @@ int get_file_size(const char *file_name);
  */
 int read_midi(const char *file_name, uint8_t *buffer, size_t max_size);
 
-// These are for reading and writing settings - we can flesh this out once we are clear on what the FSM will be
-
-/**
- * @brief Write settings to a file
- * 
- * @param fsm State machine
- * @return int 0 on success, negative error code otherwise
- */
-int write_setting_txt(fsm_struct *fsm);
-
-/**
- * @brief Read settings from a file
- * 
- * @param fsm State machine
- * @return int 0 on success, negative error code otherwise
- */
-int read_settings_txt(fsm_struct *fsm);
-
 #endif // SDCARD_INTERFACE_H
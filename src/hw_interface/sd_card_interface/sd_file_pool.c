@@ -0,0 +1,140 @@
+// sd_file_pool.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+
+#include "sd_file_pool.h"
+
+LOG_MODULE_REGISTER(sd_file_pool, LOG_LEVEL_INF);
+
+// Handles are used from several threads at once (player, recorder, read-ahead,
+// indexing), and they share the volume's window buffer and FAT. FatFs only
+// serializes that itself when built reentrant.
+#ifndef CONFIG_FS_FATFS_REENTRANT
+#error "sd_file_pool needs CONFIG_FS_FATFS_REENTRANT=y"
+#endif
+
+K_MEM_SLAB_DEFINE_STATIC(sd_file_slab, sizeof(FIL), SD_FILE_POOL_SIZE, 4);
+
+static K_MUTEX_DEFINE(sd_file_mutex);
+static FIL *sd_files[SD_FILE_POOL_SIZE];
+static sd_file_pool_stats_t sd_file_stats;
+
+static FIL *sd_file_get(int handle)
+{
+    if (handle < 0 || handle >= SD_FILE_POOL_SIZE) {
+        return NULL;
+    }
+    return sd_files[handle];
+}
+
+int sd_file_open(const char *path, uint8_t mode)
+{
+    FIL *fil;
+
+    if (k_mem_slab_alloc(&sd_file_slab, (void **)&fil, K_NO_WAIT) != 0) {
+        k_mutex_lock(&sd_file_mutex, K_FOREVER);
+        sd_file_stats.exhausted++;
+        k_mutex_unlock(&sd_file_mutex);
+        LOG_WRN("No free file handle for %s", path);
+        return -EMFILE;
+    }
+
+    FRESULT res = f_open(fil, path, mode);
+    if (res != FR_OK) {
+        k_mem_slab_free(&sd_file_slab, fil);
+        return (res == FR_NO_FILE || res == FR_NO_PATH) ? -ENOENT : -EIO;
+    }
+
+    // There is a slot for every slab block, so one is always free here
+    int handle = -EMFILE;
+    k_mutex_lock(&sd_file_mutex, K_FOREVER);
+    for (int i = 0; i < SD_FILE_POOL_SIZE; i++) {
+        if (sd_files[i] == NULL) {
+            sd_files[i] = fil;
+            handle = i;
+            break;
+        }
+    }
+    sd_file_stats.in_use++;
+    if (sd_file_stats.in_use > sd_file_stats.high_water) {
+        sd_file_stats.high_water = sd_file_stats.in_use;
+    }
+    k_mutex_unlock(&sd_file_mutex);
+
+    return handle;
+}
+
+int sd_file_read(int handle, void *buf, size_t len)
+{
+    FIL *fil = sd_file_get(handle);
+    UINT got;
+
+    if (fil == NULL) {
+        return -EBADF;
+    }
+    if (f_read(fil, buf, len, &got) != FR_OK) {
+        return -EIO;
+    }
+    return got;
+}
+
+int sd_file_write(int handle, const void *buf, size_t len)
+{
+    FIL *fil = sd_file_get(handle);
+    UINT put;
+
+    if (fil == NULL) {
+        return -EBADF;
+    }
+    if (f_write(fil, buf, len, &put) != FR_OK || put != len) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int sd_file_seek(int handle, uint32_t offset)
+{
+    FIL *fil = sd_file_get(handle);
+
+    if (fil == NULL) {
+        return -EBADF;
+    }
+    if (f_tell(fil) != offset && f_lseek(fil, offset) != FR_OK) {
+        return -EIO;
+    }
+    return 0;
+}
+
+int sd_file_size(int handle)
+{
+    FIL *fil = sd_file_get(handle);
+
+    return fil ? (int)f_size(fil) : -EBADF;
+}
+
+int sd_file_close(int handle)
+{
+    FIL *fil = sd_file_get(handle);
+
+    if (fil == NULL) {
+        return -EBADF;
+    }
+
+    FRESULT res = f_close(fil);
+
+    k_mutex_lock(&sd_file_mutex, K_FOREVER);
+    sd_files[handle] = NULL;
+    sd_file_stats.in_use--;
+    k_mutex_unlock(&sd_file_mutex);
+
+    k_mem_slab_free(&sd_file_slab, fil);
+    return res == FR_OK ? 0 : -EIO;
+}
+
+void sd_file_pool_get_stats(sd_file_pool_stats_t *stats)
+{
+    k_mutex_lock(&sd_file_mutex, K_FOREVER);
+    *stats = sd_file_stats;
+    k_mutex_unlock(&sd_file_mutex);
+}
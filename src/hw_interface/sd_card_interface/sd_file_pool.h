@@ -0,0 +1,72 @@
+#ifndef SD_FILE_POOL_H
+#define SD_FILE_POOL_H
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <ff.h>
+
+/*
+ * Open files on the SD card, handed out as small integer handles. Each open
+ * file has its own FIL, with FatFs's sector buffer inside it, taken from a
+ * memory slab, so any number of threads can each stream their own file up
+ * to SD_FILE_POOL_SIZE at a time. A handle belongs to whoever opened it and
+ * must only be used by one thread at a time. Calls on different handles may
+ * overlap; FatFs (CONFIG_FS_FATFS_REENTRANT) locks the volume for each one.
+ */
+
+// Files open at once: a song and its index playing, the next song's
+// cache being built (source plus two outputs), and one more
+#define SD_FILE_POOL_SIZE   6
+
+typedef struct {
+    uint8_t in_use;
+    uint8_t high_water;
+    uint32_t exhausted;     // opens turned away because every handle was taken
+} sd_file_pool_stats_t;
+
+/**
+ * @brief Open @p path with FatFs @p mode flags (FA_READ, FA_WRITE | FA_CREATE_ALWAYS, ...)
+ *
+ * @return int Handle on success, -EMFILE if the pool is used up, -ENOENT if
+ *         the file doesn't exist, -EIO otherwise
+ */
+int sd_file_open(const char *path, uint8_t mode);
+
+/**
+ * @brief Read up to @p len bytes at the file pointer
+ *
+ * @return int Bytes read (short only at end of file), negative error code otherwise
+ */
+int sd_file_read(int handle, void *buf, size_t len);
+
+/**
+ * @brief Write @p len bytes at the file pointer
+ *
+ * @return int 0 if all of it was written, negative error code otherwise
+ */
+int sd_file_write(int handle, const void *buf, size_t len);
+
+/**
+ * @brief Move the file pointer; a no-op if it is already there
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_file_seek(int handle, uint32_t offset);
+
+/**
+ * @brief Size of an open file
+ *
+ * @return int Size in bytes, negative error code otherwise
+ */
+int sd_file_size(int handle);
+
+/**
+ * @brief Close a file and give its handle back
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_file_close(int handle);
+
+void sd_file_pool_get_stats(sd_file_pool_stats_t *stats);
+
+#endif // SD_FILE_POOL_H
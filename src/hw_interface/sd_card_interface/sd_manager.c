@@ -0,0 +1,324 @@
+// sd_manager.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/sys/crc.h>
+#include <errno.h>
+
+#include "sd_manager.h"
+#include "sd_card_interface.h"
+#include "sd_sector_cache.h"
+
+LOG_MODULE_REGISTER(sd_manager, LOG_LEVEL_INF);
+
+K_THREAD_STACK_DEFINE(sd_manager_stack, SD_MANAGER_STACK_SIZE);
+static struct k_work_q sd_manager_workq;
+
+static void sd_manager_work_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(sd_manager_work, sd_manager_work_fn);
+
+typedef struct {
+    sd_manager_listener_t fn;
+    void *user;
+} sd_listener_t;
+
+// Filled in before the work queue starts, read-only afterwards
+static sd_listener_t sd_listeners[SD_MANAGER_MAX_LISTENERS];
+static uint8_t sd_listener_count;
+
+static atomic_t sd_state;
+// Set by sd_manager_rescan(), taken by the work queue
+static atomic_t sd_rescan_requested;
+
+// Written on the work queue, read by the shell
+static K_MUTEX_DEFINE(sd_stats_mutex);
+static sd_manager_stats_t sd_stats;
+
+// Work queue only: sector cache counters at the last check
+static uint32_t sd_last_activity;
+static uint32_t sd_last_errors;
+static uint8_t sd_sector_buf[SD_SECTOR_SIZE];
+
+#if DT_NODE_HAS_STATUS(DT_ALIAS(sdcardcd), okay)
+#define SD_MANAGER_HAS_CARD_DETECT 1
+static const struct gpio_dt_spec sd_card_detect = GPIO_DT_SPEC_GET(DT_ALIAS(sdcardcd), gpios);
+static struct gpio_callback sd_card_detect_cb;
+
+static void sd_card_detect_handler(const struct device *port, struct gpio_callback *cb,
+                                   uint32_t pins)
+{
+    k_work_reschedule_for_queue(&sd_manager_workq, &sd_manager_work,
+                                K_MSEC(SD_MANAGER_DEBOUNCE_MS));
+}
+#endif
+
+static void sd_publish(sd_card_event_t event)
+{
+    for (uint8_t i = 0; i < sd_listener_count; i++) {
+        sd_listeners[i].fn(event, sd_listeners[i].user);
+    }
+}
+
+static void sd_set_state(sd_card_state_t state, uint32_t card_id)
+{
+    atomic_set(&sd_state, state);
+
+    k_mutex_lock(&sd_stats_mutex, K_FOREVER);
+    sd_stats.state = state;
+    sd_stats.card_id = card_id;
+    k_mutex_unlock(&sd_stats_mutex);
+}
+
+static bool sd_card_inserted(void)
+{
+#ifdef SD_MANAGER_HAS_CARD_DETECT
+    return gpio_pin_get_dt(&sd_card_detect) > 0;
+#else
+    // No switch: assume a card and let the probe find out
+    return true;
+#endif
+}
+
+// Read sector 0 straight from the card, around the cache; its CRC tells cards apart
+static int sd_read_card_id(uint32_t *card_id)
+{
+    if (disk_access_read(SD_SECTOR_CACHE_RAW_DISK, sd_sector_buf, 0, 1) != 0) {
+        return -EIO;
+    }
+
+    *card_id = crc32_ieee(sd_sector_buf, sizeof(sd_sector_buf));
+    return 0;
+}
+
+static void sd_io_counters(uint32_t *activity, uint32_t *errors)
+{
+    sd_sector_cache_stats_t stats;
+
+    sd_sector_cache_get_stats(&stats);
+    *activity = stats.misses + stats.bypass + stats.writes;
+    *errors = stats.errors;
+}
+
+static void sd_try_mount(void)
+{
+    uint32_t card_id;
+
+    if (!sd_card_inserted()) {
+        return;
+    }
+
+    // Brings up a newly inserted card, and is a no-op for one already up
+    if (disk_access_init(SD_SECTOR_CACHE_RAW_DISK) != 0 || sd_read_card_id(&card_id) != 0) {
+        // Start the card over from scratch at the next probe
+        disk_access_ioctl(SD_SECTOR_CACHE_RAW_DISK, DISK_IOCTL_CTRL_DEINIT, NULL);
+        return;
+    }
+
+    int64_t start = k_uptime_get();
+    sd_set_state(SD_CARD_STATE_MOUNTING, card_id);
+    // A fresh mount walks the directory anyway
+    atomic_set(&sd_rescan_requested, 0);
+    // Nothing cached may come from another card
+    sd_sector_cache_invalidate();
+
+    if (SDcardInit() != 0) {
+        LOG_WRN("Card %08x has no usable file system", card_id);
+        sd_set_state(SD_CARD_STATE_UNUSABLE, card_id);
+        sd_publish(SD_CARD_EVENT_MOUNT_FAILED);
+        return;
+    }
+
+    scan_midi_files();
+    sd_io_counters(&sd_last_activity, &sd_last_errors);
+    sd_set_state(SD_CARD_STATE_READY, card_id);
+
+    k_mutex_lock(&sd_stats_mutex, K_FOREVER);
+    sd_stats.mounts++;
+    sd_stats.mount_ms = k_uptime_get() - start;
+    k_mutex_unlock(&sd_stats_mutex);
+
+    LOG_INF("Card %08x ready, %u songs", card_id, get_track_count());
+    sd_publish(SD_CARD_EVENT_MOUNTED);
+}
+
+static void sd_remove(bool mounted)
+{
+    if (mounted) {
+        sd_publish(SD_CARD_EVENT_REMOVING);
+        SDcardDeinit();
+    }
+
+    sd_sector_cache_invalidate();
+    disk_access_ioctl(SD_SECTOR_CACHE_RAW_DISK, DISK_IOCTL_CTRL_DEINIT, NULL);
+    sd_set_state(SD_CARD_STATE_NO_CARD, 0);
+
+    k_mutex_lock(&sd_stats_mutex, K_FOREVER);
+    sd_stats.removals++;
+    k_mutex_unlock(&sd_stats_mutex);
+
+    LOG_INF("Card removed");
+    sd_publish(SD_CARD_EVENT_REMOVED);
+}
+
+// Whether the card in the slot is still the one that was mounted
+static bool sd_same_card(void)
+{
+    uint32_t activity;
+    uint32_t errors;
+    uint32_t card_id;
+
+    if (!sd_card_inserted()) {
+        return false;
+    }
+
+    // Reads and writes that went through since the last check prove the card
+    // is there; only go to the card when it has been idle or failing
+    sd_io_counters(&activity, &errors);
+    bool proven = activity != sd_last_activity && errors == sd_last_errors;
+    sd_last_activity = activity;
+    sd_last_errors = errors;
+    if (proven) {
+        return true;
+    }
+
+    k_mutex_lock(&sd_stats_mutex, K_FOREVER);
+    sd_stats.probes++;
+    uint32_t mounted_id = sd_stats.card_id;
+    k_mutex_unlock(&sd_stats_mutex);
+
+    return sd_read_card_id(&card_id) == 0 && card_id == mounted_id;
+}
+
+static void sd_manager_work_fn(struct k_work *work)
+{
+    switch (atomic_get(&sd_state)) {
+        case SD_CARD_STATE_NO_CARD:
+            sd_try_mount();
+            break;
+
+        case SD_CARD_STATE_READY:
+        case SD_CARD_STATE_UNUSABLE:
+            if (!sd_same_card()) {
+                sd_remove(atomic_get(&sd_state) == SD_CARD_STATE_READY);
+                // A swapped card is mounted straight away
+                sd_try_mount();
+            } else if (atomic_get(&sd_state) == SD_CARD_STATE_READY &&
+                       atomic_cas(&sd_rescan_requested, 1, 0)) {
+                LOG_INF("Rescanned, %d songs", rescan_midi_files());
+                sd_publish(SD_CARD_EVENT_SONGS_CHANGED);
+            }
+            break;
+
+        default:
+            break;
+    }
+
+    k_work_reschedule_for_queue(&sd_manager_workq, &sd_manager_work,
+                                K_MSEC(SD_MANAGER_PROBE_MS));
+}
+
+int sd_manager_add_listener(sd_manager_listener_t listener, void *user)
+{
+    if (sd_listener_count == SD_MANAGER_MAX_LISTENERS) {
+        return -ENOMEM;
+    }
+
+    sd_listeners[sd_listener_count].fn = listener;
+    sd_listeners[sd_listener_count].user = user;
+    sd_listener_count++;
+    return 0;
+}
+
+int sd_manager_init(void)
+{
+    struct k_work_queue_config cfg = {
+        .name = "sd_manager",
+    };
+
+    atomic_set(&sd_state, SD_CARD_STATE_NO_CARD);
+
+    k_work_queue_init(&sd_manager_workq);
+    k_work_queue_start(&sd_manager_workq, sd_manager_stack,
+                       K_THREAD_STACK_SIZEOF(sd_manager_stack), SD_MANAGER_PRIORITY, &cfg);
+
+#ifdef SD_MANAGER_HAS_CARD_DETECT
+    if (!gpio_is_ready_dt(&sd_card_detect)) {
+        LOG_ERR("Card detect GPIO not ready");
+        return -ENODEV;
+    }
+    int ret = gpio_pin_configure_dt(&sd_card_detect, GPIO_INPUT);
+    if (ret == 0) {
+        ret = gpio_pin_interrupt_configure_dt(&sd_card_detect, GPIO_INT_EDGE_BOTH);
+    }
+    if (ret != 0) {
+        LOG_ERR("Failed to set up card detect: %d", ret);
+        return ret;
+    }
+    gpio_init_callback(&sd_card_detect_cb, sd_card_detect_handler, BIT(sd_card_detect.pin));
+    gpio_add_callback(sd_card_detect.port, &sd_card_detect_cb);
+#endif
+
+    // The first probe runs on the work queue, boot carries on meanwhile
+    k_work_schedule_for_queue(&sd_manager_workq, &sd_manager_work, K_NO_WAIT);
+
+    LOG_INF("SD manager started (%s)",
+            IS_ENABLED(SD_MANAGER_HAS_CARD_DETECT) ? "card detect" : "polling");
+    return 0;
+}
+
+sd_card_state_t sd_manager_get_state(void)
+{
+    return atomic_get(&sd_state);
+}
+
+void sd_manager_check(void)
+{
+    k_work_reschedule_for_queue(&sd_manager_workq, &sd_manager_work, K_NO_WAIT);
+}
+
+void sd_manager_rescan(void)
+{
+    atomic_set(&sd_rescan_requested, 1);
+    k_work_reschedule_for_queue(&sd_manager_workq, &sd_manager_work, K_NO_WAIT);
+}
+
+void sd_manager_get_stats(sd_manager_stats_t *stats)
+{
+    k_mutex_lock(&sd_stats_mutex, K_FOREVER);
+    *stats = sd_stats;
+    k_mutex_unlock(&sd_stats_mutex);
+}
+
+#ifdef CONFIG_SHELL
+
+static const char *const sd_state_names[] = { "no card", "mounting", "ready", "unusable" };
+
+static int cmd_sdcard_status(const struct shell *sh, size_t argc, char **argv)
+{
+    sd_manager_stats_t stats;
+
+    sd_manager_get_stats(&stats);
+    shell_print(sh, "%s, card %08x, %u songs", sd_state_names[stats.state], stats.card_id,
+                get_track_count());
+    shell_print(sh, "%u mounts (last took %u ms), %u removals, %u probe reads",
+                stats.mounts, stats.mount_ms, stats.removals, stats.probes);
+    return 0;
+}
+
+static int cmd_sdcard_check(const struct shell *sh, size_t argc, char **argv)
+{
+    sd_manager_check();
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_sdcard,
+    SHELL_CMD(status, NULL, "Card state and mount counters", cmd_sdcard_status),
+    SHELL_CMD(check, NULL, "Look for a card change now", cmd_sdcard_check),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sdcard, &sub_sdcard, "SD card hot-plug", NULL);
+
+#endif // CONFIG_SHELL
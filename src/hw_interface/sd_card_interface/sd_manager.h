@@ -0,0 +1,91 @@
+#ifndef SD_MANAGER_H
+#define SD_MANAGER_H
+
+#include <zephyr/types.h>
+
+/*
+ * Finds, mounts and unmounts the SD card in the background, so boot never
+ * waits on it and a card can be pulled or swapped while running.
+ *
+ * Everything runs as one work item on the manager's own work queue. With no
+ * card it retries the card's init every SD_MANAGER_PROBE_MS. Once a card is
+ * mounted it checks that it is still the same card: reads the card has
+ * served since the last check count as proof, otherwise sector 0 is read and
+ * compared with what it held at mount time. If the board has a card-detect
+ * switch (devicetree alias "sdcardcd") its edges trigger a check right away.
+ *
+ * Listeners are told about each change on the work queue, so they may use
+ * the card, and take their time, from the callback (index rebuilds etc.).
+ */
+
+#define SD_MANAGER_PROBE_MS         1000
+// Let a card-detect switch settle before acting on it
+#define SD_MANAGER_DEBOUNCE_MS      200
+// Rebuilding the song indexes runs in the listeners, on this stack
+#define SD_MANAGER_STACK_SIZE       3072
+// Below the player and the SD read-ahead
+#define SD_MANAGER_PRIORITY         9
+#define SD_MANAGER_MAX_LISTENERS    4
+
+typedef enum {
+    SD_CARD_STATE_NO_CARD,
+    SD_CARD_STATE_MOUNTING,
+    SD_CARD_STATE_READY,        // mounted and the song list scanned
+    SD_CARD_STATE_UNUSABLE,     // a card is in but it wouldn't mount
+} sd_card_state_t;
+
+typedef enum {
+    SD_CARD_EVENT_MOUNTED,      // song list scanned, the card can be used
+    SD_CARD_EVENT_MOUNT_FAILED, // a card is in but it has no usable file system
+    SD_CARD_EVENT_REMOVING,     // the card is gone or swapped; let go of its files
+    SD_CARD_EVENT_REMOVED,      // unmounted, the song list is empty
+    // the MIDI directory was walked again after something changed it
+    SD_CARD_EVENT_SONGS_CHANGED,
+} sd_card_event_t;
+
+typedef void (*sd_manager_listener_t)(sd_card_event_t event, void *user);
+
+typedef struct {
+    uint8_t state;              // sd_card_state_t
+    uint32_t card_id;           // CRC of sector 0 of the card in use, 0 if none
+    uint32_t mounts;
+    uint32_t removals;
+    uint32_t probes;            // times the card had to be read to be checked
+    uint32_t mount_ms;          // time from finding a card to READY, last mount
+} sd_manager_stats_t;
+
+/**
+ * @brief Start the manager; returns without waiting for a card
+ *
+ * Call after SDcardInterfaceInit() and after registering the listeners
+ * that need to see the first mount.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_manager_init(void);
+
+/**
+ * @brief Be told about card changes; call before sd_manager_init()
+ *
+ * @return int 0 on success, -ENOMEM if SD_MANAGER_MAX_LISTENERS are registered
+ */
+int sd_manager_add_listener(sd_manager_listener_t listener, void *user);
+
+sd_card_state_t sd_manager_get_state(void);
+
+/**
+ * @brief Check the card now instead of at the next probe
+ */
+void sd_manager_check(void);
+
+/**
+ * @brief Walk the MIDI directory again, for whoever just changed it
+ *
+ * Runs on the work queue; listeners then get SD_CARD_EVENT_SONGS_CHANGED.
+ * Does nothing if no card is mounted by then.
+ */
+void sd_manager_rescan(void);
+
+void sd_manager_get_stats(sd_manager_stats_t *stats);
+
+#endif // SD_MANAGER_H
@@ -0,0 +1,315 @@
+// sd_readahead.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <ff.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "sd_readahead.h"
+#include "sd_file_pool.h"
+
+LOG_MODULE_REGISTER(sd_readahead, LOG_LEVEL_INF);
+
+typedef struct {
+    int handle;             // in the file pool
+    bool open;
+    struct k_sem closed;    // given when the close request comes out of the queue
+} sd_ra_file_t;
+
+typedef struct {
+    uint8_t handle;
+    bool close;             // no read, just the end of this file's requests
+    uint32_t offset;
+    uint32_t len;
+    uint8_t *buf;
+    sd_readahead_cb_t cb;
+    void *user;
+} sd_ra_request_t;
+
+K_THREAD_STACK_DEFINE(sd_readahead_stack, SD_READAHEAD_STACK_SIZE);
+static struct k_thread sd_readahead_thread_data;
+
+K_MSGQ_DEFINE(sd_ra_queue, sizeof(sd_ra_request_t), SD_READAHEAD_QUEUE_DEPTH, 4);
+static K_MUTEX_DEFINE(sd_ra_mutex);
+static sd_ra_file_t sd_ra_files[SD_READAHEAD_MAX_FILES];
+
+static struct k_spinlock sd_ra_stats_lock;
+static sd_readahead_stats_t sd_ra_stats;
+
+static int sd_ra_do_read(sd_ra_file_t *file, const sd_ra_request_t *req)
+{
+    int ret = sd_file_seek(file->handle, req->offset);
+    if (ret) {
+        return ret;
+    }
+    // One f_read for the whole range: the aligned middle goes to the card
+    // as multi-block reads, only partial sectors at the ends are copied
+    return sd_file_read(file->handle, req->buf, req->len);
+}
+
+static void sd_readahead_thread(void *p1, void *p2, void *p3)
+{
+    sd_ra_request_t req;
+
+    while (1) {
+        k_msgq_get(&sd_ra_queue, &req, K_FOREVER);
+        sd_ra_file_t *file = &sd_ra_files[req.handle];
+
+        if (req.close) {
+            sd_file_close(file->handle);
+            k_sem_give(&file->closed);
+            continue;
+        }
+
+        int64_t start = k_uptime_get();
+        int ret = sd_ra_do_read(file, &req);
+        uint32_t took = k_uptime_get() - start;
+
+        k_spinlock_key_t key = k_spin_lock(&sd_ra_stats_lock);
+        sd_ra_stats.requests++;
+        sd_ra_stats.busy_ms += took;
+        if (ret > 0) {
+            sd_ra_stats.bytes += ret;
+        }
+        k_spin_unlock(&sd_ra_stats_lock, key);
+
+        req.cb(req.user, req.offset, req.buf, ret);
+    }
+}
+
+int sd_readahead_init(void)
+{
+    for (int i = 0; i < SD_READAHEAD_MAX_FILES; i++) {
+        k_sem_init(&sd_ra_files[i].closed, 0, 1);
+    }
+
+    k_tid_t tid = k_thread_create(&sd_readahead_thread_data, sd_readahead_stack,
+                                  K_THREAD_STACK_SIZEOF(sd_readahead_stack),
+                                  sd_readahead_thread, NULL, NULL, NULL,
+                                  SD_READAHEAD_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start SD read-ahead thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "sd_readahead");
+    return 0;
+}
+
+int sd_readahead_open(const char *path)
+{
+    int handle = -EMFILE;
+
+    k_mutex_lock(&sd_ra_mutex, K_FOREVER);
+    for (int i = 0; i < SD_READAHEAD_MAX_FILES; i++) {
+        if (!sd_ra_files[i].open) {
+            handle = i;
+            break;
+        }
+    }
+    if (handle >= 0) {
+        int ret = sd_file_open(path, FA_READ);
+        if (ret >= 0) {
+            sd_ra_files[handle].handle = ret;
+            sd_ra_files[handle].open = true;
+        } else {
+            handle = ret;
+        }
+    }
+    k_mutex_unlock(&sd_ra_mutex);
+
+    return handle;
+}
+
+static int sd_ra_queue_put(const sd_ra_request_t *req, k_timeout_t timeout)
+{
+    int ret = k_msgq_put(&sd_ra_queue, req, timeout);
+
+    k_spinlock_key_t key = k_spin_lock(&sd_ra_stats_lock);
+    if (ret) {
+        sd_ra_stats.queue_full++;
+    } else {
+        uint8_t queued = k_msgq_num_used_get(&sd_ra_queue);
+        if (queued > sd_ra_stats.max_queued) {
+            sd_ra_stats.max_queued = queued;
+        }
+    }
+    k_spin_unlock(&sd_ra_stats_lock, key);
+
+    return ret ? -EAGAIN : 0;
+}
+
+int sd_readahead_request(int handle, uint32_t offset, uint8_t *buf, uint32_t len,
+                         sd_readahead_cb_t cb, void *user)
+{
+    if (handle < 0 || handle >= SD_READAHEAD_MAX_FILES || !sd_ra_files[handle].open || cb == NULL) {
+        return -EBADF;
+    }
+
+    sd_ra_request_t req = {
+        .handle = handle,
+        .offset = offset,
+        .len = len,
+        .buf = buf,
+        .cb = cb,
+        .user = user,
+    };
+    return sd_ra_queue_put(&req, K_NO_WAIT);
+}
+
+typedef struct {
+    struct k_sem done;
+    int result;
+} sd_ra_waiter_t;
+
+static void sd_ra_wake(void *user, uint32_t offset, uint8_t *buf, int result)
+{
+    sd_ra_waiter_t *w = user;
+
+    w->result = result;
+    k_sem_give(&w->done);
+}
+
+int sd_readahead_read(int handle, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    sd_ra_waiter_t w = { .result = 0 };
+
+    if (handle < 0 || handle >= SD_READAHEAD_MAX_FILES || !sd_ra_files[handle].open) {
+        return -EBADF;
+    }
+
+    k_sem_init(&w.done, 0, 1);
+    sd_ra_request_t req = {
+        .handle = handle,
+        .offset = offset,
+        .len = len,
+        .buf = buf,
+        .cb = sd_ra_wake,
+        .user = &w,
+    };
+
+    int ret = sd_ra_queue_put(&req, K_FOREVER);
+    if (ret) {
+        return ret;
+    }
+    k_sem_take(&w.done, K_FOREVER);
+    return w.result;
+}
+
+int sd_readahead_close(int handle)
+{
+    if (handle < 0 || handle >= SD_READAHEAD_MAX_FILES || !sd_ra_files[handle].open) {
+        return -EBADF;
+    }
+
+    // Behind everything already queued on it
+    sd_ra_request_t req = { .handle = handle, .close = true };
+    k_sem_reset(&sd_ra_files[handle].closed);
+    sd_ra_queue_put(&req, K_FOREVER);
+    k_sem_take(&sd_ra_files[handle].closed, K_FOREVER);
+
+    k_mutex_lock(&sd_ra_mutex, K_FOREVER);
+    sd_ra_files[handle].open = false;
+    k_mutex_unlock(&sd_ra_mutex);
+    return 0;
+}
+
+void sd_readahead_get_stats(sd_readahead_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&sd_ra_stats_lock);
+    *stats = sd_ra_stats;
+    k_spin_unlock(&sd_ra_stats_lock, key);
+}
+
+#ifdef CONFIG_SHELL
+
+#define SD_RA_BENCH_CHUNK   2048
+#define SD_RA_BENCH_CHUNKS  4
+
+static uint8_t sd_ra_bench_buf[SD_RA_BENCH_CHUNKS][SD_RA_BENCH_CHUNK] __aligned(4);
+static K_SEM_DEFINE(sd_ra_bench_sem, 0, SD_RA_BENCH_CHUNKS);
+static int sd_ra_bench_error;
+static uint32_t sd_ra_bench_bytes;
+
+static void sd_ra_bench_done(void *user, uint32_t offset, uint8_t *buf, int result)
+{
+    if (result < 0) {
+        sd_ra_bench_error = result;
+    } else {
+        sd_ra_bench_bytes += result;
+    }
+    k_sem_give(&sd_ra_bench_sem);
+}
+
+// Read a whole file with SD_RA_BENCH_CHUNKS requests in flight
+static int cmd_sdread_bench(const struct shell *sh, size_t argc, char **argv)
+{
+    int handle = sd_readahead_open(argv[1]);
+    if (handle < 0) {
+        shell_error(sh, "Can't open %s: %d", argv[1], handle);
+        return handle;
+    }
+
+    uint32_t size = sd_file_size(sd_ra_files[handle].handle);
+    uint32_t offset = 0;
+    int inflight = 0;
+
+    sd_ra_bench_error = 0;
+    sd_ra_bench_bytes = 0;
+    k_sem_reset(&sd_ra_bench_sem);
+    int64_t start = k_uptime_get();
+
+    while ((offset < size || inflight > 0) && sd_ra_bench_error == 0) {
+        if (offset < size && inflight < SD_RA_BENCH_CHUNKS) {
+            uint8_t *buf = sd_ra_bench_buf[(offset / SD_RA_BENCH_CHUNK) % SD_RA_BENCH_CHUNKS];
+            if (sd_readahead_request(handle, offset, buf, SD_RA_BENCH_CHUNK,
+                                     sd_ra_bench_done, NULL) == 0) {
+                offset += SD_RA_BENCH_CHUNK;
+                inflight++;
+                continue;
+            }
+        }
+        k_sem_take(&sd_ra_bench_sem, K_FOREVER);
+        inflight--;
+    }
+    while (inflight-- > 0) {
+        k_sem_take(&sd_ra_bench_sem, K_FOREVER);
+    }
+
+    uint32_t ms = MAX(k_uptime_get() - start, 1);
+    sd_readahead_close(handle);
+
+    if (sd_ra_bench_error) {
+        shell_error(sh, "Read failed: %d", sd_ra_bench_error);
+        return sd_ra_bench_error;
+    }
+    shell_print(sh, "%u bytes in %u ms, %u KiB/s", sd_ra_bench_bytes, ms,
+                sd_ra_bench_bytes * 1000 / 1024 / ms);
+    return 0;
+}
+
+static int cmd_sdread_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    sd_readahead_stats_t stats;
+    sd_readahead_get_stats(&stats);
+
+    shell_print(sh, "%u requests, %u bytes, %u ms reading, %u turned away, max %u queued",
+                stats.requests, stats.bytes, stats.busy_ms, stats.queue_full, stats.max_queued);
+
+    sd_file_pool_stats_t pool;
+    sd_file_pool_get_stats(&pool);
+    shell_print(sh, "files: %u/%d open, most %u, %u opens turned away", pool.in_use,
+                SD_FILE_POOL_SIZE, pool.high_water, pool.exhausted);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_sdread,
+    SHELL_CMD_ARG(bench, NULL, "Read <path> through the service and time it", cmd_sdread_bench, 2, 0),
+    SHELL_CMD(stats, NULL, "Request counters", cmd_sdread_stats),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sdread, &sub_sdread, "SD read-ahead service", NULL);
+
+#endif // CONFIG_SHELL
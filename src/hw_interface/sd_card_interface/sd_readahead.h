@@ -0,0 +1,79 @@
+#ifndef SD_READAHEAD_H
+#define SD_READAHEAD_H
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+/*
+ * Read-ahead service: callers queue byte ranges of a file and get a
+ * callback when each has been read, so storage runs on its own thread while
+ * the caller keeps the MIDI timing. Each request is one f_read, so whatever
+ * whole sectors it covers go from FatFs straight to the card as one
+ * multi-block read per contiguous cluster run; only a partial first or last
+ * sector passes through FatFs's sector window.
+ */
+
+#define SD_READAHEAD_MAX_FILES      2
+// Requests queued across all files
+#define SD_READAHEAD_QUEUE_DEPTH    8
+#define SD_READAHEAD_STACK_SIZE     1536
+// Below the player and prefetch threads
+#define SD_READAHEAD_PRIORITY       8
+
+/**
+ * @brief Called on the read-ahead thread when a request is done
+ *
+ * @param result Bytes read (short only at end of file), negative error code otherwise
+ */
+typedef void (*sd_readahead_cb_t)(void *user, uint32_t offset, uint8_t *buf, int result);
+
+typedef struct {
+    uint32_t requests;
+    uint32_t bytes;
+    uint32_t busy_ms;       // time spent reading
+    uint32_t queue_full;    // requests turned away
+    uint8_t max_queued;
+} sd_readahead_stats_t;
+
+/**
+ * @brief Start the read-ahead thread
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_readahead_init(void);
+
+/**
+ * @brief Open @p path for read-ahead
+ *
+ * @return int Handle on success, -EMFILE if SD_READAHEAD_MAX_FILES are open,
+ *         negative error code otherwise
+ */
+int sd_readahead_open(const char *path);
+
+/**
+ * @brief Queue a read of @p len bytes at @p offset into @p buf
+ *
+ * Several requests may be outstanding on one file; they complete in order.
+ *
+ * @return int 0 if queued, -EAGAIN if the queue is full, -EBADF for a bad handle
+ */
+int sd_readahead_request(int handle, uint32_t offset, uint8_t *buf, uint32_t len,
+                         sd_readahead_cb_t cb, void *user);
+
+/**
+ * @brief Read synchronously through the service, waiting for the result
+ *
+ * @return int Bytes read, negative error code otherwise
+ */
+int sd_readahead_read(int handle, uint32_t offset, uint8_t *buf, uint32_t len);
+
+/**
+ * @brief Close a handle once every request queued on it has completed
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_readahead_close(int handle);
+
+void sd_readahead_get_stats(sd_readahead_stats_t *stats);
+
+#endif // SD_READAHEAD_H
@@ -0,0 +1,353 @@
+// sd_sector_cache.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/storage/disk_access.h>
+#include <zephyr/drivers/disk.h>
+#include <errno.h>
+#include <string.h>
+
+#include "sd_sector_cache.h"
+
+LOG_MODULE_REGISTER(sd_sector_cache, LOG_LEVEL_INF);
+
+typedef struct {
+    uint32_t sector;
+    uint32_t last_use;      // cache_clock at the last hit, for LRU
+    bool valid;
+    bool pinned;            // FAT or directory sector
+} sd_cache_entry_t;
+
+// FatFs may be entered from several threads
+static K_MUTEX_DEFINE(sd_cache_mutex);
+static sd_cache_entry_t sd_cache_entries[SD_SECTOR_CACHE_SECTORS];
+static uint8_t sd_cache_data[SD_SECTOR_CACHE_SECTORS][SD_SECTOR_SIZE] __aligned(4);
+static uint32_t sd_cache_clock;
+static sd_sector_cache_stats_t sd_cache_stats;
+
+static uint16_t sd_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t sd_le32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool sd_cache_is_meta(uint32_t sector)
+{
+    return (sector >= sd_cache_stats.meta_start && sector < sd_cache_stats.meta_end) ||
+           (sector >= sd_cache_stats.dir_start && sector < sd_cache_stats.dir_end);
+}
+
+// Find where the FATs and the FAT12/16 root directory are, from the MBR and boot sector
+static void sd_cache_find_meta(void)
+{
+    uint8_t *sec = sd_cache_data[0];
+    uint32_t part = 0;
+
+    sd_cache_stats.meta_start = 0;
+    sd_cache_stats.meta_end = 0;
+    sd_cache_stats.volume_serial = 0;
+
+    if (disk_access_read(SD_SECTOR_CACHE_RAW_DISK, sec, 0, 1) != 0 ||
+        sd_le16(&sec[510]) != 0xAA55) {
+        return;
+    }
+
+    // A boot sector starts with a jump; otherwise it's an MBR, take the first partition
+    if (!((sec[0] == 0xEB || sec[0] == 0xE9) && sd_le16(&sec[11]) == SD_SECTOR_SIZE)) {
+        part = sd_le32(&sec[0x1BE + 8]);
+        if (disk_access_read(SD_SECTOR_CACHE_RAW_DISK, sec, part, 1) != 0 ||
+            sd_le16(&sec[11]) != SD_SECTOR_SIZE) {
+            return;
+        }
+    }
+
+    uint32_t reserved = sd_le16(&sec[14]);
+    uint32_t nfats = sec[16];
+    uint32_t root_entries = sd_le16(&sec[17]);
+    uint32_t fat_size = sd_le16(&sec[22]);
+    // The extended boot record, and the serial in it, sits further on for FAT32
+    uint32_t serial_at = 39;
+    if (fat_size == 0) {
+        fat_size = sd_le32(&sec[36]);
+        serial_at = 67;
+    }
+    sd_cache_stats.volume_serial = sd_le32(&sec[serial_at]);
+
+    sd_cache_stats.meta_start = part + reserved;
+    sd_cache_stats.meta_end = sd_cache_stats.meta_start + nfats * fat_size +
+                              (root_entries * 32 + SD_SECTOR_SIZE - 1) / SD_SECTOR_SIZE;
+}
+
+static int sd_cache_lookup(uint32_t sector)
+{
+    for (int i = 0; i < SD_SECTOR_CACHE_SECTORS; i++) {
+        if (sd_cache_entries[i].valid && sd_cache_entries[i].sector == sector) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Slot for a new sector: a free one, else the least recently used file data
+// sector. A FAT/directory sector only gives way to another one, once
+// SD_SECTOR_CACHE_PINNED_MAX of them are cached.
+static int sd_cache_victim(bool pinned)
+{
+    bool quota_used = pinned && sd_cache_stats.pinned >= SD_SECTOR_CACHE_PINNED_MAX;
+    int victim = -1;
+    int any = 0;
+
+    for (int i = 0; i < SD_SECTOR_CACHE_SECTORS; i++) {
+        sd_cache_entry_t *e = &sd_cache_entries[i];
+
+        if (!e->valid) {
+            return i;
+        }
+        if (e->last_use < sd_cache_entries[any].last_use) {
+            any = i;
+        }
+        if (e->pinned == quota_used &&
+            (victim < 0 || e->last_use < sd_cache_entries[victim].last_use)) {
+            victim = i;
+        }
+    }
+
+    return victim >= 0 ? victim : any;
+}
+
+static void sd_cache_drop(int slot)
+{
+    sd_cache_entry_t *e = &sd_cache_entries[slot];
+
+    if (e->valid && e->pinned) {
+        sd_cache_stats.pinned--;
+    }
+    e->valid = false;
+    e->pinned = false;
+}
+
+static void sd_cache_fill(int slot, uint32_t sector)
+{
+    sd_cache_entry_t *e = &sd_cache_entries[slot];
+
+    e->sector = sector;
+    e->valid = true;
+    e->pinned = sd_cache_is_meta(sector);
+    e->last_use = ++sd_cache_clock;
+    if (e->pinned) {
+        sd_cache_stats.pinned++;
+    }
+}
+
+static int sd_cache_disk_init(struct disk_info *disk)
+{
+    int ret = disk_access_init(SD_SECTOR_CACHE_RAW_DISK);
+    if (ret) {
+        return ret;
+    }
+
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+    memset(sd_cache_entries, 0, sizeof(sd_cache_entries));
+    sd_cache_stats.pinned = 0;
+    sd_cache_find_meta();
+    k_mutex_unlock(&sd_cache_mutex);
+
+    LOG_INF("Sector cache: %d sectors, FAT/directory at %u-%u", SD_SECTOR_CACHE_SECTORS,
+            sd_cache_stats.meta_start, sd_cache_stats.meta_end);
+    return 0;
+}
+
+static int sd_cache_disk_status(struct disk_info *disk)
+{
+    return disk_access_status(SD_SECTOR_CACHE_RAW_DISK);
+}
+
+static int sd_cache_disk_read(struct disk_info *disk, uint8_t *buf, uint32_t start, uint32_t count)
+{
+    int ret = 0;
+
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+
+    // Runs of file data go straight to the card; cached copies are never
+    // newer than the card (writes go through), so skipping them is safe
+    if (count > 1 && !sd_cache_is_meta(start)) {
+        sd_cache_stats.bypass++;
+        k_mutex_unlock(&sd_cache_mutex);
+        ret = disk_access_read(SD_SECTOR_CACHE_RAW_DISK, buf, start, count);
+        if (ret) {
+            k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+            sd_cache_stats.errors++;
+            k_mutex_unlock(&sd_cache_mutex);
+        }
+        return ret;
+    }
+
+    for (uint32_t i = 0; i < count && ret == 0; i++) {
+        uint32_t sector = start + i;
+        int slot = sd_cache_lookup(sector);
+
+        if (slot >= 0) {
+            sd_cache_stats.hits++;
+            sd_cache_entries[slot].last_use = ++sd_cache_clock;
+        } else {
+            sd_cache_stats.misses++;
+            slot = sd_cache_victim(sd_cache_is_meta(sector));
+            if (sd_cache_entries[slot].valid) {
+                sd_cache_stats.evictions++;
+            }
+            sd_cache_drop(slot);
+            ret = disk_access_read(SD_SECTOR_CACHE_RAW_DISK, sd_cache_data[slot], sector, 1);
+            if (ret) {
+                sd_cache_stats.errors++;
+                break;
+            }
+            sd_cache_fill(slot, sector);
+        }
+        memcpy(&buf[i * SD_SECTOR_SIZE], sd_cache_data[slot], SD_SECTOR_SIZE);
+    }
+
+    k_mutex_unlock(&sd_cache_mutex);
+    return ret;
+}
+
+static int sd_cache_disk_write(struct disk_info *disk, const uint8_t *buf, uint32_t start,
+                               uint32_t count)
+{
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+
+    int ret = disk_access_write(SD_SECTOR_CACHE_RAW_DISK, buf, start, count);
+    for (uint32_t i = 0; i < count; i++) {
+        int slot = sd_cache_lookup(start + i);
+        if (slot < 0) {
+            continue;
+        }
+        if (ret == 0) {
+            memcpy(sd_cache_data[slot], &buf[i * SD_SECTOR_SIZE], SD_SECTOR_SIZE);
+        } else {
+            // Unknown what reached the card, read it again next time
+            sd_cache_drop(slot);
+        }
+    }
+    sd_cache_stats.writes += count;
+    if (ret) {
+        sd_cache_stats.errors++;
+    }
+
+    k_mutex_unlock(&sd_cache_mutex);
+    return ret;
+}
+
+static int sd_cache_disk_ioctl(struct disk_info *disk, uint8_t cmd, void *buff)
+{
+    if (cmd == DISK_IOCTL_CTRL_INIT) {
+        return sd_cache_disk_init(disk);
+    }
+    if (cmd == DISK_IOCTL_CTRL_DEINIT) {
+        // Unmounted, and the next card may not be this one
+        sd_sector_cache_invalidate();
+    }
+    return disk_access_ioctl(SD_SECTOR_CACHE_RAW_DISK, cmd, buff);
+}
+
+static const struct disk_operations sd_cache_disk_ops = {
+    .init = sd_cache_disk_init,
+    .status = sd_cache_disk_status,
+    .read = sd_cache_disk_read,
+    .write = sd_cache_disk_write,
+    .ioctl = sd_cache_disk_ioctl,
+};
+
+static struct disk_info sd_cache_disk = {
+    .name = SD_SECTOR_CACHE_DISK,
+    .ops = &sd_cache_disk_ops,
+};
+
+int sd_sector_cache_init(void)
+{
+    static bool registered;
+
+    if (registered) {
+        return 0;
+    }
+
+    int ret = disk_access_register(&sd_cache_disk);
+    if (ret) {
+        LOG_ERR("Failed to register %s: %d", SD_SECTOR_CACHE_DISK, ret);
+        return ret;
+    }
+    registered = true;
+    return 0;
+}
+
+void sd_sector_cache_invalidate(void)
+{
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+    memset(sd_cache_entries, 0, sizeof(sd_cache_entries));
+    sd_cache_stats.pinned = 0;
+    sd_cache_stats.dir_start = 0;
+    sd_cache_stats.dir_end = 0;
+    k_mutex_unlock(&sd_cache_mutex);
+}
+
+void sd_sector_cache_pin(uint32_t start, uint32_t count)
+{
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+    sd_cache_stats.dir_start = start;
+    sd_cache_stats.dir_end = start + count;
+    // Sectors already cached keep the state they came in with
+    k_mutex_unlock(&sd_cache_mutex);
+
+    LOG_INF("Directory sectors %u-%u pinned", start, start + count);
+}
+
+void sd_sector_cache_get_stats(sd_sector_cache_stats_t *stats)
+{
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+    *stats = sd_cache_stats;
+    k_mutex_unlock(&sd_cache_mutex);
+}
+
+#ifdef CONFIG_SHELL
+
+static int cmd_sdcache_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    sd_sector_cache_stats_t stats;
+    sd_sector_cache_get_stats(&stats);
+
+    uint32_t lookups = stats.hits + stats.misses;
+    shell_print(sh, "%u hits, %u misses (%u%% hit), %u bypassed, %u written, %u evicted",
+                stats.hits, stats.misses, lookups ? stats.hits * 100 / lookups : 0,
+                stats.bypass, stats.writes, stats.evictions);
+    shell_print(sh, "%u card errors", stats.errors);
+    shell_print(sh, "%u/%d FAT/directory sectors cached, region %u-%u, directory %u-%u",
+                stats.pinned, SD_SECTOR_CACHE_SECTORS, stats.meta_start, stats.meta_end,
+                stats.dir_start, stats.dir_end);
+    return 0;
+}
+
+static int cmd_sdcache_reset(const struct shell *sh, size_t argc, char **argv)
+{
+    k_mutex_lock(&sd_cache_mutex, K_FOREVER);
+    sd_cache_stats.hits = 0;
+    sd_cache_stats.misses = 0;
+    sd_cache_stats.bypass = 0;
+    sd_cache_stats.writes = 0;
+    sd_cache_stats.evictions = 0;
+    sd_cache_stats.errors = 0;
+    k_mutex_unlock(&sd_cache_mutex);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_sdcache,
+    SHELL_CMD(stats, NULL, "Hit/miss counters", cmd_sdcache_stats),
+    SHELL_CMD(reset, NULL, "Clear the counters", cmd_sdcache_reset),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(sdcache, &sub_sdcache, "SD sector cache", NULL);
+
+#endif // CONFIG_SHELL
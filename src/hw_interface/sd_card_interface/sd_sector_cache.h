@@ -0,0 +1,54 @@
+#ifndef SD_SECTOR_CACHE_H
+#define SD_SECTOR_CACHE_H
+
+#include <zephyr/types.h>
+
+// FatFs mounts the cache under the name the code has always used ("SD:"),
+// and the cache forwards to the card, which is registered as the raw disk
+#define SD_SECTOR_CACHE_DISK        "SD"
+#define SD_SECTOR_CACHE_RAW_DISK    "SDRAW"     // CONFIG_SDMMC_VOLUME_NAME
+#define SD_SECTOR_SIZE              512
+// Cached sectors, 512 bytes of RAM each
+#define SD_SECTOR_CACHE_SECTORS     12
+// FAT and directory sectors are kept over file data, up to this many
+#define SD_SECTOR_CACHE_PINNED_MAX  8
+
+typedef struct {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t bypass;        // multi-sector reads of file data, not cached
+    uint32_t writes;        // sectors written through
+    uint32_t evictions;
+    uint32_t errors;        // reads and writes the card failed
+    uint8_t pinned;         // cached FAT/directory sectors now
+    uint32_t meta_start;    // FAT/root directory region found on the card
+    uint32_t meta_end;
+    uint32_t volume_serial; // from the boot sector, changes when the card is formatted
+    uint32_t dir_start;     // directory region registered by sd_sector_cache_pin()
+    uint32_t dir_end;
+} sd_sector_cache_stats_t;
+
+/**
+ * @brief Register the caching disk; call before mounting the file system
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int sd_sector_cache_init(void);
+
+/**
+ * @brief Drop everything cached, e.g. after the card was swapped
+ */
+void sd_sector_cache_invalidate(void);
+
+/**
+ * @brief Treat @p count sectors from @p start like FAT sectors
+ *
+ * For a directory outside the fixed FAT/root region (any directory on FAT32,
+ * subdirectories on FAT12/16), so looking songs up keeps its sectors cached.
+ * Replaces the range registered before; invalidating the cache forgets it.
+ */
+void sd_sector_cache_pin(uint32_t start, uint32_t count);
+
+void sd_sector_cache_get_stats(sd_sector_cache_stats_t *stats);
+
+#endif // SD_SECTOR_CACHE_H
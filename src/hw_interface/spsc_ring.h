@@ -0,0 +1,141 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Lock-free single-producer / single-consumer byte ring.
+ *
+ * head is only ever written by the producer and tail only by the consumer, so
+ * the two sides can run in different contexts (thread and ISR) without a lock.
+ * Indices run freely and are masked on access, which is why the size must be
+ * a power of two. Puts are all-or-nothing so a MIDI message is never split.
+ */
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t head;          // producer owned
+    uint32_t tail;          // consumer owned
+    uint32_t high_water;    // producer owned, most bytes ever queued at once
+    uint32_t overflows;     // producer owned, puts rejected for lack of space
+} spsc_ring_t;
+
+/**
+ * @brief Initialize a ring over @p buf
+ *
+ * @param size Size of @p buf in bytes, must be a power of two
+ */
+static inline void spsc_ring_init(spsc_ring_t *ring, uint8_t *buf, uint32_t size)
+{
+    ring->buf = buf;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->high_water = 0;
+    ring->overflows = 0;
+}
+
+/**
+ * @brief Number of bytes currently queued (safe from either side)
+ */
+static inline uint32_t spsc_ring_used(const spsc_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return head - tail;
+}
+
+/**
+ * @brief Number of bytes that can still be put (safe from either side)
+ */
+static inline uint32_t spsc_ring_space(const spsc_ring_t *ring)
+{
+    return ring->size - spsc_ring_used(ring);
+}
+
+/**
+ * @brief Producer side: append @p len bytes, or nothing at all
+ *
+ * @return int 0 on success, -ENOMEM if the ring can't take all of @p data
+ */
+static inline int spsc_ring_put(spsc_ring_t *ring, const uint8_t *data, uint32_t len)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t used = head - tail;
+
+    if (len > ring->size - used) {
+        ring->overflows++;
+        return -ENOMEM;
+    }
+
+    uint32_t idx = head & (ring->size - 1);
+    uint32_t first = ring->size - idx;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(&ring->buf[idx], data, first);
+    memcpy(ring->buf, data + first, len - first);
+
+    // Publish the bytes before the consumer can see the new head
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+
+    if (used + len > ring->high_water) {
+        ring->high_water = used + len;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Consumer side: take up to @p max bytes out of the ring
+ *
+ * @return uint32_t Number of bytes copied to @p out
+ */
+static inline uint32_t spsc_ring_get(spsc_ring_t *ring, uint8_t *out, uint32_t max)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t len = head - tail;
+
+    if (len > max) {
+        len = max;
+    }
+    if (len == 0) {
+        return 0;
+    }
+
+    uint32_t idx = tail & (ring->size - 1);
+    uint32_t first = ring->size - idx;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(out, &ring->buf[idx], first);
+    memcpy(out + first, ring->buf, len - first);
+
+    // Hand the space back only after the bytes have been copied out
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+/**
+ * @brief Consumer side: drop everything currently queued
+ *
+ * @return uint32_t Number of bytes dropped
+ */
+static inline uint32_t spsc_ring_discard(spsc_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+    __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+
+    return head - tail;
+}
+
+#endif /* SPSC_RING_H */
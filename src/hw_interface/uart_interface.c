@@ -5,6 +5,7 @@
 #include <zephyr/sys/ring_buffer.h>
 
 #include "uart_interface.h"
+#include "latency_probe.h"
 
 LOG_MODULE_REGISTER(uart_interface, LOG_LEVEL_DBG);
 
@@ -26,6 +27,104 @@ static const struct uart_config uart_cfg = {
 static uint8_t rx_ring_buf_data[RX_RING_BUF_SIZE];
 static struct ring_buf rx_ring_buf;
 
+// Start the next DMA chunk from the TX ring. Only called by whoever owns
+// tx_active: the producer that claimed it, or uart_cb() chaining from TX_DONE.
+static void uart_tx_kick(uart_midi_ctx_t *ctx)
+{
+    while (1) {
+        // Alternate buffers so the one the driver just finished with is never
+        // refilled under it
+        uint8_t *chunk = ctx->tx_buf[ctx->tx_buf_idx];
+        uint32_t pre = 0;
+
+        // Bytes behind an aborted chunk may rely on running status the
+        // receiver never got, so lead with the status they were encoded under
+        if (ctx->tx_resync && ctx->tx_status != 0) {
+            chunk[pre++] = ctx->tx_status;
+        }
+
+        uint32_t pos = ctx->tx_ring.tail;
+        uint32_t len = spsc_ring_get(&ctx->tx_ring, chunk + pre, UART_TX_BUF_SIZE - pre);
+
+        if (len > 0) {
+            latency_probe_span_tx_start(&ctx->tx_trace, pos, len);
+            // Not needed if the queued bytes start with their own status;
+            // real-time bytes (0xF8+) leave running status alone, so they don't count
+            if (pre > 0 && chunk[pre] >= 0x80 && chunk[pre] <= 0xF7) {
+                chunk++;
+                pre = 0;
+            }
+            ctx->tx_resync = false;
+
+            for (uint32_t i = pre; i < pre + len; i++) {
+                if (chunk[i] >= 0xF8) {
+                    continue;               // Real-Time leaves running status alone
+                } else if (chunk[i] >= 0xF0) {
+                    ctx->tx_status = 0;     // System Common cancels it
+                } else if (chunk[i] >= 0x80) {
+                    ctx->tx_status = chunk[i];
+                }
+            }
+            len += pre;
+        }
+
+        if (len == 0) {
+            atomic_clear(&ctx->tx_active);
+            k_sem_give(&ctx->tx_idle_sem);
+
+            // A producer may have queued bytes after the get above but saw
+            // tx_active still set, so look again before going idle
+            if (spsc_ring_used(&ctx->tx_ring) == 0 || !atomic_cas(&ctx->tx_active, 0, 1)) {
+                return;
+            }
+            continue;
+        }
+
+        ctx->tx_buf_idx ^= 1;
+        int err = uart_tx(ctx->uart_dev, chunk, len, SYS_FOREVER_US);
+        if (err == 0) {
+            ctx->tx_chunks++;
+            return;
+        }
+
+        LOG_ERR("Failed to start UART TX: %d", err);
+        ctx->tx_errors++;
+        latency_probe_span_reset(&ctx->tx_trace);
+    }
+}
+
+// Without the async API bytes go out with uart_poll_out(), which busy-waits a
+// byte time each. That runs here on the system work queue, never in the
+// sender, who may hold the MIDI send lock.
+static void uart_tx_poll_work_fn(struct k_work *work)
+{
+    uint8_t byte;
+
+    while (1) {
+        uint32_t pos = uart_ctx.tx_ring.tail;
+        uint32_t len = spsc_ring_used(&uart_ctx.tx_ring);
+
+        if (len > 0) {
+            latency_probe_span_tx_start(&uart_ctx.tx_trace, pos, len);
+            for (uint32_t i = 0; i < len && spsc_ring_get(&uart_ctx.tx_ring, &byte, 1) == 1; i++) {
+                uart_poll_out(uart_ctx.uart_dev, byte);
+            }
+            latency_probe_span_tx_done(&uart_ctx.tx_trace);
+            continue;
+        }
+
+        atomic_clear(&uart_ctx.tx_active);
+        k_sem_give(&uart_ctx.tx_idle_sem);
+
+        // Same race as in uart_tx_kick(): bytes queued while tx_active was set
+        if (spsc_ring_used(&uart_ctx.tx_ring) == 0 || !atomic_cas(&uart_ctx.tx_active, 0, 1)) {
+            return;
+        }
+    }
+}
+
+static K_WORK_DEFINE(uart_tx_poll_work, uart_tx_poll_work_fn);
+
 // Asynchronous UART callback (if supported)
 static void uart_cb(const struct device *dev, struct uart_event *evt, void *user_data)
 {
@@ -34,14 +133,18 @@ static void uart_cb(const struct device *dev, struct uart_event *evt, void *user
     switch (evt->type) {
     case UART_TX_DONE:
         //LOG_DBG("UART TX completed: %d bytes", evt->data.tx.len);
-        ctx->tx_busy = false;
-        k_sem_give(&ctx->tx_done_sem);
+        latency_probe_span_tx_done(&ctx->tx_trace);
+        uart_tx_kick(ctx);
         break;
 
     case UART_TX_ABORTED:
         LOG_WRN("UART TX aborted");
-        ctx->tx_busy = false;
-        k_sem_give(&ctx->tx_done_sem);
+        ctx->tx_aborts++;
+        ctx->tx_resync = true;
+        atomic_inc(&ctx->tx_abort_seq);
+        // Part of the chunk never made it, so there is nothing to time
+        latency_probe_span_reset(&ctx->tx_trace);
+        uart_tx_kick(ctx);
         break;
 
     case UART_RX_RDY:
@@ -54,16 +157,19 @@ static void uart_cb(const struct device *dev, struct uart_event *evt, void *user
                                           &evt->data.rx.buf[evt->data.rx.offset], 
                                           evt->data.rx.len);
             if (written != evt->data.rx.len) {
+                ctx->rx_dropped += evt->data.rx.len - written;
                 LOG_WRN("RX ring buffer overflow, lost %d bytes", 
                         evt->data.rx.len - written);
             }
+            k_sem_give(&ctx->rx_sem);
         }
         break;
 
     case UART_RX_BUF_REQUEST:
         LOG_DBG("UART RX buffer request");
-        // Provide new buffer for continuous reception
-        uart_rx_enable(dev, ctx->rx_buf, sizeof(ctx->rx_buf), SYS_FOREVER_US);
+        // Provide the other buffer for continuous reception
+        ctx->rx_buf_idx ^= 1;
+        uart_rx_buf_rsp(dev, ctx->rx_buf[ctx->rx_buf_idx], UART_RX_BUF_SIZE);
         break;
 
     case UART_RX_BUF_RELEASED:
@@ -72,6 +178,9 @@ static void uart_cb(const struct device *dev, struct uart_event *evt, void *user
 
     case UART_RX_DISABLED:
         LOG_DBG("UART RX disabled");
+        // Keep listening, e.g. after a framing error stopped reception
+        ctx->rx_buf_idx = 0;
+        uart_rx_enable(dev, ctx->rx_buf[0], UART_RX_BUF_SIZE, UART_RX_TIMEOUT_US);
         break;
 
     default:
@@ -85,11 +194,20 @@ static void uart_isr_rx_handler(const struct device *dev, void *user_data)
 {
     uint8_t byte;
     
+    uart_midi_ctx_t *ctx = (uart_midi_ctx_t *)user_data;
+    bool received = false;
+
     while (uart_poll_in(dev, &byte) == 0) {
         // Put received byte into ring buffer
         if (ring_buf_put(&rx_ring_buf, &byte, 1) == 0) {
+            ctx->rx_dropped++;
             LOG_WRN("RX ring buffer full, dropping byte");
         }
+        received = true;
+    }
+
+    if (received) {
+        k_sem_give(&ctx->rx_sem);
     }
 }
 
@@ -98,13 +216,22 @@ int app_uart_init(void)
     int err;
     
     // Initialize synchronization primitives
-    k_sem_init(&uart_ctx.tx_done_sem, 0, 1);
-    k_mutex_init(&uart_ctx.tx_mutex);
-    uart_ctx.tx_busy = false;
+    k_sem_init(&uart_ctx.tx_idle_sem, 0, 1);
+    atomic_clear(&uart_ctx.tx_active);
     uart_ctx.async_api_supported = false;
+
+    // Initialize lock-free ring for TX
+    spsc_ring_init(&uart_ctx.tx_ring, uart_ctx.tx_ring_buf, sizeof(uart_ctx.tx_ring_buf));
+    uart_ctx.tx_buf_idx = 0;
+    uart_ctx.tx_status = 0;
+    uart_ctx.tx_resync = false;
+    atomic_clear(&uart_ctx.tx_abort_seq);
     
     // Initialize ring buffer for RX
     ring_buf_init(&rx_ring_buf, sizeof(rx_ring_buf_data), rx_ring_buf_data);
+    k_sem_init(&uart_ctx.rx_sem, 0, 1);
+    uart_ctx.rx_buf_idx = 0;
+    uart_ctx.rx_dropped = 0;
 
     // Get UART device
     uart_ctx.uart_dev = DEVICE_DT_GET(DT_NODELABEL(uart1));
@@ -119,9 +246,10 @@ int app_uart_init(void)
         LOG_INF("Using asynchronous UART API");
         uart_ctx.async_api_supported = true;
         
-        // Enable RX for continuous reception
-        err = uart_rx_enable(uart_ctx.uart_dev, uart_ctx.rx_buf, 
-                            sizeof(uart_ctx.rx_buf), SYS_FOREVER_US);
+        // Enable RX for continuous reception. A short timeout hands bytes
+        // over as soon as the line goes idle instead of when the buffer fills.
+        err = uart_rx_enable(uart_ctx.uart_dev, uart_ctx.rx_buf[0], 
+                            UART_RX_BUF_SIZE, UART_RX_TIMEOUT_US);
         if (err) {
             LOG_WRN("Failed to enable UART RX: %d", err);
             // Continue without RX - we mainly need TX for MIDI output
@@ -142,46 +270,95 @@ int app_uart_init(void)
     return 0;
 }
 
-int uart_send_midi_data(const uint8_t *data, size_t len)
+int uart_send_midi_data(const uint8_t *data, size_t len, bool traced)
 {
     if (!data || len == 0) {
         return -EINVAL;
     }
 
-    // Acquire mutex to ensure atomic transmission
-    k_mutex_lock(&uart_ctx.tx_mutex, K_FOREVER);
+    if (traced) {
+        latency_probe_span_queued(&uart_ctx.tx_trace, uart_ctx.tx_ring.head, len);
+    }
+    int err = spsc_ring_put(&uart_ctx.tx_ring, data, len);
+    if (err) {
+        if (traced) {
+            latency_probe_span_reset(&uart_ctx.tx_trace);
+        }
+        return err;
+    }
+
+    // Start the wire if nothing is in flight, otherwise TX_DONE picks it up
+    if (!atomic_cas(&uart_ctx.tx_active, 0, 1)) {
+        return 0;
+    }
 
-    int err = 0;
-    
     if (uart_ctx.async_api_supported) {
-        // Use asynchronous API
-        uart_ctx.tx_busy = true;
-        
-        err = uart_tx(uart_ctx.uart_dev, data, len, SYS_FOREVER_US);
-        if (err) {
-            LOG_ERR("Failed to start UART TX: %d", err);
-            uart_ctx.tx_busy = false;
-        } else {
-            // Wait for transmission to complete
-            err = k_sem_take(&uart_ctx.tx_done_sem, K_MSEC(1000));
-            if (err) {
-                LOG_ERR("UART TX timeout");
-                uart_tx_abort(uart_ctx.uart_dev);
-                uart_ctx.tx_busy = false;
-                err = -ETIMEDOUT;
-            }
-        }
+        uart_tx_kick(&uart_ctx);
     } else {
-        // Use polling API as fallback
-        for (size_t i = 0; i < len; i++) {
-            uart_poll_out(uart_ctx.uart_dev, data[i]);
+        // Use polling API as fallback, drained off the caller's thread
+        k_work_submit(&uart_tx_poll_work);
+    }
+
+    return 0;
+}
+
+int uart_midi_tx_flush(k_timeout_t timeout)
+{
+    k_sem_reset(&uart_ctx.tx_idle_sem);
+
+    while (atomic_get(&uart_ctx.tx_active) || spsc_ring_used(&uart_ctx.tx_ring) > 0) {
+        if (k_sem_take(&uart_ctx.tx_idle_sem, timeout) != 0) {
+            return -EAGAIN;
         }
-        //LOG_DBG("Sent %d MIDI bytes via polling", len);
     }
 
-    k_mutex_unlock(&uart_ctx.tx_mutex);
-    return err;
+    return 0;
 }
 
+int uart_midi_rx_wait(k_timeout_t timeout)
+{
+    if (!ring_buf_is_empty(&rx_ring_buf)) {
+        return 0;
+    }
 
+    return k_sem_take(&uart_ctx.rx_sem, timeout) == 0 ? 0 : -EAGAIN;
+}
+
+uint32_t uart_midi_rx_claim(uint8_t **data, uint32_t max)
+{
+    return ring_buf_get_claim(&rx_ring_buf, data, max);
+}
+
+void uart_midi_rx_finish(uint32_t len)
+{
+    ring_buf_get_finish(&rx_ring_buf, len);
+}
+
+uint32_t uart_midi_rx_dropped(void)
+{
+    return uart_ctx.rx_dropped;
+}
 
+uint32_t uart_midi_tx_abort_seq(void)
+{
+    return (uint32_t)atomic_get(&uart_ctx.tx_abort_seq);
+}
+
+void uart_midi_get_tx_stats(uart_midi_tx_stats_t *stats)
+{
+    stats->queued = spsc_ring_used(&uart_ctx.tx_ring);
+    stats->high_water = uart_ctx.tx_ring.high_water;
+    stats->overflows = uart_ctx.tx_ring.overflows;
+    stats->chunks = uart_ctx.tx_chunks;
+    stats->aborts = uart_ctx.tx_aborts;
+    stats->errors = uart_ctx.tx_errors;
+}
+
+void uart_midi_reset_tx_stats(void)
+{
+    uart_ctx.tx_ring.high_water = spsc_ring_used(&uart_ctx.tx_ring);
+    uart_ctx.tx_ring.overflows = 0;
+    uart_ctx.tx_chunks = 0;
+    uart_ctx.tx_aborts = 0;
+    uart_ctx.tx_errors = 0;
+}
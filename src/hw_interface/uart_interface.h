@@ -9,23 +9,52 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/uart.h>
 
+#include "spsc_ring.h"
+#include "latency_probe.h"
+
 // Buffer sizes
 #define UART_TX_BUF_SIZE        64
 #define UART_RX_BUF_SIZE        32
+// Idle time after which received bytes are handed over, ~1 byte at 31.25 kbps
+#define UART_RX_TIMEOUT_US      400
+// Bytes waiting for the wire, must be a power of two
+#define UART_TX_RING_SIZE       1024
 
 #define MIDI_BAUD_RATE 31250
 
 // UART MIDI context structure
 typedef struct {
     const struct device *uart_dev;
-    struct k_sem tx_done_sem;
-    struct k_mutex tx_mutex;
-    bool tx_busy;
+    struct k_sem tx_idle_sem;
+    atomic_t tx_active;         // set while a DMA chunk is in flight
     bool async_api_supported;
-    uint8_t tx_buf[UART_TX_BUF_SIZE];
-    uint8_t rx_buf[UART_RX_BUF_SIZE];
+    spsc_ring_t tx_ring;
+    uint8_t tx_ring_buf[UART_TX_RING_SIZE];
+    uint8_t tx_buf[2][UART_TX_BUF_SIZE];   // ping-pong DMA chunks
+    uint8_t tx_buf_idx;
+    uint8_t tx_status;          // last status byte handed to the driver
+    bool tx_resync;             // re-send tx_status after an abort
+    atomic_t tx_abort_seq;      // never reset, lets encoders spot aborts
+    uint32_t tx_chunks;
+    uint32_t tx_aborts;
+    uint32_t tx_errors;
+    latency_span_t tx_trace;    // traced input's bytes in the TX ring
+    uint8_t rx_buf[2][UART_RX_BUF_SIZE];   // handed to the driver in turn
+    uint8_t rx_buf_idx;
+    struct k_sem rx_sem;        // given whenever bytes land in the RX ring
+    uint32_t rx_dropped;        // bytes lost to a full RX ring
 } uart_midi_ctx_t;
 
+// TX path counters, used to size UART_TX_RING_SIZE from real playing
+typedef struct {
+    uint32_t queued;        // bytes waiting in the ring right now
+    uint32_t high_water;    // most bytes ever waiting at once
+    uint32_t overflows;     // sends rejected because the ring was full
+    uint32_t chunks;        // DMA transfers started
+    uint32_t aborts;        // transfers aborted by the driver
+    uint32_t errors;        // uart_tx() failures, chunk dropped
+} uart_midi_tx_stats_t;
+
 
 /**
  * @brief Initialize and check if UART is ready
@@ -36,8 +65,68 @@ typedef struct {
 int app_uart_init(void);
 
 /**
- * @brief Send raw MIDI bytes via UART using asynchronous API
+ * @brief Queue raw MIDI bytes for the UART without waiting for the wire
+ *
+ * Bytes are copied into a lock-free ring and sent by chained DMA transfers
+ * from the TX_DONE callback (without the async API, by polled output from a
+ * system work queue item). The ring has a single producer: callers in more
+ * than one context must serialize (midi.c does this for all MIDI output).
+ *
+ * @param traced The bytes answer the input the latency probe is tracing
+ * @return int 0 on success, -ENOMEM if the ring is full (nothing is queued)
+ */
+int uart_send_midi_data(const uint8_t *data, size_t length, bool traced);
+
+/**
+ * @brief Wait until every queued byte has left the UART
+ *
+ * @param timeout How long to wait
+ * @return int 0 once idle, -EAGAIN on timeout
+ */
+int uart_midi_tx_flush(k_timeout_t timeout);
+
+/**
+ * @brief Wait for received bytes to be available in the RX ring
+ *
+ * @return int 0 when bytes arrived, -EAGAIN on timeout
+ */
+int uart_midi_rx_wait(k_timeout_t timeout);
+
+/**
+ * @brief Borrow up to @p max received bytes in place, without copying
+ *
+ * The pointer stays valid until uart_midi_rx_finish(). A single consumer only.
+ *
+ * @return uint32_t Number of contiguous bytes at *@p data
+ */
+uint32_t uart_midi_rx_claim(uint8_t **data, uint32_t max);
+
+/**
+ * @brief Release @p len bytes previously claimed with uart_midi_rx_claim()
+ */
+void uart_midi_rx_finish(uint32_t len);
+
+/**
+ * @brief Number of received bytes dropped because the RX ring was full
+ */
+uint32_t uart_midi_rx_dropped(void);
+
+/**
+ * @brief Number of TX aborts since boot
+ *
+ * Never reset, so a running-status encoder can compare it against the value
+ * it last saw and drop its state after an abort.
+ */
+uint32_t uart_midi_tx_abort_seq(void);
+
+/**
+ * @brief Read the TX path counters
+ */
+void uart_midi_get_tx_stats(uart_midi_tx_stats_t *stats);
+
+/**
+ * @brief Clear the high-water mark and the error counters
  */
-int uart_send_midi_data(const uint8_t *data, size_t length);
+void uart_midi_reset_tx_stats(void);
 
 #endif /* UART_INTERFACE_H */
@@ -16,11 +16,21 @@
 
 #include "hw_interface/ble_interface/ble_interface.h"
 #include "hw_interface/sd_card_interface/sd_card_interface.h"
+#include "hw_interface/sd_card_interface/sd_manager.h"
 #include "hw_interface/VS1053_interface/VS1053_interface.h"
 #include "hw_interface/VS1053_interface/midi.h"
+#include "hw_interface/VS1053_interface/midi_scheduler.h"
+#include "hw_interface/VS1053_interface/midi_in.h"
+#include "hw_interface/VS1053_interface/midi_sdi.h"
 #include "hw_interface/spi_interface.h"
 #include "hw_interface/i2c_interface.h"
 #include "hw_interface/uart_interface.h"
+#include "hw_interface/latency_probe.h"
+#include "midi_file/smc_cache.h"
+#include "midi_file/midi_player.h"
+#include "midi_file/midi_recorder.h"
+#include "midi_file/track_index.h"
+#include "settings_store/settings_store.h"
 // TODO - Patrick: IMPORTANT
 //                 this include has to be changed to state_machine.h once the file is changed
 //    
@@ -53,8 +63,33 @@ LOG_MODULE_REGISTER(MODULE, LOG_LEVEL_DBG);
 #define FULL_CHRG 835 //fully charged
 bool charge_bat = false;
 int adc = 0;
-//MIDI
-uint8_t midi_data[MAX_MIDI_DATA_LENGTH];
+
+//UI state, defined in ui_thread.c
+extern fsm_struct fsm;
+
+//Runs on the SD manager's work queue whenever a card comes or goes
+static void sd_card_event_handler(sd_card_event_t event, void *user)
+{
+    switch (event) {
+        case SD_CARD_EVENT_MOUNTED:
+        case SD_CARD_EVENT_SONGS_CHANGED:
+            // Metadata first, so the track menu has it before the caches are built.
+            // fsm belongs to the UI thread, which fits the track to the new count.
+            track_index_build();
+            // Compile new or changed songs now rather than when one is picked
+            smc_cache_build_all();
+            break;
+
+        case SD_CARD_EVENT_REMOVING:
+            // Nothing may keep streaming from a card that is going away
+            midi_player_stop();
+            midi_recorder_stop();
+            break;
+
+        default:
+            break;
+    }
+}
 
 
 //
@@ -66,8 +101,12 @@ int main(void)
   
     
 
+    latency_probe_init();
+
     LOG_INF("Initializing UART interface..");
     app_uart_init();
+    midi_sched_init();
+    midi_in_init();
         
     // Initialize I2C interface
     LOG_INF("Initializing I2C interface...");
@@ -75,6 +114,9 @@ int main(void)
 
     LOG_INF("Initializing VS1053 codec...");
     VS1053Init();
+    midi_sdi_init();
+    // The synth can take what arrives on MIDI IN now
+    midi_in_set_thru(MIDI_IN_THRU_DEFAULT);
     k_msleep(2000);
   
     // Initialize audio amplifier GPIO control pins
@@ -99,8 +141,16 @@ int main(void)
     //AppTimer_Start();
     //Saadc_Init();
     
+    settings_store_init(SETTINGS_STORE_DEFAULT_BACKEND, &fsm);
+    midi_player_init();
+    midi_recorder_init();
+
     LOG_INF("Initializing SD Card...");
-    SDcardInterfaceInit(); //Error here when attempting to run - see sd_card_interface.c
+    if (SDcardInterfaceInit() == 0) {
+        sd_manager_add_listener(sd_card_event_handler, NULL);
+        // Mounting and indexing happen in the background, boot doesn't wait for a card
+        sd_manager_init();
+    }
 
     
     //TESTING PURPOSES - This works (PWR LED is red)
@@ -0,0 +1,733 @@
+// midi_player.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "midi_player.h"
+#include "smf_parser.h"
+#include "smf_merge.h"
+#include "smf_sd_io.h"
+#include "smc_format.h"
+#include "smc_cache.h"
+#include "tempo_map.h"
+#include "smk_index.h"
+#include "midi_prefetch.h"
+#include "hw_interface/VS1053_interface/midi.h"
+#include "hw_interface/VS1053_interface/midi_scheduler.h"
+#include "hw_interface/VS1053_interface/midi_voice.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+
+LOG_MODULE_REGISTER(midi_player, LOG_LEVEL_INF);
+
+BUILD_ASSERT(MAX_MIDI_TRACKS <= SMF_MAX_TRACKS, "the merge can't hold MAX_MIDI_TRACKS cursors");
+
+K_THREAD_STACK_DEFINE(midi_player_stack, MIDI_PLAYER_STACK_SIZE);
+static struct k_thread midi_player_thread_data;
+
+static K_SEM_DEFINE(player_start_sem, 0, 1);
+static K_SEM_DEFINE(player_done_sem, 0, 1);
+// Cuts a wait short when a stop is requested
+static K_SEM_DEFINE(player_wake_sem, 0, 1);
+static K_MUTEX_DEFINE(player_mutex);
+static K_MUTEX_DEFINE(player_stop_mutex);   // one stopper waits on player_done_sem at a time
+
+static char player_path[MIDI_PLAYER_PATH_LEN];
+static uint32_t player_from_ms;         // where the requested playback starts
+static uint32_t player_resume_ms;       // where pause left the song
+static bool player_paused;
+static atomic_t player_busy;
+static atomic_t player_stop_req;
+
+static struct k_spinlock player_stats_lock;
+static midi_player_stats_t player_stats;
+
+// Song being played; one at a time, so none of this lives on the stack
+static uint8_t player_buf[MIDI_TRACK_BUFFER_BUDGET];
+static smf_sd_file_t player_file;
+static smf_file_t player_smf;
+static smf_merge_t player_merge;
+static smc_reader_t player_smc;
+static bool player_cached;
+
+static tempo_segment_t player_tempo_segs[TEMPO_MAP_MAX_SEGMENTS];
+static tempo_map_t player_tempo;
+
+// Starting mid-song: channel state to replay first, and the first event to play
+static smf_sd_file_t player_index_file;
+static smk_keyframe_t player_start_state;
+static smc_record_t player_pending;
+static bool player_has_pending;
+
+// Song time to uptime: song_us plays at wall_us, later song time runs stretch_q16 times slower
+typedef struct {
+    uint32_t song_us;
+    uint64_t wall_us;
+    uint32_t stretch_q16;
+} player_warp_t;
+
+static player_warp_t player_warp;
+// Notes and sustain the player has started and not yet scheduled an end
+// for; only the player thread touches these
+static uint32_t player_notes[16][NUM_MIDI_NOTES / 32];
+static uint16_t player_sustain;
+
+static uint32_t player_song_tempo_us;   // opening tempo, what midi_player_set_tempo() scales
+static atomic_t player_target_bpm;      // 0 plays as written
+
+// midi_player_song_tempo() runs from the UI while a song may be playing
+static K_MUTEX_DEFINE(player_info_mutex);
+static smf_sd_file_t player_info_file;
+static uint8_t player_info_buf[SMF_MERGE_MIN_WINDOW * 4];
+
+static uint64_t player_now_us(void)
+{
+    return k_ticks_to_us_floor64(midi_sched_now());
+}
+
+// Sleep until @p us (uptime) unless a stop comes first; true if playback should end
+static bool player_wait_until(uint64_t us)
+{
+    if (us > player_now_us()) {
+        k_sem_take(&player_wake_sem, K_TIMEOUT_ABS_TICKS(midi_sched_us_to_ticks(us)));
+    }
+    return atomic_get(&player_stop_req);
+}
+
+static uint64_t player_warp_to_wall(const player_warp_t *w, uint32_t song_us)
+{
+    return w->wall_us + (((uint64_t)(song_us - w->song_us) * w->stretch_q16) >> 16);
+}
+
+// Q16.16 real time per song time to play at the requested BPM
+static uint32_t player_stretch(uint16_t bpm)
+{
+    if (bpm == 0 || player_song_tempo_us == 0) {
+        return MIDI_PLAYER_Q16_ONE;
+    }
+
+    // (60e6 / song tempo) BPM as written, over the BPM asked for
+    uint64_t stretch = ((uint64_t)TEMPO_MAP_US_PER_MIN << 16) / ((uint64_t)player_song_tempo_us * bpm);
+    return CLAMP(stretch, MIDI_PLAYER_Q16_ONE / MIDI_PLAYER_MAX_STRETCH,
+                 MIDI_PLAYER_Q16_ONE * MIDI_PLAYER_MAX_STRETCH);
+}
+
+// What the shell shows about the song, once it is open
+static void player_stats_song(uint8_t ntracks, uint32_t duration_ms)
+{
+    k_spinlock_key_t key = k_spin_lock(&player_stats_lock);
+    player_stats.cached = player_cached;
+    player_stats.ntracks = ntracks;
+    player_stats.duration_ms = duration_ms;
+    k_spin_unlock(&player_stats_lock, key);
+}
+
+static int player_open(const char *path)
+{
+    char smc_path[SMC_CACHE_PATH_LEN];
+    smc_header_t hdr;
+    int ret;
+
+    if (smc_cache_lookup(path, smc_path, sizeof(smc_path), &hdr) == 0) {
+        ret = smf_sd_open(&player_file, smc_path);
+        if (ret == 0) {
+            ret = smc_reader_open(&player_smc, &player_file.io, player_buf, sizeof(player_buf));
+            if (ret == 0) {
+                player_cached = true;
+                player_stats_song(hdr.ntracks, hdr.duration_us / 1000);
+                player_song_tempo_us = hdr.initial_tempo_us;
+                return 0;
+            }
+            smf_sd_close(&player_file);
+        }
+        LOG_WRN("Cache of %s unusable (%d), merging live", path, ret);
+    }
+
+    player_cached = false;
+    ret = smf_sd_open(&player_file, path);
+    if (ret) {
+        return ret;
+    }
+
+    ret = smf_open(&player_smf, &player_file.io);
+    if (ret == 0 && player_smf.ntracks > MAX_MIDI_TRACKS) {
+        ret = -E2BIG;
+    }
+    if (ret == 0) {
+        // Whole buffer for the tempo scan, it is shared out to the tracks after
+        tempo_map_init(&player_tempo, player_tempo_segs, TEMPO_MAP_MAX_SEGMENTS,
+                       player_smf.division);
+        ret = tempo_map_build(&player_tempo, &player_smf, player_buf,
+                              MIN(sizeof(player_buf), SMF_MERGE_MAX_WINDOW));
+    }
+    if (ret == 0) {
+        ret = smf_merge_init(&player_merge, &player_smf, player_buf, sizeof(player_buf));
+    }
+    if (ret) {
+        smf_sd_close(&player_file);
+        return ret;
+    }
+
+    if (player_tempo.truncated) {
+        LOG_WRN("%s has more than %d tempo changes, timing will be off", path,
+                TEMPO_MAP_MAX_SEGMENTS);
+    }
+    player_stats_song(player_smf.ntracks, tempo_map_duration_us(&player_tempo) / 1000);
+    player_song_tempo_us = tempo_map_tempo_at(&player_tempo, 0);
+    return 0;
+}
+
+// Next channel message with its song time, from the cache or the live merge
+static int player_next(smc_record_t *rec)
+{
+    smf_event_t ev;
+    uint8_t track;
+    int ret;
+
+    if (player_cached) {
+        return smc_reader_next(&player_smc, rec);
+    }
+
+    while ((ret = smf_merge_next(&player_merge, &ev, &track)) == 1) {
+        if (ev.type == SMF_EVENT_MIDI) {
+            rec->time_us = tempo_map_tick_to_us(&player_tempo, ev.tick);
+            rec->status = ev.status;
+            rec->data1 = ev.data1;
+            rec->data2 = ev.data2;
+            rec->track = track;
+            return 1;
+        }
+    }
+
+    return ret;
+}
+
+// What the prefetch thread reads from: the first event after a seek, then the song
+static int player_source(smc_record_t *rec)
+{
+    if (player_has_pending) {
+        *rec = player_pending;
+        player_has_pending = false;
+        return 1;
+    }
+    return player_next(rec);
+}
+
+// Jump to the last keyframe before @p from_us, if the song has an index
+static void player_seek_keyframe(const char *path, uint32_t from_us)
+{
+    char smk_path[SMC_CACHE_PATH_LEN];
+    smk_header_t hdr;
+
+    if (smc_cache_index_lookup(path, smk_path, sizeof(smk_path), &hdr) != 0 ||
+        smf_sd_open(&player_index_file, smk_path) != 0) {
+        return;
+    }
+
+    int ret = smk_find(&player_index_file.io, &hdr, from_us, &player_start_state);
+    if (ret == 0) {
+        ret = player_cached ? smc_reader_seek(&player_smc, player_start_state.record)
+                            : smf_merge_restore(&player_merge, player_start_state.track);
+    }
+    smf_sd_close(&player_index_file);
+
+    if (ret) {
+        // The source may have moved already, which only a reopen undoes
+        LOG_WRN("Keyframe seek failed (%d), starting %s from the top", ret, path);
+        smk_state_init(&player_start_state);
+        if (player_cached) {
+            smc_reader_seek(&player_smc, 0);
+        } else {
+            smf_merge_init(&player_merge, &player_smf, player_buf, sizeof(player_buf));
+        }
+        return;
+    }
+
+    LOG_INF("Resuming from keyframe at %u ms", player_start_state.time_us / 1000);
+}
+
+// Position the song at @p from_us: keyframe, then catch up silently to the exact time
+static int player_seek(const char *path, uint32_t from_us)
+{
+    smc_record_t rec;
+    int ret;
+
+    smk_state_init(&player_start_state);
+    player_has_pending = false;
+    if (from_us == 0) {
+        return 0;
+    }
+
+    player_seek_keyframe(path, from_us);
+
+    while ((ret = player_next(&rec)) == 1) {
+        if (rec.time_us >= from_us) {
+            player_pending = rec;
+            player_has_pending = true;
+            return 0;
+        }
+        smk_state_apply(&player_start_state, rec.status, rec.data1, rec.data2);
+    }
+
+    return ret;
+}
+
+// Schedule one of the player's messages, keeping track of what it leaves sounding
+static int player_sched(uint64_t at_us, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    int ret = midi_sched_at_us(at_us, MIDI_SCHED_TAG_PLAYER, status, data1, data2);
+    if (ret) {
+        return ret;
+    }
+
+    uint8_t ch = status & 0x0F;
+    uint8_t type = status & 0xF0;
+    if (type == note_on && data2 > 0) {
+        player_notes[ch][data1 / 32] |= BIT(data1 % 32);
+    } else if (type == note_on || type == note_off) {
+        player_notes[ch][data1 / 32] &= ~BIT(data1 % 32);
+    } else if (type == control_change && data1 == 0x40) {
+        if (data2 >= 64) {
+            player_sustain |= BIT(ch);
+        } else {
+            player_sustain &= ~BIT(ch);
+        }
+    } else if (type == control_change && (data1 == 0x78 || data1 == 0x7B)) {
+        memset(player_notes[ch], 0, sizeof(player_notes[ch]));
+    }
+    return 0;
+}
+
+// After a stop: end the notes and sustain the player left on, and nothing
+// else, so live playing and tests keep their notes and controller state
+static void player_release(void)
+{
+    midi_tx_group_t group;
+    int notes = 0;
+
+    midi_group_init(&group);
+    for (uint8_t ch = 0; ch < 16; ch++) {
+        for (uint8_t w = 0; w < NUM_MIDI_NOTES / 32; w++) {
+            uint32_t bits = player_notes[ch][w];
+            while (bits) {
+                uint8_t note = w * 32 + __builtin_ctz(bits);
+                bits &= bits - 1;
+                if (group.len + MIDI_VOICE_GROUP_ROOM > MIDI_TX_GROUP_SIZE) {
+                    midi_group_send(&group);
+                }
+                midi_voice_group_add(&group, note_off | ch, note, 0);
+                notes++;
+            }
+        }
+        if (player_sustain & BIT(ch)) {
+            if (group.len + MIDI_VOICE_GROUP_ROOM > MIDI_TX_GROUP_SIZE) {
+                midi_group_send(&group);
+            }
+            midi_voice_group_add(&group, control_change | ch, 0x40, 0);
+        }
+    }
+    midi_group_send(&group);
+
+    LOG_DBG("Released %d player notes", notes);
+    memset(player_notes, 0, sizeof(player_notes));
+    player_sustain = 0;
+}
+
+// Channel setup and held notes that were in effect at the start point
+static int player_replay_state(uint64_t at_us)
+{
+    const smk_keyframe_t *st = &player_start_state;
+    int ret = 0;
+
+    for (uint8_t ch = 0; ch < 16 && ret == 0; ch++) {
+        if (st->bank[ch] != SMK_UNSET) {
+            ret = player_sched(at_us, control_change | ch, 0x00, st->bank[ch]);
+        }
+        if (ret == 0 && st->program[ch] != SMK_UNSET) {
+            ret = player_sched(at_us, program_chng | ch, st->program[ch], 0);
+        }
+        if (ret == 0 && st->volume[ch] != SMK_UNSET) {
+            ret = player_sched(at_us, control_change | ch, 0x07, st->volume[ch]);
+        }
+    }
+
+    for (uint8_t i = 0; i < st->note_count && ret == 0; i++) {
+        ret = player_sched(at_us, note_on | st->notes[i].chan, st->notes[i].note, st->notes[i].vel);
+    }
+
+    return ret;
+}
+
+// Feed the scheduler MIDI_PLAYER_LOOKAHEAD_MS ahead of the audio
+static int player_run(uint32_t from_us)
+{
+    smc_record_t rec;
+    int ret;
+
+    uint64_t start_us = player_now_us() + MIDI_PLAYER_START_DELAY_MS * 1000;
+    uint64_t at_us = start_us;
+    uint32_t song_us = from_us;
+    uint16_t bpm = atomic_get(&player_target_bpm);
+
+    k_spinlock_key_t key = k_spin_lock(&player_stats_lock);
+    player_warp = (player_warp_t){ from_us, start_us, player_stretch(bpm) };
+    player_stats.song_tempo_us = player_song_tempo_us;
+    player_stats.stretch_q16 = player_warp.stretch_q16;
+    k_spin_unlock(&player_stats_lock, key);
+
+    ret = player_replay_state(start_us);
+    if (ret) {
+        return ret;
+    }
+
+    while ((ret = midi_prefetch_next(&rec)) == 1) {
+        // A new tempo bends the timeline at the last event handed over, so
+        // nothing already queued moves and the next event is the first to change
+        if (atomic_get(&player_target_bpm) != bpm) {
+            bpm = atomic_get(&player_target_bpm);
+            key = k_spin_lock(&player_stats_lock);
+            player_warp = (player_warp_t){ song_us, at_us, player_stretch(bpm) };
+            player_stats.stretch_q16 = player_warp.stretch_q16;
+            k_spin_unlock(&player_stats_lock, key);
+        }
+
+        // Only this thread writes the warp, so reading it needs no lock
+        song_us = rec.time_us;
+        at_us = player_warp_to_wall(&player_warp, song_us);
+
+        if (player_wait_until(at_us - MIDI_PLAYER_LOOKAHEAD_MS * 1000)) {
+            return 0;
+        }
+
+        while ((ret = player_sched(at_us, rec.status, rec.data1, rec.data2)) == -ENOMEM) {
+            key = k_spin_lock(&player_stats_lock);
+            player_stats.sched_full++;
+            k_spin_unlock(&player_stats_lock, key);
+            if (player_wait_until(player_now_us() + MIDI_PLAYER_RETRY_MS * 1000)) {
+                return 0;
+            }
+        }
+        if (ret) {
+            return ret;
+        }
+
+        key = k_spin_lock(&player_stats_lock);
+        player_stats.events++;
+        player_stats.position_ms = rec.time_us / 1000;
+        k_spin_unlock(&player_stats_lock, key);
+    }
+    if (ret == -ECANCELED) {
+        return 0;
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Still playing until the last event has gone out
+    player_wait_until(at_us);
+    return 0;
+}
+
+static void midi_player_thread(void *p1, void *p2, void *p3)
+{
+    char path[MIDI_PLAYER_PATH_LEN];
+
+    while (1) {
+        k_sem_take(&player_start_sem, K_FOREVER);
+
+        k_mutex_lock(&player_mutex, K_FOREVER);
+        strcpy(path, player_path);
+        uint32_t from_ms = player_from_ms;
+        k_mutex_unlock(&player_mutex);
+
+        k_spinlock_key_t key = k_spin_lock(&player_stats_lock);
+        player_stats = (midi_player_stats_t){ .playing = true };
+        k_spin_unlock(&player_stats_lock, key);
+
+        int ret = player_open(path);
+        if (ret == 0) {
+            // Only this thread writes the stats, so reading them needs no lock
+            LOG_INF("Playing %s (%s, %d tracks) from %u ms", path,
+                    player_cached ? "cached" : "live merge", player_stats.ntracks, from_ms);
+
+            ret = player_seek(path, from_ms * 1000);
+            if (ret == 0) {
+                // Storage is read on the prefetch thread from here on
+                midi_prefetch_start(player_source);
+                ret = player_run(from_ms * 1000);
+                midi_prefetch_stop();
+            }
+            key = k_spin_lock(&player_stats_lock);
+            player_stats.reads = player_file.reads;
+            k_spin_unlock(&player_stats_lock, key);
+            smf_sd_close(&player_file);
+        }
+
+        if (ret || atomic_get(&player_stop_req)) {
+            // Drop what is still queued (its Note Offs go out now) and end the
+            // player's own notes; global cleanup is for panic paths
+            midi_sched_cancel(MIDI_SCHED_TAG_PLAYER);
+            player_release();
+        }
+        if (ret) {
+            LOG_ERR("Playback of %s failed: %d", path, ret);
+        }
+
+        key = k_spin_lock(&player_stats_lock);
+        player_stats.playing = false;
+        player_stats.last_error = ret;
+        k_spin_unlock(&player_stats_lock, key);
+
+        atomic_clear(&player_busy);
+        k_sem_give(&player_done_sem);
+    }
+}
+
+int midi_player_init(void)
+{
+    int ret = midi_prefetch_init();
+    if (ret) {
+        return ret;
+    }
+
+    k_tid_t tid = k_thread_create(&midi_player_thread_data, midi_player_stack,
+                                  K_THREAD_STACK_SIZEOF(midi_player_stack),
+                                  midi_player_thread, NULL, NULL, NULL,
+                                  MIDI_PLAYER_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start MIDI player thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "midi_player");
+
+    LOG_INF("MIDI player ready (%d tracks, %d byte buffer budget)",
+            MAX_MIDI_TRACKS, MIDI_TRACK_BUFFER_BUDGET);
+    return 0;
+}
+
+int midi_player_play_from(const char *mid_path, uint32_t start_ms)
+{
+    if (strlen(mid_path) >= sizeof(player_path)) {
+        return -ENAMETOOLONG;
+    }
+
+    midi_player_stop();
+
+    k_mutex_lock(&player_mutex, K_FOREVER);
+    if (mid_path != player_path) {
+        strcpy(player_path, mid_path);
+    }
+    player_from_ms = start_ms;
+    player_paused = false;
+    k_mutex_unlock(&player_mutex);
+
+    atomic_clear(&player_stop_req);
+    k_sem_reset(&player_wake_sem);
+    k_sem_reset(&player_done_sem);
+    atomic_set(&player_busy, 1);
+    k_sem_give(&player_start_sem);
+
+    return 0;
+}
+
+int midi_player_play(const char *mid_path)
+{
+    return midi_player_play_from(mid_path, 0);
+}
+
+uint32_t midi_player_position_ms(void)
+{
+    if (!atomic_get(&player_busy)) {
+        return player_paused ? player_resume_ms : 0;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&player_stats_lock);
+    player_warp_t w = player_warp;
+    k_spin_unlock(&player_stats_lock, key);
+
+    // Inverse of the warp; the anchor can be ahead of now by the lookahead
+    int64_t wall = (int64_t)(player_now_us() - w.wall_us);
+    int64_t song = (int64_t)w.song_us + (wall * MIDI_PLAYER_Q16_ONE) / w.stretch_q16;
+    return song > 0 ? (uint32_t)(song / 1000) : 0;
+}
+
+void midi_player_pause(void)
+{
+    if (!atomic_get(&player_busy)) {
+        return;
+    }
+
+    uint32_t pos = midi_player_position_ms();
+    midi_player_stop();
+
+    k_mutex_lock(&player_mutex, K_FOREVER);
+    player_resume_ms = pos;
+    player_paused = true;
+    k_mutex_unlock(&player_mutex);
+
+    LOG_INF("Paused at %u ms", pos);
+}
+
+int midi_player_resume(void)
+{
+    if (!player_paused) {
+        return -ENOENT;
+    }
+    return midi_player_play_from(player_path, player_resume_ms);
+}
+
+int midi_player_seek(uint32_t ms)
+{
+    if (player_path[0] == '\0') {
+        return -ENOENT;
+    }
+    return midi_player_play_from(player_path, ms);
+}
+
+void midi_player_stop(void)
+{
+    player_paused = false;
+
+    // A second caller waits here and then finds the player idle, rather than
+    // waiting forever for a done signal the first caller already took
+    k_mutex_lock(&player_stop_mutex, K_FOREVER);
+    if (atomic_get(&player_busy)) {
+        atomic_set(&player_stop_req, 1);
+        k_sem_give(&player_wake_sem);
+        midi_prefetch_abort();
+        k_sem_take(&player_done_sem, K_FOREVER);
+    }
+    k_mutex_unlock(&player_stop_mutex);
+}
+
+bool midi_player_is_playing(void)
+{
+    return atomic_get(&player_busy);
+}
+
+void midi_player_set_tempo(uint16_t bpm)
+{
+    atomic_set(&player_target_bpm, bpm);
+}
+
+int midi_player_song_tempo(const char *mid_path, uint16_t *bpm)
+{
+    char smc_path[SMC_CACHE_PATH_LEN];
+    smc_header_t hdr;
+    smf_file_t smf;
+    tempo_segment_t seg[1];
+    tempo_map_t map;
+
+    // A current cache already knows
+    if (smc_cache_lookup(mid_path, smc_path, sizeof(smc_path), &hdr) == 0) {
+        *bpm = (TEMPO_MAP_US_PER_MIN + hdr.initial_tempo_us / 2) / hdr.initial_tempo_us;
+        return 0;
+    }
+
+    k_mutex_lock(&player_info_mutex, K_FOREVER);
+
+    int ret = smf_sd_open(&player_info_file, mid_path);
+    if (ret == 0) {
+        ret = smf_open(&smf, &player_info_file.io);
+        if (ret == 0) {
+            // Only the opening tempo is wanted, later changes don't fit and are dropped
+            tempo_map_init(&map, seg, ARRAY_SIZE(seg), smf.division);
+            ret = tempo_map_build(&map, &smf, player_info_buf, sizeof(player_info_buf));
+        }
+        smf_sd_close(&player_info_file);
+    }
+    if (ret == 0) {
+        *bpm = tempo_map_bpm_at(&map, 0);
+    }
+
+    k_mutex_unlock(&player_info_mutex);
+    return ret;
+}
+
+void midi_player_get_stats(midi_player_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&player_stats_lock);
+    *stats = player_stats;
+    k_spin_unlock(&player_stats_lock, key);
+}
+
+#ifdef CONFIG_SHELL
+
+static int cmd_player_play(const struct shell *sh, size_t argc, char **argv)
+{
+    char path[MIDI_PLAYER_PATH_LEN];
+    int track = atoi(argv[1]);
+
+    if (get_track_file_name(track, path, sizeof(path)) != 0) {
+        shell_error(sh, "No track %d (%d found)", track, get_track_count());
+        return -EINVAL;
+    }
+
+    return midi_player_play(path);
+}
+
+static int cmd_player_pause(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_player_pause();
+    return 0;
+}
+
+static int cmd_player_resume(const struct shell *sh, size_t argc, char **argv)
+{
+    return midi_player_resume();
+}
+
+static int cmd_player_seek(const struct shell *sh, size_t argc, char **argv)
+{
+    return midi_player_seek(strtoul(argv[1], NULL, 10));
+}
+
+static int cmd_player_tempo(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_player_set_tempo(strtoul(argv[1], NULL, 10));
+    return 0;
+}
+
+static int cmd_player_stop(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_player_stop();
+    return 0;
+}
+
+static int cmd_player_status(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_player_stats_t stats;
+    midi_prefetch_stats_t pf;
+
+    midi_player_get_stats(&stats);
+    midi_prefetch_get_stats(&pf);
+    shell_print(sh, "%s, %s, %d tracks", stats.playing ? "playing" : "stopped",
+                stats.cached ? "cached" : "live merge", stats.ntracks);
+    shell_print(sh, "at %u ms, queued to %u/%u ms, %u events, %u reads, scheduler full %u, last error %d",
+                midi_player_position_ms(), stats.position_ms, stats.duration_ms, stats.events, stats.reads, stats.sched_full, stats.last_error);
+    uint32_t speed = stats.stretch_q16 ? (uint64_t)MIDI_PLAYER_Q16_ONE * 1000 / stats.stretch_q16 : 1000;
+    shell_print(sh, "written at %u BPM, playing at %u.%03ux",
+                stats.song_tempo_us ? TEMPO_MAP_US_PER_MIN / stats.song_tempo_us : 0,
+                speed / 1000, speed % 1000);
+    shell_print(sh, "prefetch %u ms ahead, %u/%d blocks ready (low %u), %u underruns, %u blocks, slowest fill %u us",
+                pf.ahead_ms, pf.blocks_full, MIDI_PREFETCH_BLOCKS, pf.low_water, pf.underruns, pf.blocks, pf.max_fill_us);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_player,
+    SHELL_CMD_ARG(play, NULL, "Play track <n> from the card", cmd_player_play, 2, 0),
+    SHELL_CMD(pause, NULL, "Pause, remembering the position", cmd_player_pause),
+    SHELL_CMD(resume, NULL, "Continue from where pause left off", cmd_player_resume),
+    SHELL_CMD_ARG(seek, NULL, "Restart the song at <ms>", cmd_player_seek, 2, 0),
+    SHELL_CMD_ARG(tempo, NULL, "Play at <bpm>, 0 as written", cmd_player_tempo, 2, 0),
+    SHELL_CMD(stop, NULL, "Stop playback", cmd_player_stop),
+    SHELL_CMD(status, NULL, "Playback counters", cmd_player_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(player, &sub_player, "Song player", NULL);
+
+#endif // CONFIG_SHELL
@@ -0,0 +1,120 @@
+#ifndef MIDI_PLAYER_H
+#define MIDI_PLAYER_H
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+#define MIDI_PLAYER_STACK_SIZE      2048
+#define MIDI_PLAYER_PRIORITY        6
+// How far ahead of the audio events are handed to the scheduler
+#define MIDI_PLAYER_LOOKAHEAD_MS    50
+// Head start so the first events aren't late while the first batch is queued
+#define MIDI_PLAYER_START_DELAY_MS  20
+// Back-off while the scheduler queue is full
+#define MIDI_PLAYER_RETRY_MS        5
+#define MIDI_PLAYER_PATH_LEN        64
+// Live tempo ratios are Q16.16; the furthest a song may be slowed down or sped up
+#define MIDI_PLAYER_Q16_ONE         (1 << 16)
+#define MIDI_PLAYER_MAX_STRETCH     8
+
+// Playback counters for the current (or last) song
+typedef struct {
+    bool playing;
+    bool cached;            // playing a precompiled .smc rather than merging live
+    uint8_t ntracks;
+    uint32_t events;        // events handed to the scheduler
+    uint32_t position_ms;   // song time of the last event handed over
+    uint32_t duration_ms;   // length of the song
+    uint32_t reads;         // storage reads
+    uint32_t sched_full;    // times the scheduler queue was full
+    uint32_t song_tempo_us; // opening tempo of the file
+    uint32_t stretch_q16;   // real time per song time now, MIDI_PLAYER_Q16_ONE as written
+    int last_error;
+} midi_player_stats_t;
+
+/**
+ * @brief Start the player thread
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_player_init(void);
+
+/**
+ * @brief Play a song, stopping whatever is playing first
+ *
+ * A current .smc cache is played when there is one, otherwise the .mid is
+ * merged track by track as it plays.
+ *
+ * @param mid_path Path of the .mid (e.g. "SD:/MIDI/1_TRACK.mid")
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_player_play(const char *mid_path);
+
+/**
+ * @brief Play a song starting @p start_ms into it
+ *
+ * Jumps to the nearest keyframe of the song's .smk index, when it has a
+ * current one, and catches up from there without sounding anything; the
+ * programs, volumes and held notes in effect at @p start_ms are replayed
+ * before the first event.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_player_play_from(const char *mid_path, uint32_t start_ms);
+
+/**
+ * @brief Stop playback, remembering where it got to for midi_player_resume()
+ */
+void midi_player_pause(void);
+
+/**
+ * @brief Continue a paused song from where it stopped
+ *
+ * @return int 0 on success, -ENOENT if nothing is paused
+ */
+int midi_player_resume(void);
+
+/**
+ * @brief Restart the current (or last) song at @p ms
+ *
+ * @return int 0 on success, -ENOENT if nothing was played yet
+ */
+int midi_player_seek(uint32_t ms);
+
+/**
+ * @brief Song time that is sounding now (or where the song was paused)
+ */
+uint32_t midi_player_position_ms(void);
+
+/**
+ * @brief Stop playback and end the notes and sustain it left on
+ */
+void midi_player_stop(void);
+
+bool midi_player_is_playing(void);
+
+/**
+ * @brief Play at @p bpm instead of the song's own opening tempo
+ *
+ * The ratio of @p bpm to the opening tempo scales the whole song, tempo
+ * changes included. It takes effect from the next event handed to the
+ * scheduler, so events already queued keep their times, and it carries
+ * over to the songs played after.
+ *
+ * @param bpm Tempo to play at, 0 to play as written
+ */
+void midi_player_set_tempo(uint16_t bpm);
+
+/**
+ * @brief Opening tempo of a song, without playing it
+ *
+ * Taken from the song's cache when it has a current one, otherwise from a
+ * scan of its Set Tempo events.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_player_song_tempo(const char *mid_path, uint16_t *bpm);
+
+void midi_player_get_stats(midi_player_stats_t *stats);
+
+#endif // MIDI_PLAYER_H
@@ -0,0 +1,250 @@
+// midi_prefetch.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/atomic.h>
+#include <errno.h>
+#include <string.h>
+
+#include "midi_prefetch.h"
+
+LOG_MODULE_REGISTER(midi_prefetch, LOG_LEVEL_INF);
+
+typedef struct {
+    smc_record_t rec[MIDI_PREFETCH_BLOCK_RECORDS];
+    uint16_t count;
+    bool last;              // the song ends after this block
+    int end;                // what the source returned at the end: 0, or an error
+} prefetch_block_t;
+
+K_THREAD_STACK_DEFINE(midi_prefetch_stack, MIDI_PREFETCH_STACK_SIZE);
+static struct k_thread midi_prefetch_thread_data;
+
+static prefetch_block_t pf_blocks[MIDI_PREFETCH_BLOCKS];
+// Bounded buffer: producer takes free, gives full; player the other way round
+static K_SEM_DEFINE(pf_free_sem, MIDI_PREFETCH_BLOCKS, MIDI_PREFETCH_BLOCKS);
+static K_SEM_DEFINE(pf_full_sem, 0, MIDI_PREFETCH_BLOCKS);
+static K_SEM_DEFINE(pf_start_sem, 0, 1);
+static K_SEM_DEFINE(pf_idle_sem, 0, 1);
+// Given by the player as it moves on, so a producer that is far enough ahead re-checks
+static K_SEM_DEFINE(pf_progress_sem, 0, 1);
+
+static midi_prefetch_source_fn pf_source;
+static atomic_t pf_abort;
+static atomic_t pf_running;
+
+// Producer side
+static uint8_t pf_fill_idx;
+static uint32_t pf_produced_us;     // song time of the newest decoded event
+
+// Player side
+static uint8_t pf_drain_idx;
+static uint16_t pf_drain_pos;
+static bool pf_draining;
+static uint32_t pf_consumed_us;     // song time of the newest event handed to the player
+static bool pf_ended;
+static int pf_end_ret;
+
+static struct k_spinlock pf_stats_lock;
+static midi_prefetch_stats_t pf_stats;
+
+static uint32_t pf_ahead_us(void)
+{
+    uint32_t produced = pf_produced_us;
+    uint32_t consumed = pf_consumed_us;
+
+    return produced > consumed ? produced - consumed : 0;
+}
+
+// Fill one block; false once the song has ended or failed
+static bool prefetch_fill(prefetch_block_t *blk)
+{
+    uint32_t start = k_cycle_get_32();
+    int ret = 1;
+
+    blk->count = 0;
+    blk->last = false;
+    blk->end = 0;
+
+    while (blk->count < MIDI_PREFETCH_BLOCK_RECORDS) {
+        ret = pf_source(&blk->rec[blk->count]);
+        if (ret != 1) {
+            blk->last = true;
+            blk->end = ret;
+            break;
+        }
+        pf_produced_us = blk->rec[blk->count].time_us;
+        blk->count++;
+    }
+
+    uint32_t fill_us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    k_spinlock_key_t key = k_spin_lock(&pf_stats_lock);
+    pf_stats.blocks++;
+    if (fill_us > pf_stats.max_fill_us) {
+        pf_stats.max_fill_us = fill_us;
+    }
+    k_spin_unlock(&pf_stats_lock, key);
+
+    return !blk->last;
+}
+
+static void midi_prefetch_thread(void *p1, void *p2, void *p3)
+{
+    while (1) {
+        k_sem_take(&pf_start_sem, K_FOREVER);
+
+        bool more = true;
+        while (more && !atomic_get(&pf_abort)) {
+            // Far enough ahead: wait for the player to catch up a bit
+            if (pf_ahead_us() > MIDI_PREFETCH_LOOKAHEAD_MS * 1000) {
+                k_sem_take(&pf_progress_sem, K_MSEC(MIDI_PREFETCH_IDLE_MS));
+                continue;
+            }
+
+            if (k_sem_take(&pf_free_sem, K_MSEC(MIDI_PREFETCH_IDLE_MS)) != 0) {
+                continue;
+            }
+            if (atomic_get(&pf_abort)) {
+                k_sem_give(&pf_free_sem);
+                break;
+            }
+
+            more = prefetch_fill(&pf_blocks[pf_fill_idx]);
+            pf_fill_idx = (pf_fill_idx + 1) % MIDI_PREFETCH_BLOCKS;
+            k_sem_give(&pf_full_sem);
+        }
+
+        atomic_clear(&pf_running);
+        k_sem_give(&pf_idle_sem);
+    }
+}
+
+int midi_prefetch_init(void)
+{
+    k_tid_t tid = k_thread_create(&midi_prefetch_thread_data, midi_prefetch_stack,
+                                  K_THREAD_STACK_SIZEOF(midi_prefetch_stack),
+                                  midi_prefetch_thread, NULL, NULL, NULL,
+                                  MIDI_PREFETCH_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start MIDI prefetch thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "midi_prefetch");
+
+    LOG_INF("MIDI prefetch ready (%d x %d events, %d ms ahead)", MIDI_PREFETCH_BLOCKS,
+            MIDI_PREFETCH_BLOCK_RECORDS, MIDI_PREFETCH_LOOKAHEAD_MS);
+    return 0;
+}
+
+void midi_prefetch_start(midi_prefetch_source_fn source)
+{
+    k_sem_reset(&pf_full_sem);
+    k_sem_reset(&pf_free_sem);
+    for (int i = 0; i < MIDI_PREFETCH_BLOCKS; i++) {
+        k_sem_give(&pf_free_sem);
+    }
+    k_sem_reset(&pf_idle_sem);
+    k_sem_reset(&pf_progress_sem);
+
+    pf_source = source;
+    pf_fill_idx = 0;
+    pf_drain_idx = 0;
+    pf_drain_pos = 0;
+    pf_draining = false;
+    pf_produced_us = 0;
+    pf_consumed_us = 0;
+    pf_ended = false;
+    pf_end_ret = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&pf_stats_lock);
+    pf_stats = (midi_prefetch_stats_t){ .low_water = MIDI_PREFETCH_BLOCKS };
+    k_spin_unlock(&pf_stats_lock, key);
+
+    atomic_clear(&pf_abort);
+    atomic_set(&pf_running, 1);
+    k_sem_give(&pf_start_sem);
+}
+
+int midi_prefetch_next(smc_record_t *rec)
+{
+    while (1) {
+        if (atomic_get(&pf_abort)) {
+            return -ECANCELED;
+        }
+        if (pf_ended) {
+            return pf_end_ret;
+        }
+
+        if (!pf_draining) {
+            unsigned int ready = k_sem_count_get(&pf_full_sem);
+            if (ready == 0) {
+                // Nothing decoded: storage has fallen behind the music
+                k_spinlock_key_t key = k_spin_lock(&pf_stats_lock);
+                if (pf_stats.blocks > 0) {
+                    pf_stats.underruns++;
+                }
+                k_spin_unlock(&pf_stats_lock, key);
+
+                k_sem_take(&pf_full_sem, K_FOREVER);
+                if (atomic_get(&pf_abort)) {
+                    return -ECANCELED;
+                }
+            } else {
+                k_sem_take(&pf_full_sem, K_NO_WAIT);
+            }
+            pf_draining = true;
+            pf_drain_pos = 0;
+
+            k_spinlock_key_t key = k_spin_lock(&pf_stats_lock);
+            if (ready < pf_stats.low_water) {
+                pf_stats.low_water = ready;
+            }
+            k_spin_unlock(&pf_stats_lock, key);
+        }
+
+        prefetch_block_t *blk = &pf_blocks[pf_drain_idx];
+        if (pf_drain_pos < blk->count) {
+            *rec = blk->rec[pf_drain_pos++];
+            pf_consumed_us = rec->time_us;
+            if (pf_drain_pos % (MIDI_PREFETCH_BLOCK_RECORDS / 4) == 0) {
+                k_sem_give(&pf_progress_sem);
+            }
+            return 1;
+        }
+
+        // Block used up, hand it back
+        if (blk->last) {
+            pf_ended = true;
+            pf_end_ret = blk->end;
+        }
+        pf_draining = false;
+        pf_drain_idx = (pf_drain_idx + 1) % MIDI_PREFETCH_BLOCKS;
+        k_sem_give(&pf_free_sem);
+        k_sem_give(&pf_progress_sem);
+    }
+}
+
+void midi_prefetch_abort(void)
+{
+    atomic_set(&pf_abort, 1);
+    k_sem_give(&pf_full_sem);
+}
+
+void midi_prefetch_stop(void)
+{
+    atomic_set(&pf_abort, 1);
+    k_sem_give(&pf_progress_sem);
+
+    if (atomic_get(&pf_running)) {
+        k_sem_take(&pf_idle_sem, K_FOREVER);
+    }
+}
+
+void midi_prefetch_get_stats(midi_prefetch_stats_t *stats)
+{
+    k_spinlock_key_t key = k_spin_lock(&pf_stats_lock);
+    *stats = pf_stats;
+    k_spin_unlock(&pf_stats_lock, key);
+
+    stats->blocks_full = k_sem_count_get(&pf_full_sem);
+    stats->ahead_ms = pf_ahead_us() / 1000;
+}
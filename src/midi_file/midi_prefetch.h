@@ -0,0 +1,71 @@
+#ifndef MIDI_PREFETCH_H
+#define MIDI_PREFETCH_H
+
+#include <zephyr/types.h>
+#include <zephyr/kernel.h>
+
+#include "smc_format.h"
+
+// Read-ahead blocks; the player drains one while storage fills the others
+#define MIDI_PREFETCH_BLOCKS        4
+#define MIDI_PREFETCH_BLOCK_RECORDS 64
+// Music kept decoded ahead of the player, enough to ride out an SD card stall
+#define MIDI_PREFETCH_LOOKAHEAD_MS  500
+#define MIDI_PREFETCH_STACK_SIZE    2048
+// Below the player, so reading never delays dispatch
+#define MIDI_PREFETCH_PRIORITY      7
+// How often a producer that is far enough ahead re-checks
+#define MIDI_PREFETCH_IDLE_MS       20
+
+/**
+ * @brief Where the producer gets events from; runs on the prefetch thread
+ *
+ * @return int 1 with @p rec filled in, 0 at the end, negative error code otherwise
+ */
+typedef int (*midi_prefetch_source_fn)(smc_record_t *rec);
+
+typedef struct {
+    uint8_t blocks_full;    // blocks ready for the player now
+    uint8_t low_water;      // fewest ready blocks the player has seen since start
+    uint32_t ahead_ms;      // music decoded ahead of the player now
+    uint32_t underruns;     // times the player had to wait for storage
+    uint32_t blocks;        // blocks filled since start
+    uint32_t max_fill_us;   // slowest block fill, i.e. the worst storage stall
+} midi_prefetch_stats_t;
+
+/**
+ * @brief Start the prefetch thread
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_prefetch_init(void);
+
+/**
+ * @brief Start reading ahead from @p source
+ *
+ * The source must be positioned where playback starts; the previous
+ * session must have been ended with midi_prefetch_stop().
+ */
+void midi_prefetch_start(midi_prefetch_source_fn source);
+
+/**
+ * @brief Player side: take the next event
+ *
+ * @return int 1 with @p rec filled in, 0 at the end of the song, -ECANCELED
+ *         after midi_prefetch_abort(), negative source error otherwise
+ */
+int midi_prefetch_next(smc_record_t *rec);
+
+/**
+ * @brief Wake a player blocked in midi_prefetch_next() (stop requested)
+ */
+void midi_prefetch_abort(void);
+
+/**
+ * @brief End the session and wait until the producer has let go of the source
+ */
+void midi_prefetch_stop(void);
+
+void midi_prefetch_get_stats(midi_prefetch_stats_t *stats);
+
+#endif // MIDI_PREFETCH_H
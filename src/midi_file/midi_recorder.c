@@ -0,0 +1,478 @@
+// midi_recorder.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/byteorder.h>
+#include <ff.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "midi_recorder.h"
+#include "spsc_ring.h"
+#include "smf_parser.h"
+#include "hw_interface/VS1053_interface/midi.h"
+#include "hw_interface/sd_card_interface/sd_file_pool.h"
+#include "hw_interface/sd_card_interface/sd_manager.h"
+
+LOG_MODULE_REGISTER(midi_recorder, LOG_LEVEL_INF);
+
+// Ring entry: capture time in ms (le32), length, then the group's bytes
+#define REC_ENTRY_HEADER    5
+#define REC_ENTRY_MAX       (REC_ENTRY_HEADER + MIDI_TX_GROUP_SIZE)
+
+// One tick per ms: 500 ticks per quarter at 120 BPM
+#define REC_DIVISION        500
+#define REC_TEMPO_US        500000
+// Where the MTrk length goes, patched when the recording ends
+#define REC_MTRK_LEN_OFFSET 18
+#define REC_HEADER_SIZE     22
+
+K_THREAD_STACK_DEFINE(midi_recorder_stack, MIDI_RECORDER_STACK_SIZE);
+static struct k_thread midi_recorder_thread_data;
+
+// Producer is the tap (serialized by the MIDI send lock), consumer the writer
+static spsc_ring_t rec_ring;
+static uint8_t rec_ring_buf[MIDI_RECORDER_RING_SIZE];
+static atomic_t rec_armed;
+static atomic_t rec_state;
+static atomic_t rec_dropped;
+static uint32_t rec_start_ms;       // set before the tap is armed
+
+static K_SEM_DEFINE(rec_start_sem, 0, 1);
+static K_SEM_DEFINE(rec_stop_sem, 0, 1);
+
+// Writer thread only
+static int rec_file = -1;
+static uint8_t rec_buf[MIDI_RECORDER_WRITE_SIZE];
+static uint32_t rec_buf_len;
+static uint32_t rec_file_len;       // bytes already appended to the file
+static uint32_t rec_last_ms;        // time of the last event written
+static uint8_t rec_running_status;
+static uint32_t rec_notes[16][128 / 32];
+static uint16_t rec_next_number = 1;
+
+// Written by the writer, read by the shell
+static K_MUTEX_DEFINE(rec_stats_mutex);
+static midi_recorder_stats_t rec_stats;
+
+void midi_recorder_tap(const uint8_t *buf, uint8_t len)
+{
+    uint8_t entry[REC_ENTRY_MAX];
+
+    if (!atomic_get(&rec_armed)) {
+        return;
+    }
+    if (len == 0 || len > MIDI_TX_GROUP_SIZE) {
+        atomic_inc(&rec_dropped);
+        return;
+    }
+
+    sys_put_le32(k_uptime_get_32(), entry);
+    entry[4] = len;
+    memcpy(&entry[REC_ENTRY_HEADER], buf, len);
+
+    // One put per group, so the writer never sees half an entry
+    if (spsc_ring_put(&rec_ring, entry, REC_ENTRY_HEADER + len) != 0) {
+        atomic_inc(&rec_dropped);
+    }
+}
+
+static void rec_update_stats(void)
+{
+    k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+    rec_stats.bytes = rec_file_len + rec_buf_len;
+    rec_stats.duration_ms = rec_last_ms;
+    rec_stats.dropped = atomic_get(&rec_dropped);
+    rec_stats.ring_high_water = rec_ring.high_water;
+    k_mutex_unlock(&rec_stats_mutex);
+}
+
+static void rec_set_error(int err)
+{
+    k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+    rec_stats.error = err;
+    k_mutex_unlock(&rec_stats_mutex);
+}
+
+// Append the full buffer; after an error bytes are still counted but go nowhere
+static void rec_flush(void)
+{
+    if (rec_buf_len == 0) {
+        return;
+    }
+
+    if (rec_stats.error == 0) {
+        uint32_t start = k_cycle_get_32();
+        int ret = sd_file_write(rec_file, rec_buf, rec_buf_len);
+        uint32_t us = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+
+        if (ret < 0) {
+            LOG_ERR("Recording write failed: %d", ret);
+            rec_set_error(ret);
+        } else {
+            k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+            rec_stats.writes++;
+            rec_stats.max_write_us = MAX(rec_stats.max_write_us, us);
+            k_mutex_unlock(&rec_stats_mutex);
+        }
+    }
+
+    rec_file_len += rec_buf_len;
+    rec_buf_len = 0;
+}
+
+static void rec_put(const uint8_t *data, uint32_t len)
+{
+    while (len > 0) {
+        uint32_t n = MIN(len, sizeof(rec_buf) - rec_buf_len);
+
+        memcpy(&rec_buf[rec_buf_len], data, n);
+        rec_buf_len += n;
+        data += n;
+        len -= n;
+
+        if (rec_buf_len == sizeof(rec_buf)) {
+            rec_flush();
+        }
+    }
+}
+
+static void rec_put_delta(uint32_t time_ms)
+{
+    uint8_t vlq[5];
+    uint8_t n = 0;
+    uint32_t delta = time_ms > rec_last_ms ? time_ms - rec_last_ms : 0;
+
+    // Variable-length quantity, most significant group first
+    vlq[4] = delta & 0x7F;
+    for (delta >>= 7; delta > 0; delta >>= 7) {
+        vlq[3 - n++] = 0x80 | (delta & 0x7F);
+    }
+    rec_put(&vlq[4 - n], n + 1);
+
+    if (time_ms > rec_last_ms) {
+        rec_last_ms = time_ms;
+    }
+}
+
+static void rec_put_message(uint32_t time_ms, const uint8_t *msg, uint8_t len)
+{
+    uint8_t status = msg[0];
+    uint8_t chan = status & 0x0F;
+    uint8_t note = msg[1];
+
+    rec_put_delta(time_ms);
+    if (status != rec_running_status) {
+        rec_put(&status, 1);
+        rec_running_status = status;
+    }
+    rec_put(&msg[1], len - 1);
+
+    switch (status & 0xF0) {
+        case note_on:
+            if (msg[2] != 0) {
+                rec_notes[chan][note / 32] |= BIT(note % 32);
+                break;
+            }
+            // Velocity 0 is a Note Off, fall through
+        case note_off:
+            rec_notes[chan][note / 32] &= ~BIT(note % 32);
+            break;
+        default:
+            break;
+    }
+
+    k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+    rec_stats.events++;
+    k_mutex_unlock(&rec_stats_mutex);
+}
+
+// Turn one captured group into SMF events
+static void rec_put_group(uint32_t capture_ms, const uint8_t *buf, uint8_t len)
+{
+    // Groups captured just before the start count as at the start
+    int32_t since_start = (int32_t)(capture_ms - rec_start_ms);
+    uint32_t time_ms = since_start > 0 ? (uint32_t)since_start : 0;
+
+    for (uint8_t i = 0; i < len; ) {
+        uint8_t msg_len = midi_msg_length(buf[i]);
+
+        if (msg_len == 0 || i + msg_len > len) {
+            // Not a message we built, the rest of the group can't be trusted
+            break;
+        }
+        // System messages have no place in a song file
+        if (buf[i] < 0xF0) {
+            rec_put_message(time_ms, &buf[i], msg_len);
+        }
+        i += msg_len;
+    }
+}
+
+static void rec_drain(void)
+{
+    uint8_t entry[REC_ENTRY_MAX];
+
+    while (spsc_ring_get(&rec_ring, entry, REC_ENTRY_HEADER) == REC_ENTRY_HEADER) {
+        uint8_t len = entry[4];
+
+        spsc_ring_get(&rec_ring, &entry[REC_ENTRY_HEADER], len);
+        rec_put_group(sys_get_le32(entry), &entry[REC_ENTRY_HEADER], len);
+    }
+
+    rec_update_stats();
+}
+
+static int rec_open(void)
+{
+    char path[sizeof(rec_stats.path)];
+
+    for (; rec_next_number <= MIDI_RECORDER_MAX_FILES; rec_next_number++) {
+        snprintf(path, sizeof(path), "%s/REC_%03u.mid", MIDI_RECORDER_DIR, rec_next_number);
+
+        int file = sd_file_open(path, FA_READ);
+        if (file >= 0) {
+            sd_file_close(file);
+            continue;
+        }
+        if (file != -ENOENT) {
+            return file;
+        }
+
+        file = sd_file_open(path, FA_WRITE | FA_CREATE_NEW);
+        if (file < 0) {
+            return file;
+        }
+
+        rec_next_number++;
+        k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+        strcpy(rec_stats.path, path);
+        k_mutex_unlock(&rec_stats_mutex);
+        return file;
+    }
+
+    return -ENOSPC;
+}
+
+static void rec_put_header(void)
+{
+    static const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        0, 0,                                   // format 0
+        0, 1,                                   // one track
+        REC_DIVISION >> 8, REC_DIVISION & 0xFF,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0,         // length patched at the end
+        0, 0xFF, SMF_META_TEMPO, 3,
+        (REC_TEMPO_US >> 16) & 0xFF, (REC_TEMPO_US >> 8) & 0xFF, REC_TEMPO_US & 0xFF,
+    };
+
+    rec_put(header, sizeof(header));
+}
+
+// Release anything the performance left sounding, end the track and fix its length
+static int rec_finish(void)
+{
+    uint8_t msg[3];
+
+    for (uint8_t chan = 0; chan < 16; chan++) {
+        for (uint8_t note = 0; note < 128; note++) {
+            if (rec_notes[chan][note / 32] & BIT(note % 32)) {
+                msg[0] = note_off | chan;
+                msg[1] = note;
+                msg[2] = 0;
+                rec_put_message(rec_last_ms, msg, sizeof(msg));
+            }
+        }
+    }
+
+    static const uint8_t eot[] = { 0, 0xFF, SMF_META_END_OF_TRACK, 0 };
+    rec_put(eot, sizeof(eot));
+    rec_flush();
+    rec_update_stats();
+
+    int ret = rec_stats.error;
+    if (ret == 0) {
+        uint8_t len[4];
+        sys_put_be32(rec_file_len - REC_HEADER_SIZE, len);
+        ret = sd_file_seek(rec_file, REC_MTRK_LEN_OFFSET);
+        if (ret == 0) {
+            ret = sd_file_write(rec_file, len, sizeof(len));
+        }
+    }
+
+    int err = sd_file_close(rec_file);
+    rec_file = -1;
+    return ret < 0 ? ret : err;
+}
+
+static void rec_session(void)
+{
+    rec_buf_len = 0;
+    rec_file_len = 0;
+    rec_last_ms = 0;
+    rec_running_status = 0;
+    memset(rec_notes, 0, sizeof(rec_notes));
+
+    rec_file = rec_open();
+    if (rec_file < 0) {
+        LOG_ERR("Can't create a recording file: %d", rec_file);
+        rec_set_error(rec_file);
+        rec_file = -1;
+        atomic_set(&rec_armed, 0);
+        atomic_set(&rec_state, MIDI_RECORDER_FINISHING);
+        spsc_ring_discard(&rec_ring);
+        return;
+    }
+
+    LOG_INF("Recording to %s", rec_stats.path);
+    rec_put_header();
+
+    while (atomic_get(&rec_armed)) {
+        rec_drain();
+        k_sem_take(&rec_stop_sem, K_MSEC(MIDI_RECORDER_POLL_MS));
+    }
+    // Whatever was captured before the tap was disarmed
+    rec_drain();
+
+    int ret = rec_finish();
+    if (ret < 0) {
+        LOG_ERR("Recording %s is incomplete: %d", rec_stats.path, ret);
+        rec_set_error(ret);
+    } else {
+        LOG_INF("Recorded %s, %u events, %u ms, %u groups dropped", rec_stats.path,
+                rec_stats.events, rec_stats.duration_ms, rec_stats.dropped);
+        // The saved song list doesn't have the new file yet
+        sd_manager_rescan();
+    }
+
+    // A send that raced the disarm could still add an entry after the last drain
+    spsc_ring_discard(&rec_ring);
+}
+
+static void midi_recorder_thread(void *p1, void *p2, void *p3)
+{
+    while (1) {
+        k_sem_take(&rec_start_sem, K_FOREVER);
+        rec_session();
+        atomic_set(&rec_state, MIDI_RECORDER_IDLE);
+    }
+}
+
+int midi_recorder_init(void)
+{
+    spsc_ring_init(&rec_ring, rec_ring_buf, sizeof(rec_ring_buf));
+    atomic_set(&rec_armed, 0);
+    atomic_set(&rec_state, MIDI_RECORDER_IDLE);
+
+    k_tid_t tid = k_thread_create(&midi_recorder_thread_data, midi_recorder_stack,
+                                  K_THREAD_STACK_SIZEOF(midi_recorder_stack),
+                                  midi_recorder_thread, NULL, NULL, NULL,
+                                  MIDI_RECORDER_PRIORITY, 0, K_NO_WAIT);
+    if (tid == NULL) {
+        LOG_ERR("Failed to start MIDI recorder thread");
+        return -ENOMEM;
+    }
+    k_thread_name_set(tid, "midi_recorder");
+
+    LOG_INF("MIDI recorder ready (%d byte ring)", MIDI_RECORDER_RING_SIZE);
+    return 0;
+}
+
+int midi_recorder_start(void)
+{
+    if (!atomic_cas(&rec_state, MIDI_RECORDER_IDLE, MIDI_RECORDER_RECORDING)) {
+        return -EBUSY;
+    }
+
+    k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+    memset(&rec_stats, 0, sizeof(rec_stats));
+    rec_stats.state = MIDI_RECORDER_RECORDING;
+    k_mutex_unlock(&rec_stats_mutex);
+
+    atomic_clear(&rec_dropped);
+    rec_ring.high_water = 0;
+    k_sem_reset(&rec_stop_sem);
+
+    // The writer is idle and the ring empty, so capture can start before the file exists
+    rec_start_ms = k_uptime_get_32();
+    atomic_set(&rec_armed, 1);
+    k_sem_give(&rec_start_sem);
+
+    return 0;
+}
+
+int midi_recorder_stop(void)
+{
+    if (!atomic_cas(&rec_state, MIDI_RECORDER_RECORDING, MIDI_RECORDER_FINISHING)) {
+        return -EALREADY;
+    }
+
+    atomic_set(&rec_armed, 0);
+    k_sem_give(&rec_stop_sem);
+    return 0;
+}
+
+bool midi_recorder_is_recording(void)
+{
+    return atomic_get(&rec_state) == MIDI_RECORDER_RECORDING;
+}
+
+void midi_recorder_get_stats(midi_recorder_stats_t *stats)
+{
+    k_mutex_lock(&rec_stats_mutex, K_FOREVER);
+    *stats = rec_stats;
+    k_mutex_unlock(&rec_stats_mutex);
+    stats->state = atomic_get(&rec_state);
+}
+
+#ifdef CONFIG_SHELL
+
+static const char *const rec_state_names[] = { "idle", "recording", "finishing" };
+
+static int cmd_rec_start(const struct shell *sh, size_t argc, char **argv)
+{
+    int ret = midi_recorder_start();
+    if (ret < 0) {
+        shell_error(sh, "Can't start recording: %d", ret);
+        return ret;
+    }
+    shell_print(sh, "Recording");
+    return 0;
+}
+
+static int cmd_rec_stop(const struct shell *sh, size_t argc, char **argv)
+{
+    int ret = midi_recorder_stop();
+    if (ret < 0) {
+        shell_error(sh, "Not recording");
+        return ret;
+    }
+    shell_print(sh, "Stopping, the file is closed in the background");
+    return 0;
+}
+
+static int cmd_rec_status(const struct shell *sh, size_t argc, char **argv)
+{
+    midi_recorder_stats_t stats;
+
+    midi_recorder_get_stats(&stats);
+    shell_print(sh, "%s %s", rec_state_names[stats.state], stats.path);
+    shell_print(sh, "events %u, %u bytes, %u ms", stats.events, stats.bytes, stats.duration_ms);
+    shell_print(sh, "dropped %u, ring high water %u/%u", stats.dropped,
+                stats.ring_high_water, MIDI_RECORDER_RING_SIZE);
+    shell_print(sh, "writes %u, slowest %u us, error %d", stats.writes,
+                stats.max_write_us, stats.error);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_rec,
+    SHELL_CMD(start, NULL, "Record everything sent to the synth", cmd_rec_start),
+    SHELL_CMD(stop, NULL, "Stop and close the recording", cmd_rec_stop),
+    SHELL_CMD(status, NULL, "Recording counters", cmd_rec_status),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(rec, &sub_rec, "Performance recorder", NULL);
+
+#endif // CONFIG_SHELL
@@ -0,0 +1,90 @@
+#ifndef MIDI_RECORDER_H
+#define MIDI_RECORDER_H
+
+#include <zephyr/types.h>
+#include <stdbool.h>
+
+/*
+ * Records everything sent to the synth into a Standard MIDI File on the card.
+ *
+ * The send path only copies each message group and its time into a RAM ring
+ * (midi_recorder_tap()); a low-priority thread turns the ring into SMF events
+ * and appends them to the file in MIDI_RECORDER_WRITE_SIZE pieces. If the card
+ * falls behind the ring fills and groups are dropped and counted, the live
+ * path is never held up.
+ *
+ * Recordings are format 0 with one tick per millisecond, saved in the MIDI
+ * directory; the song list is rescanned once one is closed, so it shows up in
+ * the track menu.
+ */
+
+// Captured messages waiting for the writer, a power of two. Each group costs
+// its MIDI bytes plus a 5 byte timestamp and length.
+#define MIDI_RECORDER_RING_SIZE     4096
+// Appends are this size and this aligned, so each fills whole sectors and
+// never straddles a cluster boundary
+#define MIDI_RECORDER_WRITE_SIZE    4096
+#define MIDI_RECORDER_STACK_SIZE    1536
+// Below the player and the SD services
+#define MIDI_RECORDER_PRIORITY      10
+// How often the writer drains the ring; the tap doesn't signal it
+#define MIDI_RECORDER_POLL_MS       50
+#define MIDI_RECORDER_DIR           "SD:/MIDI"
+// Recordings are numbered REC_001.mid up to this
+#define MIDI_RECORDER_MAX_FILES     999
+
+typedef enum {
+    MIDI_RECORDER_IDLE,
+    MIDI_RECORDER_RECORDING,
+    MIDI_RECORDER_FINISHING,    // stopped, the writer is still closing the file
+} midi_recorder_state_t;
+
+typedef struct {
+    uint8_t state;              // midi_recorder_state_t
+    char path[32];              // current or last recording
+    uint32_t events;            // MIDI events written to the file
+    uint32_t bytes;             // file size so far
+    uint32_t duration_ms;
+    uint32_t dropped;           // groups lost because the ring was full
+    uint32_t ring_high_water;   // most bytes ever waiting in the ring
+    uint32_t writes;
+    uint32_t max_write_us;      // slowest append
+    int error;                  // last file error, 0 if none
+} midi_recorder_stats_t;
+
+/**
+ * @brief Start the writer thread
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int midi_recorder_init(void);
+
+/**
+ * @brief Start capturing; the file is created by the writer
+ *
+ * Returns at once, capture starts with the next message sent.
+ *
+ * @return int 0 on success, -EBUSY if a recording is running or still being closed
+ */
+int midi_recorder_start(void);
+
+/**
+ * @brief Stop capturing; the writer finishes and closes the file in the background
+ *
+ * @return int 0 on success, -EALREADY if nothing is being recorded
+ */
+int midi_recorder_stop(void);
+
+bool midi_recorder_is_recording(void);
+
+/**
+ * @brief Capture a group of complete MIDI messages just handed to the synth
+ *
+ * Called by the MIDI send path with its lock held, so there is only ever one
+ * caller at a time. Lock-free and never blocks; safe from ISRs.
+ */
+void midi_recorder_tap(const uint8_t *buf, uint8_t len);
+
+void midi_recorder_get_stats(midi_recorder_stats_t *stats);
+
+#endif // MIDI_RECORDER_H
@@ -0,0 +1,288 @@
+// smc_cache.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/crc.h>
+#include <ff.h>
+#include <errno.h>
+#include <string.h>
+
+#include "smc_cache.h"
+#include "smc_compiler.h"
+#include "smf_sd_io.h"
+#include "hw_interface/sd_card_interface/sd_file_pool.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+
+LOG_MODULE_REGISTER(smc_cache, LOG_LEVEL_INF);
+
+// The player looks caches up while boot may still be building them
+static K_MUTEX_DEFINE(smc_cache_mutex);
+static uint8_t smc_work[SMC_CACHE_WORK_SIZE];
+static smf_sd_file_t smc_src_file;
+static smf_sd_file_t smc_cache_file;
+static int smc_out_file;        // pool handles of the .smc and .smk being written
+static int smc_index_file;
+
+// Sources that can't be compiled, so a remount doesn't try them again until
+// they change; a full table forgets the oldest
+typedef struct {
+    uint32_t path_crc;
+    smc_source_info_t src;
+    int error;
+} smc_failed_t;
+
+static smc_failed_t smc_failed[SMC_CACHE_MAX_FAILED];
+static uint8_t smc_failed_count;
+static uint8_t smc_failed_next;
+
+// @p mid_path with its extension replaced by @p ext (which includes the dot)
+static int smc_cache_swap_ext(const char *mid_path, const char *ext, char *out, size_t len)
+{
+    const char *dot = strrchr(mid_path, '.');
+    if (dot == NULL) {
+        return -EINVAL;
+    }
+
+    size_t base = dot - mid_path;
+    size_t ext_len = strlen(ext) + 1;
+    if (base + ext_len > len) {
+        return -ENAMETOOLONG;
+    }
+
+    memcpy(out, mid_path, base);
+    memcpy(&out[base], ext, ext_len);
+    return 0;
+}
+
+int smc_cache_path(const char *mid_path, char *smc_path, size_t len)
+{
+    return smc_cache_swap_ext(mid_path, SMC_EXTENSION, smc_path, len);
+}
+
+int smc_cache_index_path(const char *mid_path, char *smk_path, size_t len)
+{
+    return smc_cache_swap_ext(mid_path, SMK_EXTENSION, smk_path, len);
+}
+
+static int smc_out_write(void *ctx, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+    int handle = *(int *)ctx;
+    int ret = sd_file_seek(handle, offset);
+
+    return ret ? ret : sd_file_write(handle, buf, len);
+}
+
+// First @p len bytes of a file, which must be that long
+static int smc_cache_read_raw(const char *path, uint8_t *raw, uint32_t len)
+{
+    int ret = smf_sd_open(&smc_cache_file, path);
+    if (ret) {
+        return ret;
+    }
+
+    ret = smc_cache_file.io.read(smc_cache_file.io.ctx, 0, raw, len);
+    smf_sd_close(&smc_cache_file);
+    if (ret < 0) {
+        return ret;
+    }
+    return (uint32_t)ret == len ? 0 : -EBADMSG;
+}
+
+// What the cache of @p mid_path has to have been built from
+static int smc_cache_source(const char *mid_path, smc_source_info_t *src)
+{
+    FILINFO info;
+
+    if (f_stat(mid_path, &info) != FR_OK) {
+        LOG_ERR("Can't stat %s", mid_path);
+        return -ENOENT;
+    }
+
+    src->size = info.fsize;
+    src->mtime = ((uint32_t)info.fdate << 16) | info.ftime;
+    return 0;
+}
+
+int smc_cache_lookup(const char *mid_path, char *smc_path, size_t len, smc_header_t *hdr)
+{
+    smc_source_info_t src;
+    smc_header_t cached;
+
+    int ret = smc_cache_path(mid_path, smc_path, len);
+    if (ret == 0) {
+        ret = smc_cache_source(mid_path, &src);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    uint8_t raw[SMC_HEADER_SIZE];
+    k_mutex_lock(&smc_cache_mutex, K_FOREVER);
+    ret = smc_cache_read_raw(smc_path, raw, sizeof(raw));
+    k_mutex_unlock(&smc_cache_mutex);
+
+    if (ret != 0 || smc_header_decode(raw, &cached) != 0 || !smc_header_matches(&cached, &src)) {
+        return -ESTALE;
+    }
+
+    if (hdr) {
+        *hdr = cached;
+    }
+    return 0;
+}
+
+int smc_cache_index_lookup(const char *mid_path, char *smk_path, size_t len, smk_header_t *hdr)
+{
+    smc_source_info_t src;
+    smk_header_t index;
+
+    int ret = smc_cache_index_path(mid_path, smk_path, len);
+    if (ret == 0) {
+        ret = smc_cache_source(mid_path, &src);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    uint8_t raw[SMK_HEADER_SIZE];
+    k_mutex_lock(&smc_cache_mutex, K_FOREVER);
+    ret = smc_cache_read_raw(smk_path, raw, sizeof(raw));
+    k_mutex_unlock(&smc_cache_mutex);
+
+    if (ret != 0 || smk_header_decode(raw, &index) != 0 ||
+        index.src.size != src.size || index.src.mtime != src.mtime) {
+        return -ESTALE;
+    }
+
+    if (hdr) {
+        *hdr = index;
+    }
+    return 0;
+}
+
+// Error a failed compile of this exact source gave, 0 if it wasn't tried
+static int smc_cache_known_failure(uint32_t path_crc, const smc_source_info_t *src)
+{
+    for (uint8_t i = 0; i < smc_failed_count; i++) {
+        const smc_failed_t *f = &smc_failed[i];
+
+        if (f->path_crc == path_crc && f->src.size == src->size && f->src.mtime == src->mtime) {
+            return f->error;
+        }
+    }
+    return 0;
+}
+
+static void smc_cache_remember_failure(uint32_t path_crc, const smc_source_info_t *src, int error)
+{
+    smc_failed[smc_failed_next] = (smc_failed_t){ path_crc, *src, error };
+    smc_failed_next = (smc_failed_next + 1) % SMC_CACHE_MAX_FAILED;
+    if (smc_failed_count < SMC_CACHE_MAX_FAILED) {
+        smc_failed_count++;
+    }
+}
+
+int smc_cache_ensure(const char *mid_path, smc_header_t *hdr)
+{
+    char smc_path[SMC_CACHE_PATH_LEN];
+    char smk_path[SMC_CACHE_PATH_LEN];
+    smc_source_info_t src;
+    smc_header_t cached;
+    int ret;
+
+    ret = smc_cache_lookup(mid_path, smc_path, sizeof(smc_path), hdr);
+    if (ret == 0) {
+        ret = smc_cache_index_lookup(mid_path, smk_path, sizeof(smk_path), NULL);
+    }
+    if (ret != -ESTALE) {
+        return ret;
+    }
+
+    ret = smc_cache_index_path(mid_path, smk_path, sizeof(smk_path));
+    if (ret == 0) {
+        ret = smc_cache_source(mid_path, &src);
+    }
+    if (ret) {
+        return ret;
+    }
+
+    uint32_t path_crc = crc32_ieee((const uint8_t *)mid_path, strlen(mid_path));
+    k_mutex_lock(&smc_cache_mutex, K_FOREVER);
+    ret = smc_cache_known_failure(path_crc, &src);
+    k_mutex_unlock(&smc_cache_mutex);
+    if (ret) {
+        LOG_DBG("%s failed to compile before (%d), not trying again", mid_path, ret);
+        return ret;
+    }
+
+    LOG_INF("Compiling %s", mid_path);
+    int64_t start = k_uptime_get();
+
+    k_mutex_lock(&smc_cache_mutex, K_FOREVER);
+    ret = smf_sd_open(&smc_src_file, mid_path);
+    if (ret == 0) {
+        smc_out_file = sd_file_open(smc_path, FA_WRITE | FA_CREATE_ALWAYS);
+        if (smc_out_file >= 0) {
+            smc_index_file = sd_file_open(smk_path, FA_WRITE | FA_CREATE_ALWAYS);
+            if (smc_index_file >= 0) {
+                smc_writer_t out = { .write = smc_out_write, .ctx = &smc_out_file };
+                smc_writer_t index = { .write = smc_out_write, .ctx = &smc_index_file };
+                ret = smc_compile(&smc_src_file.io, &src, &out, &index,
+                                  smc_work, sizeof(smc_work), &cached);
+                sd_file_close(smc_index_file);
+            } else {
+                LOG_ERR("Can't create %s", smk_path);
+                ret = smc_index_file;
+            }
+            sd_file_close(smc_out_file);
+        } else {
+            LOG_ERR("Can't create %s", smc_path);
+            ret = smc_out_file;
+        }
+        smf_sd_close(&smc_src_file);
+    }
+    // Only what the source itself causes; card errors are worth another try
+    if (ret == -EBADMSG || ret == -E2BIG || ret == -EINVAL || ret == -ENOMEM) {
+        smc_cache_remember_failure(path_crc, &src, ret);
+    }
+    k_mutex_unlock(&smc_cache_mutex);
+
+    if (ret) {
+        LOG_ERR("Compiling %s failed: %d", mid_path, ret);
+        // Don't leave a half-written cache around to be checked again
+        f_unlink(smc_path);
+        f_unlink(smk_path);
+        return ret;
+    }
+
+    LOG_INF("%s: %u events, %u ms, compiled in %lld ms", smc_path, cached.record_count,
+            cached.duration_us / 1000, k_uptime_get() - start);
+
+    if (hdr) {
+        *hdr = cached;
+    }
+    return 1;
+}
+
+int smc_cache_build_all(void)
+{
+    char mid_path[SMC_CACHE_PATH_LEN];
+    uint16_t count = get_track_count();
+    int rebuilt = 0;
+    int failed = 0;
+
+    for (uint16_t t = 1; t <= count; t++) {
+        if (get_track_file_name(t, mid_path, sizeof(mid_path)) != 0) {
+            continue;
+        }
+
+        int ret = smc_cache_ensure(mid_path, NULL);
+        if (ret < 0) {
+            failed++;
+        } else {
+            rebuilt += ret;
+        }
+    }
+
+    LOG_INF("Song caches: %d rebuilt, %d failed, %d tracks", rebuilt, failed, count);
+    return (count > 0 && failed == count) ? -EIO : rebuilt;
+}
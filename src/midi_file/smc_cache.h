@@ -0,0 +1,69 @@
+#ifndef SMC_CACHE_H
+#define SMC_CACHE_H
+
+#include <zephyr/types.h>
+#include <stddef.h>
+
+#include "smc_format.h"
+#include "smk_index.h"
+
+// Scratch memory for on-device compiles, enough for full windows on 8 tracks
+#define SMC_CACHE_WORK_SIZE     SMC_COMPILE_WORK_SIZE(8)
+#define SMC_CACHE_PATH_LEN      64
+// Failed compiles remembered so they aren't retried until the source changes
+#define SMC_CACHE_MAX_FAILED    16
+
+/**
+ * @brief Path of the cache that belongs to @p mid_path ("x.mid" -> "x.smc")
+ *
+ * @return int 0 on success, -EINVAL if @p mid_path has no extension, -ENAMETOOLONG
+ */
+int smc_cache_path(const char *mid_path, char *smc_path, size_t len);
+
+/**
+ * @brief Path of the keyframe index that belongs to @p mid_path ("x.mid" -> "x.smk")
+ *
+ * @return int 0 on success, -EINVAL if @p mid_path has no extension, -ENAMETOOLONG
+ */
+int smc_cache_index_path(const char *mid_path, char *smk_path, size_t len);
+
+/**
+ * @brief Find a current cache for @p mid_path without building one
+ *
+ * A cache is current when it is complete and was built from a source with
+ * the same size and timestamp as @p mid_path has now.
+ *
+ * @param smc_path Receives the cache path
+ * @param hdr Optional, receives the cache header
+ * @return int 0 if a current cache exists, -ESTALE if it is missing, partial
+ *         or out of date, negative error code otherwise
+ */
+int smc_cache_lookup(const char *mid_path, char *smc_path, size_t len, smc_header_t *hdr);
+
+/**
+ * @brief Find a current keyframe index for @p mid_path, same rules as smc_cache_lookup()
+ *
+ * @return int 0 if a current index exists, -ESTALE if not, negative error code otherwise
+ */
+int smc_cache_index_lookup(const char *mid_path, char *smk_path, size_t len, smk_header_t *hdr);
+
+/**
+ * @brief Make sure the .smc and .smk next to @p mid_path are current, compiling them if not
+ *
+ * @param hdr Optional, receives the cache header
+ * A source that couldn't be compiled (malformed, too many tracks) gives the
+ * same error again, without another attempt, until its size or timestamp changes.
+ *
+ * @return int 0 if the cache was already current, 1 if it was rebuilt,
+ *         negative error code otherwise
+ */
+int smc_cache_ensure(const char *mid_path, smc_header_t *hdr);
+
+/**
+ * @brief Bring the cache of every track found by scan_midi_files() up to date
+ *
+ * @return int Number of caches rebuilt, negative error code if none could be checked
+ */
+int smc_cache_build_all(void);
+
+#endif // SMC_CACHE_H
@@ -0,0 +1,168 @@
+// smc_compiler.c
+#include <errno.h>
+#include <string.h>
+
+#include "smc_compiler.h"
+
+// Index header goes last, like the .smc one
+static int smc_write_index_header(const smc_writer_t *index_out, const smk_builder_t *kb,
+                                  const smc_header_t *hdr, uint32_t magic)
+{
+    uint8_t raw[SMK_HEADER_SIZE];
+    smk_header_t smk = {
+        .magic = magic,
+        .version = SMK_VERSION,
+        .keyframe_size = SMK_KEYFRAME_SIZE,
+        .src = hdr->src,
+        .count = kb->count,
+        .interval_ticks = kb->interval_ticks,
+        .division = hdr->division,
+        .ntracks = hdr->ntracks,
+    };
+
+    smk_header_encode(&smk, raw);
+    return index_out->write(index_out->ctx, 0, raw, sizeof(raw));
+}
+
+int smc_compile(const smf_io_t *in, const smc_source_info_t *src, const smc_writer_t *out,
+                const smc_writer_t *index_out, uint8_t *work, uint32_t work_size,
+                smc_header_t *hdr_out)
+{
+    // Static to keep ~3.5 KB off the caller's stack; one compile at a time
+    static smf_merge_t merge;
+    static tempo_segment_t tempo_segs[TEMPO_MAP_MAX_SEGMENTS];
+    static smk_builder_t keyframes;
+    static uint8_t keyframe_raw[SMK_KEYFRAME_SIZE];
+    tempo_map_t tempo;
+    smf_file_t smf;
+    smf_event_t ev;
+    uint8_t track;
+    int ret;
+
+    ret = smf_open(&smf, in);
+    if (ret) {
+        return ret;
+    }
+
+    // Output block first, the rest is shared out as track windows
+    uint32_t block_size = SMC_OUT_BLOCK_RECORDS * SMC_RECORD_SIZE;
+    if (work_size <= block_size) {
+        return -ENOMEM;
+    }
+    uint8_t *block = work;
+
+    // Tempo first, so every event's time is known the moment it is merged
+    uint32_t scan = work_size - block_size;
+    tempo_map_init(&tempo, tempo_segs, TEMPO_MAP_MAX_SEGMENTS, smf.division);
+    ret = tempo_map_build(&tempo, &smf, work + block_size,
+                          scan > SMF_MERGE_MAX_WINDOW ? SMF_MERGE_MAX_WINDOW : scan);
+    // A full map isn't fatal: past the last change that fit the song keeps
+    // that tempo, the same as when it is played without a cache
+    if (ret) {
+        return ret;
+    }
+
+    ret = smf_merge_init(&merge, &smf, work + block_size, work_size - block_size);
+    if (ret) {
+        return ret;
+    }
+
+    smc_header_t hdr = {
+        .magic = 0,     // filled in once everything else is on disk
+        .version = SMC_VERSION,
+        .record_size = SMC_RECORD_SIZE,
+        .src = *src,
+        .initial_tempo_us = tempo_map_tempo_at(&tempo, 0),
+        .division = smf.division,
+        .ntracks = smf.ntracks,
+    };
+    uint8_t raw[SMC_HEADER_SIZE];
+    smc_header_encode(&hdr, raw);
+    ret = out->write(out->ctx, 0, raw, sizeof(raw));
+    if (ret) {
+        return ret;
+    }
+
+    smk_builder_init(&keyframes, smf.division);
+    if (index_out) {
+        ret = smc_write_index_header(index_out, &keyframes, &hdr, 0);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    uint32_t block_len = 0;
+    uint32_t written = SMC_HEADER_SIZE;
+
+    while ((ret = smf_merge_peek(&merge, &ev, &track)) == 1) {
+        // Snapshot before the event, so resuming here plays it
+        if (index_out && smk_builder_due(&keyframes, ev.tick)) {
+            uint32_t offset = SMK_HEADER_SIZE + keyframes.count * SMK_KEYFRAME_SIZE;
+            smk_builder_take(&keyframes, &merge, ev.tick, tempo_map_tick_to_us(&tempo, ev.tick),
+                             tempo_map_tempo_at(&tempo, ev.tick), hdr.record_count, keyframe_raw);
+            ret = index_out->write(index_out->ctx, offset, keyframe_raw, SMK_KEYFRAME_SIZE);
+            if (ret) {
+                return ret;
+            }
+        }
+
+        ret = smf_merge_next(&merge, &ev, &track);
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (ev.type == SMF_EVENT_MIDI) {
+            smk_state_apply(&keyframes.state, ev.status, ev.data1, ev.data2);
+
+            smc_record_t rec = {
+                .time_us = tempo_map_tick_to_us(&tempo, ev.tick),
+                .status = ev.status,
+                .data1 = ev.data1,
+                .data2 = ev.data2,
+                .track = track,
+            };
+            smc_record_encode(&rec, &block[block_len]);
+            block_len += SMC_RECORD_SIZE;
+            hdr.record_count++;
+
+            if (block_len == block_size) {
+                ret = out->write(out->ctx, written, block, block_len);
+                if (ret) {
+                    return ret;
+                }
+                written += block_len;
+                block_len = 0;
+            }
+        }
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (block_len > 0) {
+        ret = out->write(out->ctx, written, block, block_len);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    hdr.magic = SMC_MAGIC;
+    hdr.duration_us = tempo_map_duration_us(&tempo);
+    smc_header_encode(&hdr, raw);
+    ret = out->write(out->ctx, 0, raw, sizeof(raw));
+    if (ret) {
+        return ret;
+    }
+
+    if (index_out) {
+        ret = smc_write_index_header(index_out, &keyframes, &hdr, SMK_MAGIC);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    if (hdr_out) {
+        *hdr_out = hdr;
+    }
+    return 0;
+}
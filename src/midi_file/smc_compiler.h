@@ -0,0 +1,46 @@
+#ifndef SMC_COMPILER_H
+#define SMC_COMPILER_H
+
+#include <stdint.h>
+
+#include "smf_parser.h"
+#include "smf_merge.h"
+#include "tempo_map.h"
+#include "smk_index.h"
+#include "smc_format.h"
+
+// Records gathered before each write
+#define SMC_OUT_BLOCK_RECORDS   64
+
+/**
+ * @brief Work memory needed to compile a file with @p ntracks tracks at full speed
+ */
+#define SMC_COMPILE_WORK_SIZE(ntracks) \
+    (SMC_OUT_BLOCK_RECORDS * SMC_RECORD_SIZE + SMF_MERGE_BUFFER_SIZE(ntracks))
+
+/**
+ * @brief Compile an SMF into a .smc
+ *
+ * Tracks are merged in time order (ties keep track order), tempo changes are
+ * folded into microsecond times and only channel messages are kept. The
+ * header goes out last, so an interrupted compile leaves a file that
+ * smc_header_decode() rejects.
+ *
+ * The keyframe index is built in the same pass, the song is only parsed once.
+ *
+ * @param in Source .mid
+ * @param src Source size/timestamp recorded in the header
+ * @param out Destination .smc
+ * @param index_out Optional, destination .smk
+ * @param work Scratch memory for the track windows and output block
+ * @param hdr_out Optional, receives the header that was written
+ * Tempo changes past the first TEMPO_MAP_MAX_SEGMENTS are dropped, as in live
+ * playback, rather than failing the compile.
+ *
+ * @return int 0 on success, -ENOMEM if @p work is too small, negative error code otherwise
+ */
+int smc_compile(const smf_io_t *in, const smc_source_info_t *src, const smc_writer_t *out,
+                const smc_writer_t *index_out, uint8_t *work, uint32_t work_size,
+                smc_header_t *hdr_out);
+
+#endif // SMC_COMPILER_H
@@ -0,0 +1,157 @@
+// smc_format.c
+#include <errno.h>
+#include <string.h>
+
+#include "smc_format.h"
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void smc_header_encode(const smc_header_t *hdr, uint8_t out[SMC_HEADER_SIZE])
+{
+    memset(out, 0, SMC_HEADER_SIZE);
+    put_le32(&out[0], hdr->magic);
+    put_le16(&out[4], hdr->version);
+    put_le16(&out[6], hdr->record_size);
+    put_le32(&out[8], hdr->src.size);
+    put_le32(&out[12], hdr->src.mtime);
+    put_le32(&out[16], hdr->record_count);
+    put_le32(&out[20], hdr->duration_us);
+    put_le32(&out[24], hdr->initial_tempo_us);
+    put_le16(&out[28], hdr->division);
+    put_le16(&out[30], hdr->ntracks);
+}
+
+int smc_header_decode(const uint8_t in[SMC_HEADER_SIZE], smc_header_t *hdr)
+{
+    hdr->magic = get_le32(&in[0]);
+    hdr->version = get_le16(&in[4]);
+    hdr->record_size = get_le16(&in[6]);
+    hdr->src.size = get_le32(&in[8]);
+    hdr->src.mtime = get_le32(&in[12]);
+    hdr->record_count = get_le32(&in[16]);
+    hdr->duration_us = get_le32(&in[20]);
+    hdr->initial_tempo_us = get_le32(&in[24]);
+    hdr->division = get_le16(&in[28]);
+    hdr->ntracks = get_le16(&in[30]);
+
+    // The magic is written last, so a compile that died halfway fails here
+    if (hdr->magic != SMC_MAGIC || hdr->version != SMC_VERSION ||
+        hdr->record_size != SMC_RECORD_SIZE) {
+        return -EBADMSG;
+    }
+
+    return 0;
+}
+
+void smc_record_encode(const smc_record_t *rec, uint8_t out[SMC_RECORD_SIZE])
+{
+    put_le32(&out[0], rec->time_us);
+    out[4] = rec->status;
+    out[5] = rec->data1;
+    out[6] = rec->data2;
+    out[7] = rec->track;
+}
+
+void smc_record_decode(const uint8_t in[SMC_RECORD_SIZE], smc_record_t *rec)
+{
+    rec->time_us = get_le32(&in[0]);
+    rec->status = in[4];
+    rec->data1 = in[5];
+    rec->data2 = in[6];
+    rec->track = in[7];
+}
+
+bool smc_header_matches(const smc_header_t *hdr, const smc_source_info_t *src)
+{
+    return hdr->src.size == src->size && hdr->src.mtime == src->mtime;
+}
+
+int smc_reader_open(smc_reader_t *rd, const smf_io_t *io, uint8_t *buf, uint32_t buf_size)
+{
+    uint8_t raw[SMC_HEADER_SIZE];
+
+    if (buf_size < SMC_RECORD_SIZE) {
+        return -EINVAL;
+    }
+
+    memset(rd, 0, sizeof(*rd));
+    rd->io = io;
+    rd->buf = buf;
+    rd->buf_size = buf_size - (buf_size % SMC_RECORD_SIZE);
+
+    int ret = io->read(io->ctx, 0, raw, sizeof(raw));
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret != SMC_HEADER_SIZE) {
+        return -EBADMSG;
+    }
+
+    return smc_header_decode(raw, &rd->hdr);
+}
+
+int smc_reader_next(smc_reader_t *rd, smc_record_t *rec)
+{
+    if (rd->buf_pos >= rd->buf_len) {
+        uint32_t left = rd->hdr.record_count - rd->next;
+        if (left == 0) {
+            return 0;
+        }
+
+        uint32_t len = left * SMC_RECORD_SIZE;
+        if (len > rd->buf_size) {
+            len = rd->buf_size;
+        }
+
+        uint32_t offset = SMC_HEADER_SIZE + rd->next * SMC_RECORD_SIZE;
+        int ret = rd->io->read(rd->io->ctx, offset, rd->buf, len);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret < SMC_RECORD_SIZE) {
+            return -EBADMSG;
+        }
+
+        rd->buf_len = ret - (ret % SMC_RECORD_SIZE);
+        rd->buf_pos = 0;
+        rd->next += rd->buf_len / SMC_RECORD_SIZE;
+    }
+
+    smc_record_decode(&rd->buf[rd->buf_pos], rec);
+    rd->buf_pos += SMC_RECORD_SIZE;
+    return 1;
+}
+
+int smc_reader_seek(smc_reader_t *rd, uint32_t index)
+{
+    if (index > rd->hdr.record_count) {
+        return -EINVAL;
+    }
+
+    rd->next = index;
+    rd->buf_len = 0;
+    rd->buf_pos = 0;
+    return 0;
+}
@@ -0,0 +1,115 @@
+#ifndef SMC_FORMAT_H
+#define SMC_FORMAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smf_parser.h"
+
+/*
+ * .smc: a song precompiled from a .mid into one flat, time-ordered stream of
+ * fixed-size records. Tracks are already merged and tempo changes already
+ * folded into each record's time, so playing it is a sequential read with no
+ * parsing. All fields are little-endian, the layout is the same on the
+ * device and the host tool.
+ *
+ *   header   SMC_HEADER_SIZE bytes
+ *   records  record_count x SMC_RECORD_SIZE bytes
+ */
+
+#define SMC_MAGIC           0x31434D53  // "SMC1"
+#define SMC_VERSION         1
+#define SMC_HEADER_SIZE     32
+#define SMC_RECORD_SIZE     8
+#define SMC_EXTENSION       ".smc"
+
+// What the cache was built from; a mismatch means the .mid changed
+typedef struct {
+    uint32_t size;
+    uint32_t mtime;         // FAT date << 16 | FAT time
+} smc_source_info_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    smc_source_info_t src;
+    uint32_t record_count;
+    uint32_t duration_us;
+    uint32_t initial_tempo_us;
+    uint16_t division;
+    uint16_t ntracks;
+} smc_header_t;
+
+// One channel message at an absolute time
+typedef struct {
+    uint32_t time_us;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t track;
+} smc_record_t;
+
+/**
+ * @brief Write @p len bytes at @p offset of the output file
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+typedef int (*smc_write_fn)(void *ctx, uint32_t offset, const uint8_t *buf, uint32_t len);
+
+typedef struct {
+    smc_write_fn write;
+    void *ctx;
+} smc_writer_t;
+
+// Sequential reader over a .smc
+typedef struct {
+    const smf_io_t *io;
+    smc_header_t hdr;
+    uint8_t *buf;
+    uint32_t buf_size;      // rounded down to whole records
+    uint32_t buf_len;
+    uint32_t buf_pos;
+    uint32_t next;          // index of the next record to read from the file
+} smc_reader_t;
+
+void smc_header_encode(const smc_header_t *hdr, uint8_t out[SMC_HEADER_SIZE]);
+
+/**
+ * @brief Decode and sanity check a header
+ *
+ * @return int 0 on success, -EBADMSG if it isn't a complete .smc of this version
+ */
+int smc_header_decode(const uint8_t in[SMC_HEADER_SIZE], smc_header_t *hdr);
+
+void smc_record_encode(const smc_record_t *rec, uint8_t out[SMC_RECORD_SIZE]);
+void smc_record_decode(const uint8_t in[SMC_RECORD_SIZE], smc_record_t *rec);
+
+/**
+ * @brief Check whether a cache was built from the source described by @p src
+ */
+bool smc_header_matches(const smc_header_t *hdr, const smc_source_info_t *src);
+
+/**
+ * @brief Open a .smc for sequential reading
+ *
+ * @param buf Read window, at least one record
+ * @return int 0 on success, negative error code otherwise
+ */
+int smc_reader_open(smc_reader_t *rd, const smf_io_t *io, uint8_t *buf, uint32_t buf_size);
+
+/**
+ * @brief Read the next record
+ *
+ * @return int 1 with @p rec filled in, 0 at the end, negative error code otherwise
+ */
+int smc_reader_next(smc_reader_t *rd, smc_record_t *rec);
+
+/**
+ * @brief Continue reading from record @p index
+ *
+ * @return int 0 on success, -EINVAL past the end
+ */
+int smc_reader_seek(smc_reader_t *rd, uint32_t index);
+
+#endif // SMC_FORMAT_H
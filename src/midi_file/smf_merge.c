@@ -0,0 +1,170 @@
+// smf_merge.c
+#include <errno.h>
+#include <string.h>
+
+#include "smf_merge.h"
+
+static bool smf_merge_before(const smf_merge_t *m, uint8_t a, uint8_t b)
+{
+    uint32_t ta = m->cur[a].ev.tick;
+    uint32_t tb = m->cur[b].ev.tick;
+
+    return ta < tb || (ta == tb && a < b);
+}
+
+static void smf_merge_sift_down(smf_merge_t *m, uint8_t i)
+{
+    while (1) {
+        uint8_t l = 2 * i + 1;
+        uint8_t r = l + 1;
+        uint8_t min = i;
+
+        if (l < m->heap_len && smf_merge_before(m, m->heap[l], m->heap[min])) {
+            min = l;
+        }
+        if (r < m->heap_len && smf_merge_before(m, m->heap[r], m->heap[min])) {
+            min = r;
+        }
+        if (min == i) {
+            return;
+        }
+
+        uint8_t tmp = m->heap[i];
+        m->heap[i] = m->heap[min];
+        m->heap[min] = tmp;
+        i = min;
+    }
+}
+
+static int smf_merge_advance(smf_merge_cursor_t *cur)
+{
+    cur->at.pos = cur->trk.pos;
+    cur->at.tick = cur->trk.tick;
+    cur->at.running_status = cur->trk.running_status;
+
+    return smf_track_next(&cur->trk, &cur->ev);
+}
+
+// Read each track's next event and heapify whatever has one
+static int smf_merge_fill(smf_merge_t *m)
+{
+    m->heap_len = 0;
+
+    for (uint8_t t = 0; t < m->ntracks; t++) {
+        int ret = smf_merge_advance(&m->cur[t]);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 1) {
+            m->heap[m->heap_len++] = t;
+        }
+    }
+
+    for (int i = m->heap_len / 2 - 1; i >= 0; i--) {
+        smf_merge_sift_down(m, i);
+    }
+    return 0;
+}
+
+int smf_merge_init(smf_merge_t *m, const smf_file_t *smf, uint8_t *buf, uint32_t buf_size)
+{
+    if (smf->ntracks == 0 || smf->ntracks > SMF_MAX_TRACKS) {
+        return -EINVAL;
+    }
+
+    uint32_t window = buf_size / smf->ntracks;
+    if (window < SMF_MERGE_MIN_WINDOW) {
+        return -ENOMEM;
+    }
+    if (window > SMF_MERGE_MAX_WINDOW) {
+        window = SMF_MERGE_MAX_WINDOW;
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->ntracks = smf->ntracks;
+    m->window = window;
+
+    for (uint8_t t = 0; t < m->ntracks; t++) {
+        int ret = smf_track_init(&m->cur[t].trk, smf, t, buf + t * window, window);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return smf_merge_fill(m);
+}
+
+int smf_merge_next(smf_merge_t *m, smf_event_t *ev, uint8_t *track)
+{
+    if (m->heap_len == 0) {
+        return 0;
+    }
+
+    uint8_t t = m->heap[0];
+    *ev = m->cur[t].ev;
+    if (track) {
+        *track = t;
+    }
+
+    // Refill the root from the same track, or drop it if the track ended
+    int ret = smf_merge_advance(&m->cur[t]);
+    if (ret < 0) {
+        return ret;
+    }
+    if (ret == 0) {
+        m->heap[0] = m->heap[--m->heap_len];
+    }
+    smf_merge_sift_down(m, 0);
+
+    return 1;
+}
+
+int smf_merge_peek(const smf_merge_t *m, smf_event_t *ev, uint8_t *track)
+{
+    if (m->heap_len == 0) {
+        return 0;
+    }
+
+    *ev = m->cur[m->heap[0]].ev;
+    if (track) {
+        *track = m->heap[0];
+    }
+    return 1;
+}
+
+void smf_merge_save(const smf_merge_t *m, smf_track_state_t *state)
+{
+    for (uint8_t t = 0; t < m->ntracks; t++) {
+        const smf_merge_cursor_t *cur = &m->cur[t];
+
+        if (cur->trk.done) {
+            // Nothing left but (at most) End of Track
+            state[t] = (smf_track_state_t){ .pos = cur->trk.end, .tick = cur->trk.tick };
+        } else {
+            state[t] = cur->at;
+        }
+    }
+}
+
+int smf_merge_restore(smf_merge_t *m, const smf_track_state_t *state)
+{
+    for (uint8_t t = 0; t < m->ntracks; t++) {
+        int ret = smf_track_seek(&m->cur[t].trk, state[t].pos, state[t].tick,
+                                 state[t].running_status);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    return smf_merge_fill(m);
+}
+
+uint32_t smf_merge_refills(const smf_merge_t *m)
+{
+    uint32_t refills = 0;
+
+    for (uint8_t t = 0; t < m->ntracks; t++) {
+        refills += m->cur[t].trk.refills;
+    }
+    return refills;
+}
@@ -0,0 +1,88 @@
+#ifndef SMF_MERGE_H
+#define SMF_MERGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smf_parser.h"
+
+/*
+ * K-way merge of the tracks of a format 1 file into one time-ordered event
+ * stream. Each track keeps its own streaming cursor and the cursors sit in a
+ * binary min-heap keyed on (next event tick, track index), so taking an event
+ * costs O(log ntracks) and events with equal ticks come out in track order.
+ */
+
+// Smallest per-track read window that still makes progress on long events
+#define SMF_MERGE_MIN_WINDOW    32
+// Largest per-track read window; past this a refill doesn't get any cheaper
+#define SMF_MERGE_MAX_WINDOW    512
+
+/**
+ * @brief Read buffer needed to give @p ntracks tracks full size windows
+ */
+#define SMF_MERGE_BUFFER_SIZE(ntracks)  ((ntracks) * SMF_MERGE_MAX_WINDOW)
+
+typedef struct {
+    smf_track_t trk;
+    smf_event_t ev;         // next event of this track
+    smf_track_state_t at;   // where the track was before ev was read
+} smf_merge_cursor_t;
+
+typedef struct {
+    smf_merge_cursor_t cur[SMF_MAX_TRACKS];
+    uint8_t heap[SMF_MAX_TRACKS];   // indexes into cur[], earliest first
+    uint8_t heap_len;
+    uint8_t ntracks;
+    uint16_t window;                // per-track window actually handed out
+} smf_merge_t;
+
+/**
+ * @brief Start merging every track of @p smf from its beginning
+ *
+ * @p buf is split evenly between the tracks as their read windows, capped at
+ * SMF_MERGE_MAX_WINDOW each.
+ *
+ * @return int 0 on success, -ENOMEM if @p buf can't give every track
+ *         SMF_MERGE_MIN_WINDOW, negative error code otherwise
+ */
+int smf_merge_init(smf_merge_t *m, const smf_file_t *smf, uint8_t *buf, uint32_t buf_size);
+
+/**
+ * @brief Take the earliest pending event of any track
+ *
+ * @param track Optional, receives the index of the track it came from
+ * @return int 1 with @p ev filled in, 0 once every track has ended,
+ *         negative error code otherwise
+ */
+int smf_merge_next(smf_merge_t *m, smf_event_t *ev, uint8_t *track);
+
+/**
+ * @brief Look at the earliest pending event without taking it
+ *
+ * @return int 1 with @p ev filled in, 0 once every track has ended
+ */
+int smf_merge_peek(const smf_merge_t *m, smf_event_t *ev, uint8_t *track);
+
+/**
+ * @brief Record where every track is, so the merge can later resume from here
+ *
+ * The saved point is just before the event smf_merge_peek() would return.
+ *
+ * @param state One entry per track
+ */
+void smf_merge_save(const smf_merge_t *m, smf_track_state_t *state);
+
+/**
+ * @brief Move every track to a point saved with smf_merge_save()
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int smf_merge_restore(smf_merge_t *m, const smf_track_state_t *state);
+
+/**
+ * @brief Total window refills across all tracks, i.e. storage reads
+ */
+uint32_t smf_merge_refills(const smf_merge_t *m);
+
+#endif // SMF_MERGE_H
@@ -0,0 +1,303 @@
+// smf_parser.c
+#include <errno.h>
+#include <string.h>
+
+#include "smf_parser.h"
+
+// Chunk header: 4 byte id, 4 byte big-endian length
+#define SMF_CHUNK_HDR_LEN   8
+#define SMF_MTHD_LEN        6
+
+static uint32_t smf_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint16_t smf_be16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int smf_read_exact(const smf_io_t *io, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    int ret = io->read(io->ctx, offset, buf, len);
+
+    if (ret < 0) {
+        return ret;
+    }
+    return (uint32_t)ret == len ? 0 : -EBADMSG;
+}
+
+int smf_open(smf_file_t *smf, const smf_io_t *io)
+{
+    uint8_t hdr[SMF_CHUNK_HDR_LEN + SMF_MTHD_LEN];
+    int ret;
+
+    memset(smf, 0, sizeof(*smf));
+    smf->io = io;
+
+    ret = smf_read_exact(io, 0, hdr, sizeof(hdr));
+    if (ret) {
+        return ret;
+    }
+
+    uint32_t hdr_len = smf_be32(&hdr[4]);
+    if (memcmp(hdr, "MThd", 4) != 0 || hdr_len < SMF_MTHD_LEN || io->size < sizeof(hdr) ||
+        hdr_len > io->size - SMF_CHUNK_HDR_LEN) {
+        return -EBADMSG;
+    }
+
+    smf->format = smf_be16(&hdr[8]);
+    uint16_t declared = smf_be16(&hdr[10]);
+    smf->division = smf_be16(&hdr[12]);
+
+    if (smf->format > 1 || declared == 0 || (smf->division & 0x8000) || smf->division == 0) {
+        // Format 2 and SMPTE timing aren't something we play
+        return -EBADMSG;
+    }
+    if (declared > SMF_MAX_TRACKS) {
+        return -E2BIG;
+    }
+
+    // Walk the chunk headers only, skipping anything that isn't a track
+    uint32_t offset = SMF_CHUNK_HDR_LEN + hdr_len;
+    while (smf->ntracks < declared) {
+        ret = io->read(io->ctx, offset, hdr, SMF_CHUNK_HDR_LEN);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret < SMF_CHUNK_HDR_LEN) {
+            break;
+        }
+
+        uint32_t len = smf_be32(&hdr[4]);
+        // A corrupt length must neither wrap the walk back nor reach past the file
+        if (len > UINT32_MAX - offset - SMF_CHUNK_HDR_LEN ||
+            offset + SMF_CHUNK_HDR_LEN + len > io->size) {
+            return -EBADMSG;
+        }
+        if (memcmp(hdr, "MTrk", 4) == 0) {
+            smf->track_offset[smf->ntracks] = offset + SMF_CHUNK_HDR_LEN;
+            smf->track_length[smf->ntracks] = len;
+            smf->ntracks++;
+        }
+        offset += SMF_CHUNK_HDR_LEN + len;
+    }
+
+    return smf->ntracks > 0 ? 0 : -EBADMSG;
+}
+
+int smf_track_init(smf_track_t *trk, const smf_file_t *smf, uint8_t index,
+                   uint8_t *buf, uint16_t buf_size)
+{
+    if (index >= smf->ntracks || buf == NULL || buf_size == 0) {
+        return -EINVAL;
+    }
+    // smf_open() only lists tracks inside the file; don't trust a hand-filled one
+    if (smf->track_offset[index] > smf->io->size ||
+        smf->track_length[index] > smf->io->size - smf->track_offset[index]) {
+        return -EBADMSG;
+    }
+
+    memset(trk, 0, sizeof(*trk));
+    trk->io = smf->io;
+    trk->start = smf->track_offset[index];
+    trk->end = trk->start + smf->track_length[index];
+    trk->pos = trk->start;
+    trk->buf = buf;
+    trk->buf_size = buf_size;
+
+    return 0;
+}
+
+int smf_track_seek(smf_track_t *trk, uint32_t pos, uint32_t tick, uint8_t running_status)
+{
+    if (pos < trk->start || pos > trk->end) {
+        return -EINVAL;
+    }
+
+    trk->pos = pos;
+    trk->tick = tick;
+    trk->running_status = running_status;
+    trk->done = (pos == trk->end);
+
+    return 0;
+}
+
+// Next byte of the track, refilling the window when the cursor leaves it
+static int smf_getc(smf_track_t *trk, uint8_t *out)
+{
+    if (trk->pos >= trk->end) {
+        return -EBADMSG;
+    }
+
+    if (trk->pos < trk->buf_base || trk->pos >= trk->buf_base + trk->buf_len) {
+        uint32_t len = trk->end - trk->pos;
+        if (len > trk->buf_size) {
+            len = trk->buf_size;
+        }
+
+        int ret = trk->io->read(trk->io->ctx, trk->pos, trk->buf, len);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            // File shorter than the track header claims
+            return -EBADMSG;
+        }
+
+        trk->buf_base = trk->pos;
+        trk->buf_len = (uint16_t)ret;
+        trk->refills++;
+    }
+
+    *out = trk->buf[trk->pos - trk->buf_base];
+    trk->pos++;
+    return 0;
+}
+
+static int smf_read_vlq(smf_track_t *trk, uint32_t *value)
+{
+    uint32_t v = 0;
+
+    // At most 4 bytes, 28 bits
+    for (int i = 0; i < 4; i++) {
+        uint8_t b;
+        int ret = smf_getc(trk, &b);
+        if (ret) {
+            return ret;
+        }
+
+        v = (v << 7) | (b & 0x7F);
+        if (!(b & 0x80)) {
+            *value = v;
+            return 0;
+        }
+    }
+
+    return -EBADMSG;
+}
+
+// Copy the start of a SysEx/meta payload into the event and skip the rest
+static int smf_take_payload(smf_track_t *trk, smf_event_t *ev)
+{
+    int ret = smf_read_vlq(trk, &ev->length);
+    if (ret) {
+        return ret;
+    }
+
+    if (ev->length > trk->end - trk->pos) {
+        return -EBADMSG;
+    }
+
+    ev->offset = trk->pos;
+
+    uint32_t keep = ev->length < SMF_EVENT_DATA_MAX ? ev->length : SMF_EVENT_DATA_MAX;
+    for (uint32_t i = 0; i < keep; i++) {
+        ret = smf_getc(trk, &ev->data[i]);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    trk->pos = ev->offset + ev->length;
+    return 0;
+}
+
+int smf_track_next(smf_track_t *trk, smf_event_t *ev)
+{
+    uint32_t delta;
+    uint8_t b;
+    int ret;
+
+    if (trk->done || trk->pos >= trk->end) {
+        trk->done = true;
+        return 0;
+    }
+
+    ret = smf_read_vlq(trk, &delta);
+    if (ret) {
+        return ret;
+    }
+    trk->tick += delta;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->tick = trk->tick;
+
+    ret = smf_getc(trk, &b);
+    if (ret) {
+        return ret;
+    }
+
+    if (b == 0xFF) {
+        ev->type = SMF_EVENT_META;
+        ev->status = 0xFF;
+        ret = smf_getc(trk, &ev->meta_type);
+        if (ret) {
+            return ret;
+        }
+        ret = smf_take_payload(trk, ev);
+        if (ret) {
+            return ret;
+        }
+        if (ev->meta_type == SMF_META_END_OF_TRACK) {
+            trk->done = true;
+        }
+        return 1;
+    }
+
+    if (b == 0xF0 || b == 0xF7) {
+        ev->type = SMF_EVENT_SYSEX;
+        ev->status = b;
+        // The spec says SysEx and meta events cancel running status, but
+        // files that keep running after them are common, and a file that
+        // follows the spec always re-sends the status anyway, so leave it
+        ret = smf_take_payload(trk, ev);
+        return ret ? ret : 1;
+    }
+
+    ev->type = SMF_EVENT_MIDI;
+
+    if (b & 0x80) {
+        if (b >= 0xF0) {
+            // System Common/Real-Time have no place in a file
+            return -EBADMSG;
+        }
+        trk->running_status = b;
+        ret = smf_getc(trk, &ev->data1);
+        if (ret) {
+            return ret;
+        }
+    } else {
+        if (trk->running_status == 0) {
+            return -EBADMSG;
+        }
+        ev->data1 = b;
+    }
+    ev->status = trk->running_status;
+
+    // Program change and channel pressure carry one data byte, the rest two
+    uint8_t type = ev->status & 0xF0;
+    if (type != 0xC0 && type != 0xD0) {
+        ret = smf_getc(trk, &ev->data2);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    if ((ev->data1 | ev->data2) & 0x80) {
+        return -EBADMSG;
+    }
+
+    return 1;
+}
+
+uint32_t smf_meta_tempo(const smf_event_t *ev)
+{
+    if (ev->type != SMF_EVENT_META || ev->meta_type != SMF_META_TEMPO || ev->length < 3) {
+        return SMF_DEFAULT_TEMPO_US;
+    }
+
+    uint32_t tempo = ((uint32_t)ev->data[0] << 16) | ((uint32_t)ev->data[1] << 8) | ev->data[2];
+    return tempo ? tempo : SMF_DEFAULT_TEMPO_US;
+}
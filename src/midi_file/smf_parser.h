@@ -0,0 +1,141 @@
+#ifndef SMF_PARSER_H
+#define SMF_PARSER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Streaming Standard MIDI File parser.
+ *
+ * Nothing here holds a whole file or track in RAM. Each track cursor parses
+ * through a small caller-supplied window that is refilled from the file as it
+ * is consumed, and long SysEx/meta payloads are skipped rather than read.
+ * Plain C with no RTOS dependencies so the host tools can build it too.
+ */
+
+// Most tracks a file may have
+#define SMF_MAX_TRACKS          16
+// Leading payload bytes copied into an event (tempo is 3, time signature 4)
+#define SMF_EVENT_DATA_MAX      8
+
+// Meta event types the player cares about
+#define SMF_META_SEQUENCE_NAME  0x03
+#define SMF_META_END_OF_TRACK   0x2F
+#define SMF_META_TEMPO          0x51
+#define SMF_META_TIME_SIG       0x58
+#define SMF_META_KEY_SIG        0x59
+
+// Tempo until the first Set Tempo: 120 BPM
+#define SMF_DEFAULT_TEMPO_US    500000
+
+/**
+ * @brief Read @p len bytes at @p offset of the file
+ *
+ * @return int Bytes read (short only at end of file), negative error code otherwise
+ */
+typedef int (*smf_read_fn)(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len);
+
+// Where a parser gets its bytes from (SD file, host FILE*, memory)
+typedef struct {
+    smf_read_fn read;
+    void *ctx;
+    uint32_t size;          // file size in bytes; chunks must fit inside it
+} smf_io_t;
+
+// File header plus where each track's event data lives
+typedef struct {
+    const smf_io_t *io;
+    uint16_t format;
+    uint16_t ntracks;
+    uint16_t division;      // ticks per quarter note (SMPTE timing isn't supported)
+    uint32_t track_offset[SMF_MAX_TRACKS];
+    uint32_t track_length[SMF_MAX_TRACKS];
+} smf_file_t;
+
+typedef enum {
+    SMF_EVENT_MIDI,
+    SMF_EVENT_SYSEX,
+    SMF_EVENT_META,
+} smf_event_type_t;
+
+// One decoded event
+typedef struct {
+    uint32_t tick;          // absolute, from the start of the track
+    uint8_t type;           // smf_event_type_t
+    uint8_t status;         // MIDI status, 0xF0/0xF7 for SysEx, 0xFF for meta
+    uint8_t data1;
+    uint8_t data2;
+    uint8_t meta_type;
+    uint32_t length;        // SysEx/meta payload length
+    uint32_t offset;        // file offset of the payload, to read the rest on demand
+    uint8_t data[SMF_EVENT_DATA_MAX];   // first bytes of the payload
+} smf_event_t;
+
+// Cursor over one track
+typedef struct {
+    const smf_io_t *io;
+    uint32_t start;         // file offset of the first event
+    uint32_t end;           // file offset just past the track
+    uint32_t pos;           // file offset of the next byte to parse
+    uint8_t *buf;           // refill window
+    uint16_t buf_size;
+    uint16_t buf_len;
+    uint32_t buf_base;      // file offset of buf[0]
+    uint8_t running_status;
+    uint32_t tick;
+    bool done;
+    uint32_t refills;       // window reloads, i.e. reads that hit storage
+} smf_track_t;
+
+// Where a cursor is, enough to pick it up again with smf_track_seek()
+typedef struct {
+    uint32_t pos;
+    uint32_t tick;
+    uint8_t running_status;
+} smf_track_state_t;
+
+/**
+ * @brief Read the header and locate every track
+ *
+ * Only chunk headers are read; unknown chunks are skipped.
+ *
+ * @return int 0 on success, -EBADMSG if this isn't a usable SMF, -E2BIG for
+ *         more than SMF_MAX_TRACKS tracks, negative I/O error otherwise
+ */
+int smf_open(smf_file_t *smf, const smf_io_t *io);
+
+/**
+ * @brief Start a cursor at the beginning of track @p index
+ *
+ * @param buf Refill window, owned by the caller for the life of the cursor
+ * @param buf_size Window size; bigger means fewer, larger reads
+ * @return int 0 on success, -EINVAL for a bad index or window
+ */
+int smf_track_init(smf_track_t *trk, const smf_file_t *smf, uint8_t index,
+                   uint8_t *buf, uint16_t buf_size);
+
+/**
+ * @brief Decode the next event of a track
+ *
+ * @return int 1 with @p ev filled in, 0 at end of track, negative error code otherwise
+ */
+int smf_track_next(smf_track_t *trk, smf_event_t *ev);
+
+/**
+ * @brief Move a cursor to a known position inside its track
+ *
+ * Used to resume from a saved parser state without re-reading what came before.
+ *
+ * @param pos File offset of the next event's delta time
+ * @param tick Absolute tick of the event before @p pos
+ * @param running_status Running status in effect at @p pos
+ * @return int 0 on success, -EINVAL if @p pos is outside the track
+ */
+int smf_track_seek(smf_track_t *trk, uint32_t pos, uint32_t tick, uint8_t running_status);
+
+/**
+ * @brief Microseconds per quarter note from a Set Tempo meta event
+ */
+uint32_t smf_meta_tempo(const smf_event_t *ev);
+
+#endif // SMF_PARSER_H
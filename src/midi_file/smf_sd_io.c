@@ -0,0 +1,62 @@
+// smf_sd_io.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <errno.h>
+
+#include "smf_sd_io.h"
+#include "hw_interface/sd_card_interface/sd_file_pool.h"
+
+LOG_MODULE_REGISTER(smf_sd_io, LOG_LEVEL_INF);
+
+static int smf_sd_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    smf_sd_file_t *file = ctx;
+    int ret;
+
+    if (!file->open) {
+        return -EBADF;
+    }
+
+    // Cursors of different tracks take turns, so most reads move the pointer
+    ret = sd_file_seek(file->handle, offset);
+    if (ret) {
+        LOG_ERR("Seek to %u failed: %d", offset, ret);
+        return ret;
+    }
+
+    ret = sd_file_read(file->handle, buf, len);
+    if (ret < 0) {
+        LOG_ERR("Read of %u bytes at %u failed: %d", len, offset, ret);
+        return ret;
+    }
+    file->reads++;
+
+    return ret;
+}
+
+int smf_sd_open(smf_sd_file_t *file, const char *path)
+{
+    int handle = sd_file_open(path, FA_READ);
+    if (handle < 0) {
+        LOG_ERR("Failed to open %s: %d", path, handle);
+        return handle;
+    }
+
+    file->handle = handle;
+    file->open = true;
+    file->size = sd_file_size(handle);
+    file->reads = 0;
+    file->io.read = smf_sd_read;
+    file->io.ctx = file;
+    file->io.size = file->size;
+
+    return 0;
+}
+
+void smf_sd_close(smf_sd_file_t *file)
+{
+    if (file->open) {
+        sd_file_close(file->handle);
+        file->open = false;
+    }
+}
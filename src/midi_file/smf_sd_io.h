@@ -0,0 +1,30 @@
+#ifndef SMF_SD_IO_H
+#define SMF_SD_IO_H
+
+#include <zephyr/types.h>
+
+#include "smf_parser.h"
+
+// A file on the SD card opened for the SMF parser. All track cursors of one
+// song share it; every window refill is a seek plus one read of a pool file.
+typedef struct {
+    int handle;             // in the SD file pool
+    bool open;
+    uint32_t size;
+    uint32_t reads;         // f_read calls, for sizing the track windows
+    smf_io_t io;
+} smf_sd_file_t;
+
+/**
+ * @brief Open @p path (e.g. "SD:/MIDI/1_TRACK.mid") for streaming reads
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int smf_sd_open(smf_sd_file_t *file, const char *path);
+
+/**
+ * @brief Close a file opened with smf_sd_open()
+ */
+void smf_sd_close(smf_sd_file_t *file);
+
+#endif // SMF_SD_IO_H
@@ -0,0 +1,262 @@
+// smk_index.c
+#include <errno.h>
+#include <string.h>
+
+#include "smk_index.h"
+
+// Encoded keyframe: 16 bytes of times, 9 per track, 48 of channel state,
+// 2 + 3 per note, zero padded to SMK_KEYFRAME_SIZE
+#define SMK_KF_TRACKS_OFS   16
+#define SMK_KF_CHANNELS_OFS (SMK_KF_TRACKS_OFS + SMF_MAX_TRACKS * 9)
+#define SMK_KF_NOTES_OFS    (SMK_KF_CHANNELS_OFS + 3 * 16)
+#define SMK_KF_USED         (SMK_KF_NOTES_OFS + 2 + SMK_KEYFRAME_MAX_NOTES * 3)
+
+_Static_assert(SMK_KF_USED <= SMK_KEYFRAME_SIZE, "keyframe doesn't fit SMK_KEYFRAME_SIZE");
+
+static void put_le16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = v >> 24;
+}
+
+static uint16_t get_le16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+void smk_header_encode(const smk_header_t *hdr, uint8_t out[SMK_HEADER_SIZE])
+{
+    memset(out, 0, SMK_HEADER_SIZE);
+    put_le32(&out[0], hdr->magic);
+    put_le16(&out[4], hdr->version);
+    put_le16(&out[6], hdr->keyframe_size);
+    put_le32(&out[8], hdr->src.size);
+    put_le32(&out[12], hdr->src.mtime);
+    put_le32(&out[16], hdr->count);
+    put_le32(&out[20], hdr->interval_ticks);
+    put_le16(&out[24], hdr->division);
+    put_le16(&out[26], hdr->ntracks);
+}
+
+int smk_header_decode(const uint8_t in[SMK_HEADER_SIZE], smk_header_t *hdr)
+{
+    hdr->magic = get_le32(&in[0]);
+    hdr->version = get_le16(&in[4]);
+    hdr->keyframe_size = get_le16(&in[6]);
+    hdr->src.size = get_le32(&in[8]);
+    hdr->src.mtime = get_le32(&in[12]);
+    hdr->count = get_le32(&in[16]);
+    hdr->interval_ticks = get_le32(&in[20]);
+    hdr->division = get_le16(&in[24]);
+    hdr->ntracks = get_le16(&in[26]);
+
+    // Written last, like the .smc header
+    if (hdr->magic != SMK_MAGIC || hdr->version != SMK_VERSION ||
+        hdr->keyframe_size != SMK_KEYFRAME_SIZE) {
+        return -EBADMSG;
+    }
+
+    return 0;
+}
+
+void smk_keyframe_encode(const smk_keyframe_t *kf, uint8_t out[SMK_KEYFRAME_SIZE])
+{
+    memset(out, 0, SMK_KEYFRAME_SIZE);
+    put_le32(&out[0], kf->tick);
+    put_le32(&out[4], kf->time_us);
+    put_le32(&out[8], kf->tempo_us);
+    put_le32(&out[12], kf->record);
+
+    for (int t = 0; t < SMF_MAX_TRACKS; t++) {
+        uint8_t *p = &out[SMK_KF_TRACKS_OFS + t * 9];
+        put_le32(&p[0], kf->track[t].pos);
+        put_le32(&p[4], kf->track[t].tick);
+        p[8] = kf->track[t].running_status;
+    }
+
+    memcpy(&out[SMK_KF_CHANNELS_OFS], kf->program, 16);
+    memcpy(&out[SMK_KF_CHANNELS_OFS + 16], kf->bank, 16);
+    memcpy(&out[SMK_KF_CHANNELS_OFS + 32], kf->volume, 16);
+
+    uint8_t *p = &out[SMK_KF_NOTES_OFS];
+    p[0] = kf->note_count;
+    p[1] = kf->notes_dropped;
+    for (int i = 0; i < kf->note_count; i++) {
+        p[2 + i * 3] = kf->notes[i].chan;
+        p[3 + i * 3] = kf->notes[i].note;
+        p[4 + i * 3] = kf->notes[i].vel;
+    }
+}
+
+void smk_keyframe_decode(const uint8_t in[SMK_KEYFRAME_SIZE], smk_keyframe_t *kf)
+{
+    kf->tick = get_le32(&in[0]);
+    kf->time_us = get_le32(&in[4]);
+    kf->tempo_us = get_le32(&in[8]);
+    kf->record = get_le32(&in[12]);
+
+    for (int t = 0; t < SMF_MAX_TRACKS; t++) {
+        const uint8_t *p = &in[SMK_KF_TRACKS_OFS + t * 9];
+        kf->track[t].pos = get_le32(&p[0]);
+        kf->track[t].tick = get_le32(&p[4]);
+        kf->track[t].running_status = p[8];
+    }
+
+    memcpy(kf->program, &in[SMK_KF_CHANNELS_OFS], 16);
+    memcpy(kf->bank, &in[SMK_KF_CHANNELS_OFS + 16], 16);
+    memcpy(kf->volume, &in[SMK_KF_CHANNELS_OFS + 32], 16);
+
+    const uint8_t *p = &in[SMK_KF_NOTES_OFS];
+    kf->note_count = p[0] < SMK_KEYFRAME_MAX_NOTES ? p[0] : SMK_KEYFRAME_MAX_NOTES;
+    kf->notes_dropped = p[1];
+    for (int i = 0; i < kf->note_count; i++) {
+        kf->notes[i].chan = p[2 + i * 3];
+        kf->notes[i].note = p[3 + i * 3];
+        kf->notes[i].vel = p[4 + i * 3];
+    }
+}
+
+void smk_state_init(smk_keyframe_t *state)
+{
+    memset(state, 0, sizeof(*state));
+    state->tempo_us = SMF_DEFAULT_TEMPO_US;
+    memset(state->program, SMK_UNSET, sizeof(state->program));
+    memset(state->bank, SMK_UNSET, sizeof(state->bank));
+    memset(state->volume, SMK_UNSET, sizeof(state->volume));
+}
+
+static void smk_note_release(smk_keyframe_t *state, uint8_t chan, int note)
+{
+    for (int i = 0; i < state->note_count; i++) {
+        if (state->notes[i].chan == chan && (note < 0 || state->notes[i].note == note)) {
+            state->notes[i] = state->notes[--state->note_count];
+            i--;
+        }
+    }
+}
+
+void smk_state_apply(smk_keyframe_t *state, uint8_t status, uint8_t data1, uint8_t data2)
+{
+    uint8_t chan = status & 0x0F;
+
+    switch (status & 0xF0) {
+    case 0x90:
+        if (data2 > 0) {
+            // Retrigger keeps one entry with the newer velocity
+            smk_note_release(state, chan, data1);
+            if (state->note_count < SMK_KEYFRAME_MAX_NOTES) {
+                state->notes[state->note_count++] = (smk_note_t){ chan, data1, data2 };
+            } else {
+                state->notes_dropped = true;
+            }
+            break;
+        }
+        // Note On with velocity 0 is a Note Off
+        // fall through
+    case 0x80:
+        smk_note_release(state, chan, data1);
+        break;
+    case 0xB0:
+        if (data1 == 0x00) {
+            state->bank[chan] = data2;
+        } else if (data1 == 0x07) {
+            state->volume[chan] = data2;
+        } else if (data1 == 0x78 || data1 == 0x7B) {
+            // All Sound Off / All Notes Off
+            smk_note_release(state, chan, -1);
+        }
+        break;
+    case 0xC0:
+        state->program[chan] = data1;
+        break;
+    default:
+        break;
+    }
+}
+
+void smk_builder_init(smk_builder_t *b, uint16_t division)
+{
+    memset(b, 0, sizeof(*b));
+    smk_state_init(&b->state);
+    b->interval_ticks = (uint32_t)division * SMK_KEYFRAME_BEATS;
+}
+
+bool smk_builder_due(const smk_builder_t *b, uint32_t tick)
+{
+    return tick >= b->next_tick;
+}
+
+void smk_builder_take(smk_builder_t *b, const smf_merge_t *m, uint32_t tick, uint32_t time_us,
+                      uint32_t tempo_us, uint32_t record, uint8_t out[SMK_KEYFRAME_SIZE])
+{
+    smk_keyframe_t *kf = &b->state;
+
+    kf->tick = tick;
+    kf->time_us = time_us;
+    kf->tempo_us = tempo_us;
+    kf->record = record;
+    memset(kf->track, 0, sizeof(kf->track));
+    smf_merge_save(m, kf->track);
+
+    smk_keyframe_encode(kf, out);
+    b->count++;
+
+    // Next one on the following boundary; gaps in the song just get none
+    b->next_tick = (tick / b->interval_ticks + 1) * b->interval_ticks;
+}
+
+static int smk_read_keyframe(const smf_io_t *io, uint32_t index, uint8_t *raw, uint32_t len)
+{
+    int ret = io->read(io->ctx, SMK_HEADER_SIZE + index * SMK_KEYFRAME_SIZE, raw, len);
+    if (ret < 0) {
+        return ret;
+    }
+    return (uint32_t)ret == len ? 0 : -EBADMSG;
+}
+
+int smk_find(const smf_io_t *io, const smk_header_t *hdr, uint32_t time_us, smk_keyframe_t *kf)
+{
+    uint8_t raw[SMK_KEYFRAME_SIZE];
+    uint32_t lo = 0;
+    uint32_t hi;
+    int ret;
+
+    if (hdr->count == 0) {
+        return -ENOENT;
+    }
+
+    // Binary search on each keyframe's leading tick/time, 8 bytes per probe
+    hi = hdr->count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        ret = smk_read_keyframe(io, mid, raw, 8);
+        if (ret) {
+            return ret;
+        }
+        if (get_le32(&raw[4]) <= time_us) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    ret = smk_read_keyframe(io, lo, raw, sizeof(raw));
+    if (ret) {
+        return ret;
+    }
+    smk_keyframe_decode(raw, kf);
+    return 0;
+}
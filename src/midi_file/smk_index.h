@@ -0,0 +1,123 @@
+#ifndef SMK_INDEX_H
+#define SMK_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smf_parser.h"
+#include "smf_merge.h"
+#include "smc_format.h"
+
+/*
+ * .smk: keyframe index of a song, built alongside its .smc. A keyframe is a
+ * snapshot taken every few beats of everything needed to start playing from
+ * that point: where each track's parser is, which .smc record comes next,
+ * the tempo, the program/bank/volume of every channel and the notes that
+ * are sounding. Resuming or scrubbing is then one seek plus replaying that
+ * state, instead of parsing from the top.
+ *
+ *   header     SMK_HEADER_SIZE bytes
+ *   keyframes  count x SMK_KEYFRAME_SIZE bytes, in time order
+ */
+
+#define SMK_MAGIC               0x314B4D53  // "SMK1"
+#define SMK_VERSION             1
+#define SMK_HEADER_SIZE         32
+#define SMK_KEYFRAME_SIZE       320
+#define SMK_EXTENSION           ".smk"
+
+// Beats between keyframes
+#define SMK_KEYFRAME_BEATS      4
+// Sounding notes a keyframe remembers, more are dropped
+#define SMK_KEYFRAME_MAX_NOTES  32
+// program/bank/volume not set yet
+#define SMK_UNSET               0xFF
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t keyframe_size;
+    smc_source_info_t src;
+    uint32_t count;
+    uint32_t interval_ticks;
+    uint16_t division;
+    uint16_t ntracks;
+} smk_header_t;
+
+typedef struct {
+    uint8_t chan;
+    uint8_t note;
+    uint8_t vel;
+} smk_note_t;
+
+typedef struct {
+    uint32_t tick;
+    uint32_t time_us;
+    uint32_t tempo_us;
+    uint32_t record;        // index of the first .smc record at or after tick
+    smf_track_state_t track[SMF_MAX_TRACKS];
+    uint8_t program[16];
+    uint8_t bank[16];
+    uint8_t volume[16];
+    uint8_t note_count;
+    bool notes_dropped;
+    smk_note_t notes[SMK_KEYFRAME_MAX_NOTES];
+} smk_keyframe_t;
+
+// Running channel state while a song is parsed, plus where the next keyframe is due
+typedef struct {
+    smk_keyframe_t state;
+    uint32_t interval_ticks;
+    uint32_t next_tick;
+    uint32_t count;
+} smk_builder_t;
+
+void smk_header_encode(const smk_header_t *hdr, uint8_t out[SMK_HEADER_SIZE]);
+
+/**
+ * @brief Decode and sanity check a header
+ *
+ * @return int 0 on success, -EBADMSG if it isn't a complete .smk of this version
+ */
+int smk_header_decode(const uint8_t in[SMK_HEADER_SIZE], smk_header_t *hdr);
+
+void smk_keyframe_encode(const smk_keyframe_t *kf, uint8_t out[SMK_KEYFRAME_SIZE]);
+void smk_keyframe_decode(const uint8_t in[SMK_KEYFRAME_SIZE], smk_keyframe_t *kf);
+
+/**
+ * @brief Start from the state at the top of a song
+ */
+void smk_state_init(smk_keyframe_t *state);
+
+/**
+ * @brief Apply one channel message to a running state
+ */
+void smk_state_apply(smk_keyframe_t *state, uint8_t status, uint8_t data1, uint8_t data2);
+
+void smk_builder_init(smk_builder_t *b, uint16_t division);
+
+/**
+ * @brief Check whether a keyframe should be taken before the event at @p tick
+ */
+bool smk_builder_due(const smk_builder_t *b, uint32_t tick);
+
+/**
+ * @brief Snapshot the running state and the merge position as the next keyframe
+ *
+ * Call with the merge positioned just before the event at @p tick.
+ *
+ * @param out Receives the encoded keyframe
+ */
+void smk_builder_take(smk_builder_t *b, const smf_merge_t *m, uint32_t tick, uint32_t time_us,
+                      uint32_t tempo_us, uint32_t record, uint8_t out[SMK_KEYFRAME_SIZE]);
+
+/**
+ * @brief Find the last keyframe at or before song time @p time_us
+ *
+ * @param io The .smk
+ * @param kf Receives the keyframe
+ * @return int 0 on success, -ENOENT for an empty index, negative error code otherwise
+ */
+int smk_find(const smf_io_t *io, const smk_header_t *hdr, uint32_t time_us, smk_keyframe_t *kf);
+
+#endif // SMK_INDEX_H
@@ -0,0 +1,151 @@
+// tempo_map.c
+#include <errno.h>
+#include <string.h>
+
+#include "tempo_map.h"
+
+// Index of the last segment starting at or before @p tick
+static uint16_t tempo_map_find_tick(const tempo_map_t *map, uint32_t tick)
+{
+    uint16_t lo = 0;
+    uint16_t hi = map->count - 1;
+
+    while (lo < hi) {
+        uint16_t mid = (lo + hi + 1) / 2;
+        if (map->seg[mid].tick <= tick) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Index of the last segment starting at or before song time @p us
+static uint16_t tempo_map_find_us(const tempo_map_t *map, uint32_t us)
+{
+    uint16_t lo = 0;
+    uint16_t hi = map->count - 1;
+
+    while (lo < hi) {
+        uint16_t mid = (lo + hi + 1) / 2;
+        if (map->seg[mid].us <= us) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static uint32_t tempo_map_seg_us(const tempo_map_t *map, const tempo_segment_t *seg, uint32_t tick)
+{
+    uint64_t us = seg->us + (uint64_t)(tick - seg->tick) * seg->tempo_us / map->division;
+    return us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+// Start times of every segment from @p from on
+static void tempo_map_relink(tempo_map_t *map, uint16_t from)
+{
+    for (uint16_t i = from ? from : 1; i < map->count; i++) {
+        map->seg[i].us = tempo_map_seg_us(map, &map->seg[i - 1], map->seg[i].tick);
+    }
+}
+
+void tempo_map_init(tempo_map_t *map, tempo_segment_t *seg, uint16_t max, uint16_t division)
+{
+    memset(map, 0, sizeof(*map));
+    map->seg = seg;
+    map->max = max;
+    map->division = division ? division : 1;
+    map->count = 1;
+    seg[0] = (tempo_segment_t){ .tick = 0, .us = 0, .tempo_us = SMF_DEFAULT_TEMPO_US };
+}
+
+int tempo_map_add(tempo_map_t *map, uint32_t tick, uint32_t tempo_us)
+{
+    uint16_t i = tempo_map_find_tick(map, tick);
+
+    if (map->seg[i].tick == tick) {
+        map->seg[i].tempo_us = tempo_us;
+        tempo_map_relink(map, i + 1);
+        return 0;
+    }
+    if (map->seg[i].tempo_us == tempo_us) {
+        // Restates the tempo already in effect
+        return 0;
+    }
+    if (map->count == map->max) {
+        map->truncated = true;
+        return -ENOSPC;
+    }
+
+    // Usually appended, tracks are scanned in tick order
+    i++;
+    memmove(&map->seg[i + 1], &map->seg[i], (map->count - i) * sizeof(map->seg[0]));
+    map->seg[i] = (tempo_segment_t){ .tick = tick, .tempo_us = tempo_us };
+    map->count++;
+    tempo_map_relink(map, i);
+    return 0;
+}
+
+int tempo_map_build(tempo_map_t *map, const smf_file_t *smf, uint8_t *buf, uint16_t buf_size)
+{
+    smf_track_t trk;
+    smf_event_t ev;
+
+    for (uint8_t t = 0; t < smf->ntracks; t++) {
+        int ret = smf_track_init(&trk, smf, t, buf, buf_size);
+        if (ret) {
+            return ret;
+        }
+
+        while ((ret = smf_track_next(&trk, &ev)) == 1) {
+            if (ev.type == SMF_EVENT_META && ev.meta_type == SMF_META_TEMPO) {
+                tempo_map_add(map, ev.tick, smf_meta_tempo(&ev));
+            }
+        }
+        if (ret < 0) {
+            return ret;
+        }
+
+        if (trk.tick > map->end_tick) {
+            map->end_tick = trk.tick;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t tempo_map_tick_to_us(const tempo_map_t *map, uint32_t tick)
+{
+    return tempo_map_seg_us(map, &map->seg[tempo_map_find_tick(map, tick)], tick);
+}
+
+uint32_t tempo_map_us_to_tick(const tempo_map_t *map, uint32_t us)
+{
+    const tempo_segment_t *seg = &map->seg[tempo_map_find_us(map, us)];
+
+    // Last tick whose (rounded down) time isn't past @p us, so that
+    // tempo_map_us_to_tick(tempo_map_tick_to_us(t)) == t
+    uint64_t tick = seg->tick +
+                    ((uint64_t)(us - seg->us + 1) * map->division - 1) / seg->tempo_us;
+
+    return tick > UINT32_MAX ? UINT32_MAX : (uint32_t)tick;
+}
+
+uint32_t tempo_map_tempo_at(const tempo_map_t *map, uint32_t tick)
+{
+    return map->seg[tempo_map_find_tick(map, tick)].tempo_us;
+}
+
+uint16_t tempo_map_bpm_at(const tempo_map_t *map, uint32_t tick)
+{
+    uint32_t tempo = tempo_map_tempo_at(map, tick);
+    return (uint16_t)((TEMPO_MAP_US_PER_MIN + tempo / 2) / tempo);
+}
+
+uint32_t tempo_map_duration_us(const tempo_map_t *map)
+{
+    return tempo_map_tick_to_us(map, map->end_tick);
+}
@@ -0,0 +1,90 @@
+#ifndef TEMPO_MAP_H
+#define TEMPO_MAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smf_parser.h"
+
+/*
+ * Tempo map of a song: every Set Tempo of every track, sorted by tick, with
+ * the song time each tempo starts at worked out up front. Converting between
+ * ticks and microseconds is then a binary search plus one multiply, in
+ * either direction, with no rescan of the events.
+ *
+ * Storage comes from the caller so a map can be sized for what it's used
+ * for (a whole song, or just the opening tempo).
+ */
+
+// Segments for a full song; ritardandos written as tempo ramps need a lot
+#define TEMPO_MAP_MAX_SEGMENTS  128
+
+#define TEMPO_MAP_US_PER_MIN    60000000
+
+// One stretch of constant tempo; µs per tick is tempo_us / division, kept
+// as a ratio so long songs don't drift from rounding
+typedef struct {
+    uint32_t tick;          // first tick of the segment
+    uint32_t us;            // song time at that tick
+    uint32_t tempo_us;      // µs per quarter note
+} tempo_segment_t;
+
+typedef struct {
+    tempo_segment_t *seg;
+    uint16_t max;
+    uint16_t count;
+    uint16_t division;      // ticks per quarter note
+    bool truncated;         // the song has more tempo changes than fit
+    uint32_t end_tick;      // last tick of the longest track (tempo_map_build() only)
+} tempo_map_t;
+
+/**
+ * @brief Start an empty map: the default tempo from tick 0
+ *
+ * @param seg Segment storage, at least one
+ */
+void tempo_map_init(tempo_map_t *map, tempo_segment_t *seg, uint16_t max, uint16_t division);
+
+/**
+ * @brief Add a tempo change; a change at a tick already in the map replaces it
+ *
+ * @return int 0 on success, -ENOSPC if the map is full (it is marked truncated)
+ */
+int tempo_map_add(tempo_map_t *map, uint32_t tick, uint32_t tempo_us);
+
+/**
+ * @brief Build the map from every track of @p smf
+ *
+ * Reads each track once through @p buf. A full map is not an error here;
+ * check map->truncated.
+ *
+ * @return int 0 on success, negative error code otherwise
+ */
+int tempo_map_build(tempo_map_t *map, const smf_file_t *smf, uint8_t *buf, uint16_t buf_size);
+
+/**
+ * @brief Song time at @p tick
+ */
+uint32_t tempo_map_tick_to_us(const tempo_map_t *map, uint32_t tick);
+
+/**
+ * @brief Tick that plays at song time @p us (rounded down)
+ */
+uint32_t tempo_map_us_to_tick(const tempo_map_t *map, uint32_t us);
+
+/**
+ * @brief Microseconds per quarter note in effect at @p tick
+ */
+uint32_t tempo_map_tempo_at(const tempo_map_t *map, uint32_t tick);
+
+/**
+ * @brief Tempo in effect at @p tick in (rounded) beats per minute
+ */
+uint16_t tempo_map_bpm_at(const tempo_map_t *map, uint32_t tick);
+
+/**
+ * @brief Length of the song, from tick 0 to map->end_tick
+ */
+uint32_t tempo_map_duration_us(const tempo_map_t *map);
+
+#endif // TEMPO_MAP_H
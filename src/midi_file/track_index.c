@@ -0,0 +1,348 @@
+// track_index.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <ff.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "track_index.h"
+#include "smf_sd_io.h"
+#include "hw_interface/sd_card_interface/sd_file_pool.h"
+#include "smf_merge.h"
+#include "smc_cache.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+
+LOG_MODULE_REGISTER(track_index, LOG_LEVEL_INF);
+
+// Saved as is; the index only ever lives on the device that wrote it
+typedef struct {
+    uint32_t magic;         // written last, so a partial index never loads
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t count;
+    uint32_t dir_stamp;     // FAT date << 16 | FAT time of the MIDI directory
+} track_index_header_t;
+
+typedef struct {
+    uint32_t name_hash;
+    uint32_t size;
+    uint32_t mtime;
+    track_meta_t meta;      // ntracks 0 marks a song that couldn't be parsed
+} track_index_record_t;
+
+BUILD_ASSERT(sizeof(track_index_record_t) == 32, "index records are saved as is");
+
+// The UI reads entries while boot may still be building them
+static K_MUTEX_DEFINE(track_index_mutex);
+static track_index_record_t track_index[TRACK_INDEX_MAX_TRACKS];
+static uint16_t track_index_count;
+
+static int track_index_file;     // pool handle while the saved index is open
+static smf_sd_file_t track_index_src;
+static tempo_segment_t track_index_segs[TEMPO_MAP_MAX_SEGMENTS];
+static uint8_t track_index_buf[SMF_MERGE_MAX_WINDOW];
+
+// FNV-1a, to recognise a song's entry without keeping its name
+static uint32_t track_index_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+static int track_index_stamp(const char *path, uint32_t *size, uint32_t *mtime)
+{
+    FILINFO info;
+
+    if (f_stat(path, &info) != FR_OK) {
+        return -ENOENT;
+    }
+    if (size) {
+        *size = info.fsize;
+    }
+    *mtime = ((uint32_t)info.fdate << 16) | info.ftime;
+    return 0;
+}
+
+static bool track_index_read(void *buf, size_t len)
+{
+    return sd_file_read(track_index_file, buf, len) == (int)len;
+}
+
+static bool track_index_write(const void *buf, size_t len)
+{
+    return sd_file_write(track_index_file, buf, len) == 0;
+}
+
+static bool track_index_same_file(const track_index_record_t *a, const track_index_record_t *b)
+{
+    return a->name_hash == b->name_hash && a->size == b->size && a->mtime == b->mtime;
+}
+
+// Whether every loaded entry's size and timestamp still match its song, in
+// one pass over the directory rather than a lookup per song
+static bool track_index_current(uint16_t count)
+{
+    DIR dir;
+    FILINFO info;
+    char path[SMC_CACHE_PATH_LEN];
+    uint16_t matched = 0;
+    bool ok = true;
+
+    if (f_opendir(&dir, TRACK_INDEX_DIR) != FR_OK) {
+        return false;
+    }
+    while (ok && matched < count && f_readdir(&dir, &info) == FR_OK && info.fname[0] != 0) {
+        if (info.fattrib & AM_DIR) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", TRACK_INDEX_DIR, info.fname);
+        uint32_t hash = track_index_hash(path);
+
+        for (uint16_t t = 0; t < count; t++) {
+            if (track_index[t].name_hash == hash) {
+                ok = track_index[t].size == info.fsize &&
+                     track_index[t].mtime == (((uint32_t)info.fdate << 16) | info.ftime);
+                matched++;
+                break;
+            }
+        }
+    }
+    f_closedir(&dir);
+
+    return ok && matched == count;
+}
+
+// The saved index as is, if it was written for this directory and song list
+static bool track_index_load(uint16_t count, uint32_t dir_stamp)
+{
+    track_index_header_t hdr;
+    char path[SMC_CACHE_PATH_LEN];
+    bool ok = false;
+
+    track_index_file = sd_file_open(TRACK_INDEX_PATH, FA_READ);
+    if (track_index_file < 0) {
+        return false;
+    }
+    if (track_index_read(&hdr, sizeof(hdr)) && hdr.magic == TRACK_INDEX_MAGIC &&
+        hdr.version == TRACK_INDEX_VERSION && hdr.record_size == sizeof(track_index_record_t) &&
+        hdr.count == count && hdr.dir_stamp == dir_stamp) {
+        ok = track_index_read(track_index, count * sizeof(track_index_record_t));
+    }
+    sd_file_close(track_index_file);
+
+    // Same directory stamp, but make sure it still lists the same songs in the same order
+    for (uint16_t t = 0; ok && t < count; t++) {
+        ok = get_track_file_name(t + 1, path, sizeof(path)) == 0 &&
+             track_index[t].name_hash == track_index_hash(path);
+    }
+    // The directory stamp doesn't change when a song is rewritten in place
+    return ok && track_index_current(count);
+}
+
+// Take entries of songs that haven't changed from the saved index; false for the ones that did
+static void track_index_reuse(uint16_t count, bool *filled)
+{
+    track_index_header_t hdr;
+    track_index_record_t rec;
+
+    track_index_file = sd_file_open(TRACK_INDEX_PATH, FA_READ);
+    if (track_index_file < 0) {
+        return;
+    }
+    if (track_index_read(&hdr, sizeof(hdr)) && hdr.magic == TRACK_INDEX_MAGIC &&
+        hdr.version == TRACK_INDEX_VERSION && hdr.record_size == sizeof(rec)) {
+        for (uint32_t i = 0; i < hdr.count && track_index_read(&rec, sizeof(rec)); i++) {
+            for (uint16_t t = 0; t < count; t++) {
+                if (!filled[t] && track_index_same_file(&track_index[t], &rec)) {
+                    track_index[t].meta = rec.meta;
+                    filled[t] = true;
+                }
+            }
+        }
+    }
+    sd_file_close(track_index_file);
+}
+
+static int track_index_parse(const char *path, track_meta_t *meta)
+{
+    smf_file_t smf;
+    tempo_map_t map;
+
+    int ret = smf_sd_open(&track_index_src, path);
+    if (ret) {
+        return ret;
+    }
+
+    ret = smf_open(&smf, &track_index_src.io);
+    if (ret == 0) {
+        tempo_map_init(&map, track_index_segs, TEMPO_MAP_MAX_SEGMENTS, smf.division);
+        ret = track_meta_scan(&smf, &map, track_index_buf, sizeof(track_index_buf), meta);
+    }
+    smf_sd_close(&track_index_src);
+    return ret;
+}
+
+static int track_index_save(uint16_t count, uint32_t dir_stamp)
+{
+    track_index_header_t hdr = {
+        .magic = 0,
+        .version = TRACK_INDEX_VERSION,
+        .record_size = sizeof(track_index_record_t),
+        .count = count,
+        .dir_stamp = dir_stamp,
+    };
+    bool ok;
+
+    track_index_file = sd_file_open(TRACK_INDEX_PATH, FA_WRITE | FA_CREATE_ALWAYS);
+    if (track_index_file < 0) {
+        return -EIO;
+    }
+    ok = track_index_write(&hdr, sizeof(hdr)) &&
+         track_index_write(track_index, count * sizeof(track_index_record_t));
+    if (ok) {
+        hdr.magic = TRACK_INDEX_MAGIC;
+        ok = sd_file_seek(track_index_file, 0) == 0 && track_index_write(&hdr, sizeof(hdr));
+    }
+    sd_file_close(track_index_file);
+
+    if (!ok) {
+        f_unlink(TRACK_INDEX_PATH);
+        return -EIO;
+    }
+    return 0;
+}
+
+int track_index_build(void)
+{
+    static bool filled[TRACK_INDEX_MAX_TRACKS];
+    char path[SMC_CACHE_PATH_LEN];
+    uint16_t count = MIN(get_track_count(), TRACK_INDEX_MAX_TRACKS);
+    uint32_t dir_stamp = 0;
+    int parsed = 0;
+
+    int64_t start = k_uptime_get();
+    track_index_stamp(TRACK_INDEX_DIR, NULL, &dir_stamp);
+
+    k_mutex_lock(&track_index_mutex, K_FOREVER);
+
+    if (track_index_load(count, dir_stamp)) {
+        track_index_count = count;
+        k_mutex_unlock(&track_index_mutex);
+        LOG_INF("Track index of %d songs loaded in %lld ms", count, k_uptime_get() - start);
+        return 0;
+    }
+
+    track_index_count = 0;
+    for (uint16_t t = 0; t < count; t++) {
+        track_index_record_t *rec = &track_index[t];
+
+        memset(rec, 0, sizeof(*rec));
+        filled[t] = false;
+        if (get_track_file_name(t + 1, path, sizeof(path)) == 0) {
+            rec->name_hash = track_index_hash(path);
+            track_index_stamp(path, &rec->size, &rec->mtime);
+        }
+    }
+
+    track_index_reuse(count, filled);
+
+    for (uint16_t t = 0; t < count; t++) {
+        if (filled[t] || get_track_file_name(t + 1, path, sizeof(path)) != 0) {
+            continue;
+        }
+
+        int ret = track_index_parse(path, &track_index[t].meta);
+        if (ret) {
+            LOG_WRN("Can't index %s: %d", path, ret);
+            memset(&track_index[t].meta, 0, sizeof(track_meta_t));
+        }
+        parsed++;
+    }
+    track_index_count = count;
+
+    int ret = track_index_save(count, dir_stamp);
+    k_mutex_unlock(&track_index_mutex);
+
+    if (ret) {
+        LOG_ERR("Can't save %s: %d", TRACK_INDEX_PATH, ret);
+    }
+    LOG_INF("Track index of %d songs built in %lld ms, %d parsed", count,
+            k_uptime_get() - start, parsed);
+    return parsed;
+}
+
+int track_index_get(uint16_t track_number, track_meta_t *meta)
+{
+    int ret = 0;
+
+    k_mutex_lock(&track_index_mutex, K_FOREVER);
+    if (track_number == 0 || track_number > track_index_count) {
+        ret = -EINVAL;
+    } else if (track_index[track_number - 1].meta.ntracks == 0) {
+        ret = -EBADMSG;
+    } else {
+        *meta = track_index[track_number - 1].meta;
+    }
+    k_mutex_unlock(&track_index_mutex);
+
+    return ret;
+}
+
+#ifdef CONFIG_SHELL
+
+static int cmd_tracks_list(const struct shell *sh, size_t argc, char **argv)
+{
+    char path[SMC_CACHE_PATH_LEN];
+    track_meta_t meta;
+
+    for (uint16_t t = 1; t <= get_track_count(); t++) {
+        if (get_track_file_name(t, path, sizeof(path)) != 0) {
+            continue;
+        }
+        if (track_index_get(t, &meta) != 0) {
+            shell_print(sh, "%3u %s: not indexed", t, path);
+            continue;
+        }
+        shell_print(sh, "%3u %s: %u:%02u, %u BPM, %u/%u, key %d%s, %u notes, channels %04x, program %u",
+                    t, path, meta.duration_ms / 60000, (meta.duration_ms / 1000) % 60,
+                    track_meta_bpm(&meta), meta.time_sig_num, 1U << meta.time_sig_den,
+                    meta.key_sharps, meta.key_minor ? "m" : "", meta.note_count,
+                    meta.channels, meta.first_program);
+    }
+    return 0;
+}
+
+static int cmd_tracks_rescan(const struct shell *sh, size_t argc, char **argv)
+{
+    shell_print(sh, "%d songs found", rescan_midi_files());
+    int ret = track_index_build();
+    return ret < 0 ? ret : 0;
+}
+
+static int cmd_tracks_rebuild(const struct shell *sh, size_t argc, char **argv)
+{
+    f_unlink(TRACK_INDEX_PATH);
+    int ret = track_index_build();
+    if (ret < 0) {
+        return ret;
+    }
+    shell_print(sh, "%d songs parsed", ret);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_tracks,
+    SHELL_CMD(list, NULL, "Songs on the card with their metadata", cmd_tracks_list),
+    SHELL_CMD(rescan, NULL, "Walk the MIDI directory again", cmd_tracks_rescan),
+    SHELL_CMD(rebuild, NULL, "Throw the index away and parse every song", cmd_tracks_rebuild),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(tracks, &sub_tracks, "Song index", NULL);
+
+#endif // CONFIG_SHELL
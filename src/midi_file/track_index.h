@@ -0,0 +1,38 @@
+#ifndef TRACK_INDEX_H
+#define TRACK_INDEX_H
+
+#include <zephyr/types.h>
+
+#include "track_meta.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+
+/*
+ * Metadata of every song found by scan_midi_files(), kept in RAM and
+ * persisted to TRACK_INDEX_PATH so it survives a reboot. The saved index is
+ * used as is when it lists the same songs in the same order and each one's
+ * size and timestamp still match; otherwise each song's entry is reused if
+ * its size and timestamp still match, and only new or changed songs are parsed.
+ */
+
+#define TRACK_INDEX_PATH        "SD:/MIDI/index.bin"
+#define TRACK_INDEX_DIR         "SD:/MIDI"
+#define TRACK_INDEX_MAGIC       0x31584954  // "TIX1"
+#define TRACK_INDEX_VERSION     1
+#define TRACK_INDEX_MAX_TRACKS  MAX_SONG_FILES
+
+/**
+ * @brief Load or rebuild the index for the songs the last scan found
+ *
+ * @return int Number of songs that had to be parsed, negative error code otherwise
+ */
+int track_index_build(void);
+
+/**
+ * @brief Metadata of song @p track_number (1-based, as get_track_file_name())
+ *
+ * @return int 0 on success, -EINVAL if there is no such song, -EBADMSG if it
+ *         couldn't be parsed
+ */
+int track_index_get(uint16_t track_number, track_meta_t *meta);
+
+#endif // TRACK_INDEX_H
@@ -0,0 +1,86 @@
+// track_meta.c
+#include <errno.h>
+#include <string.h>
+
+#include "track_meta.h"
+
+// Earliest tick each opening value was seen at, so the order of the tracks doesn't matter
+typedef struct {
+    uint32_t time_sig;
+    uint32_t key_sig;
+    uint32_t program;
+} track_meta_seen_t;
+
+static void track_meta_event(const smf_event_t *ev, track_meta_t *meta, track_meta_seen_t *seen)
+{
+    if (ev->type == SMF_EVENT_META) {
+        if (ev->meta_type == SMF_META_TIME_SIG && ev->length >= 2 && ev->tick < seen->time_sig) {
+            seen->time_sig = ev->tick;
+            meta->time_sig_num = ev->data[0];
+            meta->time_sig_den = ev->data[1];
+        } else if (ev->meta_type == SMF_META_KEY_SIG && ev->length >= 2 && ev->tick < seen->key_sig) {
+            seen->key_sig = ev->tick;
+            meta->key_sharps = (int8_t)ev->data[0];
+            meta->key_minor = ev->data[1];
+        }
+        return;
+    }
+
+    if (ev->type != SMF_EVENT_MIDI) {
+        return;
+    }
+
+    uint8_t type = ev->status & 0xF0;
+    if (type == 0x90 && ev->data2 > 0) {
+        meta->note_count++;
+        meta->channels |= 1 << (ev->status & 0x0F);
+    } else if (type == 0xC0 && ev->tick < seen->program) {
+        seen->program = ev->tick;
+        meta->first_program = ev->data1;
+    }
+}
+
+int track_meta_scan(const smf_file_t *smf, tempo_map_t *map, uint8_t *buf, uint16_t buf_size,
+                    track_meta_t *meta)
+{
+    track_meta_seen_t seen = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
+    smf_track_t trk;
+    smf_event_t ev;
+    int ret;
+
+    memset(meta, 0, sizeof(*meta));
+    meta->time_sig_num = 4;
+    meta->time_sig_den = 2;
+    meta->first_program = TRACK_META_NO_PROGRAM;
+    meta->ntracks = smf->ntracks;
+
+    ret = tempo_map_build(map, smf, buf, buf_size);
+    if (ret) {
+        return ret;
+    }
+    meta->duration_ms = tempo_map_duration_us(map) / 1000;
+    meta->tempo_us = tempo_map_tempo_at(map, 0);
+
+    for (uint8_t t = 0; t < smf->ntracks; t++) {
+        ret = smf_track_init(&trk, smf, t, buf, buf_size);
+        if (ret) {
+            return ret;
+        }
+        while ((ret = smf_track_next(&trk, &ev)) == 1) {
+            track_meta_event(&ev, meta, &seen);
+        }
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+uint16_t track_meta_bpm(const track_meta_t *meta)
+{
+    if (meta->tempo_us == 0) {
+        return TEMPO_MAP_US_PER_MIN / SMF_DEFAULT_TEMPO_US;
+    }
+    return (TEMPO_MAP_US_PER_MIN + meta->tempo_us / 2) / meta->tempo_us;
+}
@@ -0,0 +1,48 @@
+#ifndef TRACK_META_H
+#define TRACK_META_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "smf_parser.h"
+#include "tempo_map.h"
+
+/*
+ * What the UI wants to know about a song without opening it: how long it
+ * is, how fast, its meter and key, which channels it uses and what it
+ * starts on. One pass over the file fills it in; the track index keeps it
+ * so switching songs never has to touch the .mid again.
+ */
+
+// first_program when the song never changes program
+#define TRACK_META_NO_PROGRAM   0xFF
+
+typedef struct {
+    uint32_t duration_ms;
+    uint32_t tempo_us;          // opening tempo, µs per quarter note
+    uint32_t note_count;        // note-ons with a velocity
+    uint16_t channels;          // bit n set if channel n plays notes
+    uint8_t time_sig_num;       // opening time signature, 4/4 if none
+    uint8_t time_sig_den;       // as a power of two, 2 for quarter notes
+    int8_t key_sharps;          // opening key, negative for flats
+    uint8_t key_minor;
+    uint8_t first_program;      // earliest program change, TRACK_META_NO_PROGRAM if none
+    uint8_t ntracks;
+} track_meta_t;
+
+/**
+ * @brief Collect the metadata of @p smf
+ *
+ * @param map Initialised tempo map for the song's division; built here
+ * @param buf Parse window for one track at a time
+ * @return int 0 on success, negative error code otherwise
+ */
+int track_meta_scan(const smf_file_t *smf, tempo_map_t *map, uint8_t *buf, uint16_t buf_size,
+                    track_meta_t *meta);
+
+/**
+ * @brief Opening tempo in whole BPM
+ */
+uint16_t track_meta_bpm(const track_meta_t *meta);
+
+#endif // TRACK_META_H
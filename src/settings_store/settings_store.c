@@ -0,0 +1,478 @@
+// settings_store.c
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/sys/byteorder.h>
+#include <ff.h>
+#include <errno.h>
+#include <string.h>
+
+#include "settings_store.h"
+#include "hw_interface/sd_card_interface/sd_file_pool.h"
+#include "hw_interface/sd_card_interface/sd_card_interface.h"
+#include "hw_interface/VS1053_interface/midi.h"
+
+LOG_MODULE_REGISTER(settings_store, LOG_LEVEL_INF);
+
+// MIDI octaves run 0-10
+#define SETTINGS_MAX_OCTAVE     10
+
+// The persistent part of fsm_struct
+typedef struct {
+    uint8_t input_mode;
+    uint8_t single_btn_play_mode;
+    uint8_t multi_btn_play_mode;
+    uint8_t ble_play_mode;
+    uint8_t instrument;
+    uint8_t octave;
+    uint16_t tempo;
+    uint16_t current_track;
+} settings_data_t;
+
+/*
+ * Record layout, little-endian:
+ *   0  magic       4  version     6  payload length     8  sequence
+ *  12  payload (settings_data_t fields in order)       28  CRC-32 of bytes 0-27
+ */
+#define SETTINGS_PAYLOAD_OFFSET 12
+#define SETTINGS_PAYLOAD_SIZE   10
+#define SETTINGS_CRC_OFFSET     (SETTINGS_STORE_RECORD_SIZE - 4)
+
+static const settings_store_backend_t *settings_backend;
+
+// Guards everything below; the UI writes it, the flush work reads it
+static K_MUTEX_DEFINE(settings_mutex);
+static settings_data_t settings_saved;
+static settings_data_t settings_pending;
+static int64_t settings_dirty_since;
+static int settings_last_err;
+static settings_store_stats_t settings_stats;
+
+void settings_store_fit_track(fsm_struct *fsm, uint16_t count)
+{
+    fsm->total_tracks = count;
+
+    // The card may have lost songs since the track was picked; no card at
+    // all keeps it, the same card is likely back soon
+    if (count > 0 && fsm->current_track > count) {
+        LOG_INF("Track %u is not on this card, back to track 1", fsm->current_track);
+        fsm->current_track = 1;
+        fsm->previous_track = 1;
+        settings_store_mark_dirty(fsm);
+    }
+}
+
+static void settings_flush_work_fn(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(settings_flush_work, settings_flush_work_fn);
+
+static void settings_from_fsm(const fsm_struct *fsm, settings_data_t *data)
+{
+    memset(data, 0, sizeof(*data));
+    data->input_mode = fsm->input_mode;
+    data->single_btn_play_mode = fsm->play_mode.single_btn_play_mode;
+    data->multi_btn_play_mode = fsm->play_mode.multi_btn_play_mode;
+    data->ble_play_mode = fsm->play_mode.ble_play_mode;
+    data->instrument = fsm->instrument;
+    data->octave = fsm->octave;
+    data->tempo = fsm->tempo;
+    data->current_track = fsm->current_track;
+}
+
+static void settings_to_fsm(const settings_data_t *data, fsm_struct *fsm)
+{
+    fsm->input_mode = data->input_mode;
+    fsm->play_mode.single_btn_play_mode = data->single_btn_play_mode;
+    fsm->play_mode.multi_btn_play_mode = data->multi_btn_play_mode;
+    fsm->play_mode.ble_play_mode = data->ble_play_mode;
+    fsm->instrument = data->instrument;
+    fsm->octave = data->octave;
+    fsm->tempo = data->tempo;
+    fsm->current_track = data->current_track;
+    fsm->previous_track = data->current_track;
+}
+
+// A record that passes its CRC but holds values the UI can't show is still refused
+static bool settings_valid(const settings_data_t *data)
+{
+    return data->input_mode < NUM_PLAYMODES &&
+           data->single_btn_play_mode < NUM_SINGLE_PLAYBACK &&
+           data->multi_btn_play_mode < NUM_MULTI_PLAYBACK &&
+           data->ble_play_mode < NUM_BLE_PLAYBACK &&
+           data->instrument <= MAX_INSTRUMENTS &&
+           data->octave <= SETTINGS_MAX_OCTAVE &&
+           data->tempo >= MIN_TEMPO && data->tempo <= MAX_TEMPO &&
+           data->current_track >= 1;
+}
+
+static void settings_encode(const settings_data_t *data, uint32_t seq,
+                            uint8_t out[SETTINGS_STORE_RECORD_SIZE])
+{
+    uint8_t *p = &out[SETTINGS_PAYLOAD_OFFSET];
+
+    memset(out, 0, SETTINGS_STORE_RECORD_SIZE);
+    sys_put_le32(SETTINGS_STORE_MAGIC, &out[0]);
+    sys_put_le16(SETTINGS_STORE_VERSION, &out[4]);
+    sys_put_le16(SETTINGS_PAYLOAD_SIZE, &out[6]);
+    sys_put_le32(seq, &out[8]);
+
+    p[0] = data->input_mode;
+    p[1] = data->single_btn_play_mode;
+    p[2] = data->multi_btn_play_mode;
+    p[3] = data->ble_play_mode;
+    p[4] = data->instrument;
+    p[5] = data->octave;
+    sys_put_le16(data->tempo, &p[6]);
+    sys_put_le16(data->current_track, &p[8]);
+
+    sys_put_le32(crc32_ieee(out, SETTINGS_CRC_OFFSET), &out[SETTINGS_CRC_OFFSET]);
+}
+
+/**
+ * @brief Check and unpack one slot
+ *
+ * @return int 0 on success, -EBADMSG if the slot is empty, torn or from another version
+ */
+static int settings_decode(const uint8_t in[SETTINGS_STORE_RECORD_SIZE], int len,
+                           settings_data_t *data, uint32_t *seq)
+{
+    const uint8_t *p = &in[SETTINGS_PAYLOAD_OFFSET];
+
+    if (len != SETTINGS_STORE_RECORD_SIZE ||
+        sys_get_le32(&in[0]) != SETTINGS_STORE_MAGIC ||
+        sys_get_le16(&in[4]) != SETTINGS_STORE_VERSION ||
+        sys_get_le16(&in[6]) != SETTINGS_PAYLOAD_SIZE ||
+        sys_get_le32(&in[SETTINGS_CRC_OFFSET]) != crc32_ieee(in, SETTINGS_CRC_OFFSET)) {
+        return -EBADMSG;
+    }
+
+    *seq = sys_get_le32(&in[8]);
+    data->input_mode = p[0];
+    data->single_btn_play_mode = p[1];
+    data->multi_btn_play_mode = p[2];
+    data->ble_play_mode = p[3];
+    data->instrument = p[4];
+    data->octave = p[5];
+    data->tempo = sys_get_le16(&p[6]);
+    data->current_track = sys_get_le16(&p[8]);
+
+    return settings_valid(data) ? 0 : -EBADMSG;
+}
+
+int settings_store_init(const settings_store_backend_t *backend, fsm_struct *fsm)
+{
+    uint8_t raw[SETTINGS_STORE_RECORD_SIZE];
+    settings_data_t data;
+    settings_data_t best;
+    uint32_t seq;
+    uint32_t best_seq = 0;
+    int best_slot = -1;
+
+    settings_backend = backend;
+
+    int ret = backend->init();
+    if (ret < 0) {
+        LOG_ERR("Settings backend %s failed to start: %d", backend->name, ret);
+        settings_backend = NULL;
+        return ret;
+    }
+
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        ret = backend->read(slot, raw, sizeof(raw));
+        if (ret < 0) {
+            LOG_WRN("Settings slot %u unreadable: %d", slot, ret);
+            continue;
+        }
+        if (settings_decode(raw, ret, &data, &seq) != 0) {
+            continue;
+        }
+        // Signed difference so the newer slot still wins after the counter wraps
+        if (best_slot < 0 || (int32_t)(seq - best_seq) > 0) {
+            best = data;
+            best_seq = seq;
+            best_slot = slot;
+        }
+    }
+
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    if (best_slot >= 0) {
+        settings_to_fsm(&best, fsm);
+        settings_stats.seq = best_seq;
+    }
+    settings_from_fsm(fsm, &settings_saved);
+    settings_pending = settings_saved;
+    k_mutex_unlock(&settings_mutex);
+
+    if (best_slot < 0) {
+        LOG_INF("No saved settings in %s, using defaults", backend->name);
+        return -ENOENT;
+    }
+
+    LOG_INF("Settings loaded from %s slot %d (seq %u)", backend->name, best_slot, best_seq);
+    return 0;
+}
+
+void settings_store_mark_dirty(const fsm_struct *fsm)
+{
+    settings_data_t data;
+
+    if (settings_backend == NULL) {
+        return;
+    }
+
+    settings_from_fsm(fsm, &data);
+
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    if (memcmp(&data, &settings_pending, sizeof(data)) == 0) {
+        k_mutex_unlock(&settings_mutex);
+        return;
+    }
+
+    settings_pending = data;
+    int64_t now = k_uptime_get();
+    if (settings_stats.dirty) {
+        settings_stats.coalesced++;
+    } else {
+        settings_stats.dirty = true;
+        settings_dirty_since = now;
+    }
+
+    // Push the write back while changes keep coming, but not forever
+    int64_t delay = SETTINGS_STORE_MAX_DELAY_MS - (now - settings_dirty_since);
+    delay = CLAMP(delay, 0, SETTINGS_STORE_QUIET_MS);
+    k_work_reschedule(&settings_flush_work, K_MSEC(delay));
+    k_mutex_unlock(&settings_mutex);
+}
+
+static void settings_flush_work_fn(struct k_work *work)
+{
+    uint8_t raw[SETTINGS_STORE_RECORD_SIZE];
+    settings_data_t data;
+
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    if (!settings_stats.dirty) {
+        settings_last_err = 0;
+        k_mutex_unlock(&settings_mutex);
+        return;
+    }
+    data = settings_pending;
+    uint32_t seq = settings_stats.seq + 1;
+    k_mutex_unlock(&settings_mutex);
+
+    // Settings that were changed and changed back don't need a write
+    int ret = 0;
+    if (memcmp(&data, &settings_saved, sizeof(data)) != 0) {
+        settings_encode(&data, seq, raw);
+        // Always overwrite the older slot, never the one holding the newest record
+        ret = settings_backend->write(seq & 1, raw, sizeof(raw));
+    }
+
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    settings_last_err = ret;
+    if (ret < 0) {
+        settings_stats.errors++;
+        LOG_ERR("Failed to save settings to %s: %d", settings_backend->name, ret);
+        // Stay dirty and try again later
+        k_work_reschedule(&settings_flush_work, K_MSEC(SETTINGS_STORE_QUIET_MS));
+    } else {
+        if (memcmp(&data, &settings_saved, sizeof(data)) != 0) {
+            settings_saved = data;
+            settings_stats.seq = seq;
+            settings_stats.saves++;
+            LOG_DBG("Settings saved, seq %u", seq);
+        }
+        // A change that landed during the write has its own work scheduled
+        if (memcmp(&settings_pending, &settings_saved, sizeof(data)) == 0) {
+            settings_stats.dirty = false;
+        }
+    }
+    k_mutex_unlock(&settings_mutex);
+}
+
+int settings_store_flush(void)
+{
+    struct k_work_sync sync;
+
+    if (settings_backend == NULL) {
+        return -ENODEV;
+    }
+
+    k_work_reschedule(&settings_flush_work, K_NO_WAIT);
+    k_work_flush_delayable(&settings_flush_work, &sync);
+
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    int ret = settings_last_err;
+    k_mutex_unlock(&settings_mutex);
+    return ret;
+}
+
+void settings_store_get_stats(settings_store_stats_t *stats)
+{
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    *stats = settings_stats;
+    k_mutex_unlock(&settings_mutex);
+}
+
+//
+// NVS backend: one settings subsystem key per slot
+//
+
+static int settings_nvs_init(void)
+{
+    return settings_subsys_init();
+}
+
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    int len;
+} settings_nvs_read_t;
+
+static int settings_nvs_load_cb(const char *key, size_t len, settings_read_cb read_cb,
+                                void *cb_arg, void *param)
+{
+    settings_nvs_read_t *rd = param;
+
+    // Only the slot key itself, not anything below it
+    if (key != NULL) {
+        return 0;
+    }
+    if (len > rd->size) {
+        // Not one of our records; let the decode reject it
+        rd->len = len;
+        return 0;
+    }
+
+    rd->len = read_cb(cb_arg, rd->buf, len);
+    return 0;
+}
+
+static int settings_nvs_read(uint8_t slot, uint8_t *buf, size_t len)
+{
+    settings_nvs_read_t rd = { .buf = buf, .size = len, .len = 0 };
+
+    int ret = settings_load_subtree_direct(slot ? SETTINGS_STORE_NVS_KEY_B : SETTINGS_STORE_NVS_KEY_A,
+                                           settings_nvs_load_cb, &rd);
+    if (ret < 0) {
+        return ret;
+    }
+    return rd.len;
+}
+
+static int settings_nvs_write(uint8_t slot, const uint8_t *buf, size_t len)
+{
+    return settings_save_one(slot ? SETTINGS_STORE_NVS_KEY_B : SETTINGS_STORE_NVS_KEY_A, buf, len);
+}
+
+const settings_store_backend_t settings_store_backend_nvs = {
+    .name = "nvs",
+    .init = settings_nvs_init,
+    .read = settings_nvs_read,
+    .write = settings_nvs_write,
+};
+
+//
+// SD backend: one file, a slot per sector so a torn write can't reach the other
+//
+
+static int settings_sd_init(void)
+{
+    return 0;
+}
+
+static int settings_sd_read(uint8_t slot, uint8_t *buf, size_t len)
+{
+    int file = sd_file_open(SETTINGS_STORE_SD_FILE, FA_READ);
+    if (file == -ENOENT) {
+        return 0;
+    }
+    if (file < 0) {
+        return file;
+    }
+
+    uint32_t offset = slot * SETTINGS_STORE_SD_SLOT_SPAN;
+    int ret = sd_file_size(file);
+    if (ret >= 0 && (uint32_t)ret < offset + len) {
+        // Slot B is only there once it has been written
+        ret = 0;
+    } else if (ret >= 0) {
+        ret = sd_file_seek(file, offset);
+        if (ret == 0) {
+            ret = sd_file_read(file, buf, len);
+        }
+    }
+
+    sd_file_close(file);
+    return ret;
+}
+
+static int settings_sd_write(uint8_t slot, const uint8_t *buf, size_t len)
+{
+    int file = sd_file_open(SETTINGS_STORE_SD_FILE, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if (file < 0) {
+        return file;
+    }
+
+    // Seeking past the end grows the file, so slot B can be written first
+    int ret = sd_file_seek(file, slot * SETTINGS_STORE_SD_SLOT_SPAN);
+    if (ret == 0) {
+        ret = sd_file_write(file, buf, len);
+    }
+
+    // Closing syncs the file, so the slot is on the card once this returns
+    int err = sd_file_close(file);
+    return ret < 0 ? ret : err;
+}
+
+const settings_store_backend_t settings_store_backend_sd = {
+    .name = "sd",
+    .init = settings_sd_init,
+    .read = settings_sd_read,
+    .write = settings_sd_write,
+};
+
+#ifdef CONFIG_SHELL
+
+static int cmd_prefs_stats(const struct shell *sh, size_t argc, char **argv)
+{
+    settings_store_stats_t stats;
+    settings_data_t saved;
+
+    settings_store_get_stats(&stats);
+    k_mutex_lock(&settings_mutex, K_FOREVER);
+    saved = settings_saved;
+    k_mutex_unlock(&settings_mutex);
+
+    shell_print(sh, "backend %s, seq %u (slot %u), %s",
+                settings_backend ? settings_backend->name : "none",
+                stats.seq, stats.seq & 1, stats.dirty ? "dirty" : "clean");
+    shell_print(sh, "saves %u, coalesced %u, errors %u",
+                stats.saves, stats.coalesced, stats.errors);
+    shell_print(sh, "saved: mode %u, play %u/%u/%u, instrument %u, octave %u, tempo %u, track %u",
+                saved.input_mode, saved.single_btn_play_mode, saved.multi_btn_play_mode,
+                saved.ble_play_mode, saved.instrument, saved.octave, saved.tempo,
+                saved.current_track);
+    return 0;
+}
+
+static int cmd_prefs_save(const struct shell *sh, size_t argc, char **argv)
+{
+    int ret = settings_store_flush();
+    if (ret < 0) {
+        shell_error(sh, "Save failed: %d", ret);
+        return ret;
+    }
+    shell_print(sh, "Settings saved");
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_prefs,
+    SHELL_CMD(stats, NULL, "Saved settings and write counters", cmd_prefs_stats),
+    SHELL_CMD(save, NULL, "Write pending changes now", cmd_prefs_save),
+    SHELL_SUBCMD_SET_END
+);
+
+SHELL_CMD_REGISTER(prefs, &sub_prefs, "Persistent user settings", NULL);
+
+#endif // CONFIG_SHELL
@@ -0,0 +1,114 @@
+#ifndef SETTINGS_STORE_H
+#define SETTINGS_STORE_H
+
+#include <zephyr/types.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "state_machine_defs.h"
+
+/*
+ * The user's settings (input mode, play modes, instrument, tempo, octave and
+ * song) kept across power cycles. The UI only marks them changed; a write
+ * happens once the knobs have been left alone for SETTINGS_STORE_QUIET_MS, so
+ * a burst of encoder turns costs one write and the UI never waits on storage.
+ *
+ * Each write is a small versioned record with a sequence number and CRC,
+ * written alternately to two slots. A write cut short by power loss only
+ * damages the older slot, and loading takes the newest slot that checks out.
+ */
+
+// Idle time after the last change before settings are written
+#define SETTINGS_STORE_QUIET_MS     3000
+// Longest settings can stay unsaved while they keep changing
+#define SETTINGS_STORE_MAX_DELAY_MS 30000
+
+#define SETTINGS_STORE_MAGIC        0x31544553  // "SET1"
+#define SETTINGS_STORE_VERSION      1
+// Encoded size of one slot
+#define SETTINGS_STORE_RECORD_SIZE  32
+
+// SD backend: both slots in one file, each in its own sector
+#define SETTINGS_STORE_SD_FILE      "SD:/settings.bin"
+#define SETTINGS_STORE_SD_SLOT_SPAN 512
+// NVS backend: settings subsystem key of each slot
+#define SETTINGS_STORE_NVS_KEY_A    "sami/set/a"
+#define SETTINGS_STORE_NVS_KEY_B    "sami/set/b"
+
+// Where settings are kept
+typedef struct {
+    const char *name;
+
+    /**
+     * @brief Get the storage ready, called once from settings_store_init()
+     *
+     * @return int 0 on success, negative error code otherwise
+     */
+    int (*init)(void);
+
+    /**
+     * @brief Read slot @p slot (0 or 1)
+     *
+     * @return int Bytes read, 0 if the slot was never written, negative error code otherwise
+     */
+    int (*read)(uint8_t slot, uint8_t *buf, size_t len);
+
+    /**
+     * @brief Replace slot @p slot (0 or 1)
+     *
+     * @return int 0 on success, negative error code otherwise
+     */
+    int (*write)(uint8_t slot, const uint8_t *buf, size_t len);
+} settings_store_backend_t;
+
+// Internal flash through the settings subsystem; doesn't need a card
+extern const settings_store_backend_t settings_store_backend_nvs;
+// A file on the SD card; the settings travel with the card
+extern const settings_store_backend_t settings_store_backend_sd;
+
+#define SETTINGS_STORE_DEFAULT_BACKEND  (&settings_store_backend_nvs)
+
+typedef struct {
+    uint32_t seq;           // sequence number of the newest saved record
+    uint32_t saves;
+    uint32_t coalesced;     // changes folded into a write that was already pending
+    uint32_t errors;
+    bool dirty;
+} settings_store_stats_t;
+
+/**
+ * @brief Pick a backend and load the saved settings into @p fsm
+ *
+ * If neither slot holds a valid record @p fsm keeps its defaults.
+ *
+ * @param backend Where settings live, e.g. SETTINGS_STORE_DEFAULT_BACKEND
+ * @return int 0 if settings were loaded, -ENOENT if none were saved, negative error code otherwise
+ */
+int settings_store_init(const settings_store_backend_t *backend, fsm_struct *fsm);
+
+/**
+ * @brief Note that the settings in @p fsm may have changed
+ *
+ * Cheap enough to call on every UI redraw: nothing is scheduled unless a
+ * persistent field actually differs from what is saved.
+ */
+void settings_store_mark_dirty(const fsm_struct *fsm);
+
+/**
+ * @brief Fit @p fsm to a card holding @p count songs, saving any change
+ *
+ * Call from the UI thread, which owns @p fsm; the card is mounted in the
+ * background, after the settings were loaded.
+ */
+void settings_store_fit_track(fsm_struct *fsm, uint16_t count);
+
+/**
+ * @brief Write pending changes now instead of waiting for the quiet period
+ *
+ * @return int 0 on success (or nothing to write), negative error code otherwise
+ */
+int settings_store_flush(void);
+
+void settings_store_get_stats(settings_store_stats_t *stats);
+
+#endif // SETTINGS_STORE_H
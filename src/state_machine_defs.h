@@ -119,9 +119,9 @@ typedef struct
     //                      2) get_chord 3) get_key_name
     //music_key_enum key;
 
-    uint8_t current_track;
-    uint8_t previous_track;
-    uint8_t total_tracks;
+    uint16_t current_track;
+    uint16_t previous_track;
+    uint16_t total_tracks;
     char track_name[20];
 
     bool pause;
@@ -23,6 +23,8 @@
 #include "hw_interface/i2c_interface.h"
 #include "hw_interface/uart_interface.h"
 #include "hw_interface/inputs_interface/gpio_interface.h"  // Use the new GPIO interface
+#include "hw_interface/latency_probe.h"
+#include "settings_store/settings_store.h"
 
 #include "state_machine_defs.h"
 
@@ -105,6 +107,9 @@ void draw_all_UI(void)
 // Updated interrupt handler using the new GPIO interface
 void input_interrupt_handler(const struct device *port, struct gpio_callback *cb, uint32_t pins)
 {
+    // Stamp the edge before anything else so the probe sees the whole path
+    latency_probe_begin();
+
     // Get GPIO specs using the interface functions
     const struct gpio_dt_spec* enc1sw = get_enc1sw_gpio();
     const struct gpio_dt_spec* enc2sw = get_enc2sw_gpio();
@@ -218,17 +223,28 @@ void input_interrupt_handler(const struct device *port, struct gpio_callback *cb
         fsm.btn[5] = !fsm.btn[5];
         LOG_INF("BTN6 = %d", fsm.btn[5]);
     }
+
+    latency_probe_mark(LATENCY_STAGE_GPIO_ISR);
 }
 
 // Function to handle LCD clearing and drawing when encoders are pressed
 void UI_Handler(fsm_struct* fsm)
 {
+    latency_probe_mark(LATENCY_STAGE_FSM);
+
+    // Songs come and go with the card, which the SD manager mounts in the background
+    uint16_t count = get_track_count();
+    if (count != fsm->total_tracks) {
+        settings_store_fit_track(fsm, count);
+        fsm->draw_ui_entry = true;
+    }
+
     if (fsm->screen_blackout_entry) {
         i2c_lcd_clear();
         fsm->screen_blackout_entry = false;
     } else if (fsm->draw_ui_entry) {
-        // TODO - Patrick: Replace this with function to write settings to SD - not written yet
-        // write_to_sd(fsm);
+        // Only schedules a deferred write, and only if something persistent changed
+        settings_store_mark_dirty(fsm);
         draw_all_UI();
         fsm->draw_ui_entry = false;
     }
@@ -0,0 +1,242 @@
+// main.c - host side .mid -> .smc compiler
+//
+// Produces the same files the instrument builds at boot. A cache made here
+// is only reused on the device if the card keeps the .mid's size and
+// modification time, which copying with a normal file manager does.
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "smf_parser.h"
+#include "smc_format.h"
+#include "smc_compiler.h"
+#include "smk_index.h"
+
+#define PATH_LEN    1024
+
+static uint8_t work[SMC_COMPILE_WORK_SIZE(SMF_MAX_TRACKS)];
+
+static int file_read(void *ctx, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+    FILE *f = ctx;
+
+    if (fseek(f, offset, SEEK_SET) != 0) {
+        return -EIO;
+    }
+    size_t n = fread(buf, 1, len, f);
+    return ferror(f) ? -EIO : (int)n;
+}
+
+static int file_write(void *ctx, uint32_t offset, const uint8_t *buf, uint32_t len)
+{
+    FILE *f = ctx;
+
+    if (fseek(f, offset, SEEK_SET) != 0 || fwrite(buf, 1, len, f) != len) {
+        return -EIO;
+    }
+    return 0;
+}
+
+// Same packing FatFs uses for FILINFO fdate/ftime, in local time like FAT
+static uint32_t fat_mtime(time_t t)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+
+    uint32_t date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    uint32_t time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+    return (date << 16) | time;
+}
+
+static int cache_path(const char *mid, const char *ext, char *out, size_t len)
+{
+    const char *dot = strrchr(mid, '.');
+    const char *slash = strrchr(mid, '/');
+    size_t base = (dot && (!slash || dot > slash)) ? (size_t)(dot - mid) : strlen(mid);
+
+    if (base + strlen(ext) + 1 > len) {
+        return -ENAMETOOLONG;
+    }
+    memcpy(out, mid, base);
+    strcpy(&out[base], ext);
+    return 0;
+}
+
+static int read_head(const char *path, uint8_t *raw, size_t len)
+{
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        return 0;
+    }
+    size_t n = fread(raw, 1, len, f);
+    fclose(f);
+    return n == len;
+}
+
+// Both the .smc and its keyframe index built from this exact .mid
+static int cache_current(const char *smc, const char *smk, const smc_source_info_t *src)
+{
+    uint8_t raw[SMC_HEADER_SIZE > SMK_HEADER_SIZE ? SMC_HEADER_SIZE : SMK_HEADER_SIZE];
+    smc_header_t hdr;
+    smk_header_t index;
+
+    if (!read_head(smc, raw, SMC_HEADER_SIZE) || smc_header_decode(raw, &hdr) != 0 ||
+        !smc_header_matches(&hdr, src)) {
+        return 0;
+    }
+
+    return read_head(smk, raw, SMK_HEADER_SIZE) && smk_header_decode(raw, &index) == 0 &&
+           index.src.size == src->size && index.src.mtime == src->mtime;
+}
+
+// 1 if compiled, 0 if already current, negative on error
+static int compile_one(const char *mid, int force)
+{
+    char smc[PATH_LEN];
+    char smk[PATH_LEN];
+    struct stat st;
+    smc_header_t hdr;
+
+    if (stat(mid, &st) != 0) {
+        fprintf(stderr, "%s: %s\n", mid, strerror(errno));
+        return -errno;
+    }
+    if (cache_path(mid, SMC_EXTENSION, smc, sizeof(smc)) ||
+        cache_path(mid, SMK_EXTENSION, smk, sizeof(smk))) {
+        fprintf(stderr, "%s: path too long\n", mid);
+        return -ENAMETOOLONG;
+    }
+
+    smc_source_info_t src = {
+        .size = (uint32_t)st.st_size,
+        .mtime = fat_mtime(st.st_mtime),
+    };
+
+    if (!force && cache_current(smc, smk, &src)) {
+        printf("%s: up to date\n", smc);
+        return 0;
+    }
+
+    FILE *in = fopen(mid, "rb");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", mid, strerror(errno));
+        return -errno;
+    }
+    FILE *out = fopen(smc, "wb");
+    FILE *idx = fopen(smk, "wb");
+    if (!out || !idx) {
+        int err = errno;
+        fprintf(stderr, "%s: %s\n", out ? smk : smc, strerror(err));
+        fclose(in);
+        if (out) {
+            fclose(out);
+        }
+        if (idx) {
+            fclose(idx);
+        }
+        return -err;
+    }
+
+    smf_io_t io = { .read = file_read, .ctx = in, .size = src.size };
+    smc_writer_t wr = { .write = file_write, .ctx = out };
+    smc_writer_t index = { .write = file_write, .ctx = idx };
+    int ret = smc_compile(&io, &src, &wr, &index, work, sizeof(work), &hdr);
+
+    fclose(in);
+    if (fclose(out) != 0 && ret == 0) {
+        ret = -EIO;
+    }
+    if (fclose(idx) != 0 && ret == 0) {
+        ret = -EIO;
+    }
+
+    if (ret) {
+        fprintf(stderr, "%s: compile failed (%d)\n", mid, ret);
+        remove(smc);
+        remove(smk);
+        return ret;
+    }
+
+    printf("%s: %u tracks, %u events, %u.%03u s\n", smc, hdr.ntracks, hdr.record_count,
+           hdr.duration_us / 1000000, (hdr.duration_us / 1000) % 1000);
+    return 1;
+}
+
+static int is_midi(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot && (strcasecmp(dot, ".mid") == 0 || strcasecmp(dot, ".midi") == 0);
+}
+
+static int compile_dir(const char *dir, int force, int *failed)
+{
+    char path[PATH_LEN];
+    struct dirent *ent;
+    int compiled = 0;
+    DIR *d = opendir(dir);
+
+    if (!d) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        (*failed)++;
+        return 0;
+    }
+
+    while ((ent = readdir(d)) != NULL) {
+        if (!is_midi(ent->d_name)) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
+
+        int ret = compile_one(path, force);
+        if (ret < 0) {
+            (*failed)++;
+        } else {
+            compiled += ret;
+        }
+    }
+
+    closedir(d);
+    return compiled;
+}
+
+int main(int argc, char **argv)
+{
+    int force = 0;
+    int failed = 0;
+    int compiled = 0;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "-f") == 0) {
+        force = 1;
+        first = 2;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "usage: %s [-f] <file.mid | directory>...\n"
+                        "  -f  recompile even if the .smc is up to date\n", argv[0]);
+        return 2;
+    }
+
+    for (int i = first; i < argc; i++) {
+        struct stat st;
+
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            compiled += compile_dir(argv[i], force, &failed);
+        } else {
+            int ret = compile_one(argv[i], force);
+            if (ret < 0) {
+                failed++;
+            } else {
+                compiled += ret;
+            }
+        }
+    }
+
+    printf("%d compiled, %d failed\n", compiled, failed);
+    return failed ? 1 : 0;
+}